@@ -0,0 +1,462 @@
+//
+//  AggregateAudioDevice.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "AggregateAudioDevice.h"
+#include "RealtimeChecker.h"
+
+class AggregateAudioIODevice;
+
+namespace
+{
+    // how hard the resampling pulls the FIFO level back to where it should be, per sample of error,
+    // and the most it is allowed to correct by. Sound cards are within 100ppm of each other or so
+    const double driftGain = 2.0e-6;
+    const double maxCorrection = 0.002;
+    // how quickly the measured FIFO level follows the real one, it jumps about by a block either way
+    const double levelSmoothing = 0.01;
+}
+
+//==============================================================================================
+/** One of the real devices, and for the ones that aren't the clock, the FIFO it writes into */
+class AggregateMember : public AudioIODeviceCallback
+{
+public:
+    AggregateMember(AggregateAudioIODevice& o, AudioIODevice* d, bool isClock)
+    :   owner(o),
+        device(d),
+        clock(isClock),
+        firstChannel(0),
+        numActive(0),
+        target(0),
+        ratio(1.0),
+        level(0),
+        primed(false),
+        dropped(0)
+    {
+
+    }
+
+    /** Gets the FIFO ready once the device is open and the clock's block size is known */
+    void prepare(int clockBlockSize)
+    {
+        numActive = device->getActiveInputChannels().countNumberOfSetBits();
+        const int blockSize = jmax(clockBlockSize, device->getCurrentBufferSizeSamples());
+
+        // a couple of blocks of slack either way, and plenty of room to get that wrong
+        target = 2 * blockSize;
+        fifo.setTotalSize(16 * blockSize);
+        fifoBuffer.setSize(jmax(1, numActive), fifo.getTotalSize());
+        linear.setSize(jmax(1, numActive), (int) (clockBlockSize * (1.0 + maxCorrection)) + 8);
+        resampled.setSize(jmax(1, numActive), clockBlockSize);
+        interpolators.clear();
+        for (int c = 0; c < numActive; c++)
+            interpolators.add(new LagrangeInterpolator());
+        restart();
+    }
+
+    void restart()
+    {
+        fifo.reset();
+        for (LagrangeInterpolator* interpolator : interpolators)
+            interpolator->reset();
+        ratio = 1.0;
+        level = target;
+        primed = false;
+    }
+
+    //==========================================================================================
+    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                               float** outputChannelData, int numOutputChannels, int numSamples) override;
+
+    void audioDeviceAboutToStart(AudioIODevice*) override
+    {
+        restart();
+    }
+
+    void audioDeviceStopped() override
+    {
+
+    }
+
+    /** Called from the clock's callback, fills resampled with numSamples of this member's inputs */
+    void pull(int numSamples)
+    {
+        const int needed = (int) std::ceil(ratio * numSamples) + 1;
+        int ready = fifo.getNumReady();
+
+        // way behind or ahead (a device stalled, or was late starting), start again from the current level
+        if (ready > fifo.getTotalSize() - 2 * needed)
+        {
+            fifo.finishedRead(ready - target);
+            ready = target;
+            for (LagrangeInterpolator* interpolator : interpolators)
+                interpolator->reset();
+        }
+
+        if (!primed)
+            primed = ready >= target + needed;
+
+        if (!primed || ready < needed)
+        {
+            primed = false;
+            resampled.clear();
+            return;
+        }
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(needed, start1, size1, start2, size2);
+        int used = 0;
+        for (int c = 0; c < numActive; c++)
+        {
+            float* in = linear.getSampleData(c);
+            memcpy(in, fifoBuffer.getSampleData(c, start1), sizeof(float) * size1);
+            memcpy(in + size1, fifoBuffer.getSampleData(c, start2), sizeof(float) * size2);
+            used = interpolators[c]->process(ratio, in, resampled.getSampleData(c), numSamples);
+        }
+        fifo.finishedRead(used);
+
+        // keep the FIFO where it should be by reading a little faster or slower
+        level += levelSmoothing * (fifo.getNumReady() - level);
+        ratio = 1.0 + jlimit(-maxCorrection, maxCorrection, (level - target) * driftGain);
+    }
+
+    AggregateAudioIODevice& owner;
+    ScopedPointer<AudioIODevice> device;
+    const bool clock;
+    int firstChannel; // of all the aggregate's inputs
+    int numActive;
+
+    AbstractFifo fifo {2};
+    AudioSampleBuffer fifoBuffer {1, 1};
+    AudioSampleBuffer linear {1, 1};    // what the interpolators read, the FIFO unwrapped
+    AudioSampleBuffer resampled {1, 1}; // a block at the clock's rate
+    OwnedArray<LagrangeInterpolator> interpolators;
+    int target;
+    double ratio;
+    double level;
+    bool primed;
+    int dropped; // blocks that didn't fit in the FIFO
+
+    JUCE_DECLARE_NON_COPYABLE (AggregateMember)
+};
+
+//==============================================================================================
+class AggregateAudioIODevice : public AudioIODevice
+{
+public:
+    AggregateAudioIODevice()
+    :   AudioIODevice(AggregateAudioIODeviceType::deviceName, "Aggregate"),
+        deviceOpen(false),
+        callback(nullptr)
+    {
+
+    }
+
+    ~AggregateAudioIODevice()
+    {
+        close();
+    }
+
+    /** Takes ownership of the device, the first one added is the clock */
+    void addMember(AudioIODevice* device)
+    {
+        AggregateMember* member = new AggregateMember(*this, device, members.size() == 0);
+        member->firstChannel = getInputChannelNames().size();
+        members.add(member);
+    }
+
+    int getNumMembers() const { return members.size(); }
+
+    //==========================================================================================
+    StringArray getOutputChannelNames() override { return StringArray(); }
+
+    StringArray getInputChannelNames() override
+    {
+        StringArray names;
+        for (AggregateMember* member : members)
+        {
+            StringArray memberNames = member->device->getInputChannelNames();
+            for (int i = 0; i < memberNames.size(); i++)
+                names.add(member->device->getName() + ": " + memberNames[i]);
+        }
+        return names;
+    }
+
+    int getNumSampleRates() override                { return clock().getNumSampleRates(); }
+    double getSampleRate(int index) override        { return clock().getSampleRate(index); }
+    int getNumBufferSizesAvailable() override       { return clock().getNumBufferSizesAvailable(); }
+    int getBufferSizeSamples(int index) override    { return clock().getBufferSizeSamples(index); }
+    int getDefaultBufferSize() override             { return clock().getDefaultBufferSize(); }
+
+    String open(const BigInteger& inputChannels, const BigInteger&, double sampleRate, int bufferSizeSamples) override
+    {
+        close();
+
+        int numActive = 0;
+        for (AggregateMember* member : members)
+        {
+            // this member's share of the channels
+            const int count = member->device->getInputChannelNames().size();
+            BigInteger memberInputs = inputChannels.getBitRange(member->firstChannel, count);
+            if (memberInputs.isZero() && !member->clock)
+                continue;
+
+            String error = member->device->open(memberInputs, BigInteger(), sampleRate, bufferSizeSamples);
+            if (error.isEmpty() && member->device->getCurrentSampleRate() != clock().getCurrentSampleRate())
+                error = "runs at a different sample rate to " + clock().getName();
+            if (error.isNotEmpty())
+            {
+                close();
+                lastError = member->device->getName() + ": " + error;
+                return lastError;
+            }
+
+            member->prepare(clock().getCurrentBufferSizeSamples());
+            numActive += member->numActive;
+        }
+
+        inputs.calloc((size_t) jmax(1, numActive));
+        numInputs = numActive;
+        deviceOpen = true;
+        lastError = String::empty;
+        return lastError;
+    }
+
+    void close() override
+    {
+        stop();
+        for (AggregateMember* member : members)
+            member->device->close();
+        deviceOpen = false;
+    }
+
+    bool isOpen() override                          { return deviceOpen; }
+
+    void start(AudioIODeviceCallback* newCallback) override
+    {
+        if (newCallback != nullptr)
+            newCallback->audioDeviceAboutToStart(this);
+        {
+            const SpinLock::ScopedLockType sl(callbackLock);
+            callback = newCallback;
+        }
+
+        // the clock last, so the others have something in their FIFOs by the time it wants it
+        for (int i = members.size(); --i >= 0;)
+            if (members[i]->device->isOpen())
+                members[i]->device->start(members[i]);
+    }
+
+    void stop() override
+    {
+        for (AggregateMember* member : members)
+            member->device->stop();
+
+        AudioIODeviceCallback* old;
+        {
+            const SpinLock::ScopedLockType sl(callbackLock);
+            old = callback;
+            callback = nullptr;
+        }
+        if (old != nullptr)
+            old->audioDeviceStopped();
+    }
+
+    bool isPlaying() override                       { return callback != nullptr; }
+    String getLastError() override                  { return lastError; }
+    int getCurrentBufferSizeSamples() override      { return clock().getCurrentBufferSizeSamples(); }
+    double getCurrentSampleRate() override          { return clock().getCurrentSampleRate(); }
+    int getCurrentBitDepth() override               { return clock().getCurrentBitDepth(); }
+    BigInteger getActiveOutputChannels() const override { return BigInteger(); }
+    int getOutputLatencyInSamples() override        { return 0; }
+    int getInputLatencyInSamples() override         { return clock().getInputLatencyInSamples(); }
+
+    BigInteger getActiveInputChannels() const override
+    {
+        BigInteger active;
+        for (AggregateMember* member : members)
+            if (member->device->isOpen())
+                active |= member->device->getActiveInputChannels() << member->firstChannel;
+        return active;
+    }
+
+    //==========================================================================================
+    /** The clock's callback, this is where the aggregate's callback happens */
+    void clockCallback(const float** clockInputs, int numClockInputs, int numSamples)
+    {
+        int n = 0;
+        {
+            // only what's ours, the downstream callback takes its own locks and answers for them
+            RealtimeChecker::ScopedRealtimeSection realtime;
+            for (AggregateMember* member : members)
+            {
+                if (member->clock)
+                {
+                    for (int c = 0; c < numClockInputs && n < numInputs; c++)
+                        inputs[n++] = clockInputs[c];
+                }
+                else if (member->numActive > 0)
+                {
+                    member->pull(numSamples);
+                    for (int c = 0; c < member->numActive && n < numInputs; c++)
+                        inputs[n++] = member->resampled.getSampleData(c);
+                }
+            }
+        }
+
+        // start() or stop() has it, skip the block rather than wait for the message thread
+        const GenericScopedTryLock<SpinLock> lock(callbackLock);
+        if (lock.isLocked() && callback != nullptr)
+            callback->audioDeviceIOCallback(inputs, n, nullptr, 0, numSamples);
+    }
+
+private:
+    OwnedArray<AggregateMember> members;
+    bool deviceOpen;
+    String lastError;
+    HeapBlock<const float*> inputs;
+    int numInputs;
+    SpinLock callbackLock;
+    AudioIODeviceCallback* callback;
+
+    AudioIODevice& clock() const { return *members.getFirst()->device; }
+
+    JUCE_DECLARE_NON_COPYABLE (AggregateAudioIODevice)
+};
+
+//==============================================================================================
+void AggregateMember::audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                                            float** outputChannelData, int numOutputChannels, int numSamples)
+{
+    if (clock)
+    {
+        owner.clockCallback(inputChannelData, numInputChannels, numSamples);
+        return;
+    }
+
+    RealtimeChecker::ScopedRealtimeSection realtime;
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+    if (size1 + size2 < numSamples) // the clock has stopped taking them, pull() sorts it out when it's back
+    {
+        dropped++;
+        return;
+    }
+
+    for (int c = 0; c < numActive; c++)
+    {
+        const float* in = c < numInputChannels ? inputChannelData[c] : nullptr;
+        if (in != nullptr)
+        {
+            memcpy(fifoBuffer.getSampleData(c, start1), in, sizeof(float) * size1);
+            memcpy(fifoBuffer.getSampleData(c, start2), in + size1, sizeof(float) * size2);
+        }
+        else
+        {
+            FloatVectorOperations::clear(fifoBuffer.getSampleData(c, start1), size1);
+            FloatVectorOperations::clear(fifoBuffer.getSampleData(c, start2), size2);
+        }
+    }
+    fifo.finishedWrite(numSamples);
+}
+
+//==============================================================================================
+const char* const AggregateAudioIODeviceType::deviceName = "Aggregate";
+
+AggregateAudioIODeviceType::AggregateAudioIODeviceType(const StringArray& m)
+:   AudioIODeviceType("Aggregate"),
+    members(m),
+    scanned(false)
+{
+    // the manager only makes these for itself, so borrow one to make a set of our own
+    AudioDeviceManager platform;
+    platform.createAudioDeviceTypes(types);
+}
+
+void AggregateAudioIODeviceType::scanForDevices()
+{
+    for (AudioIODeviceType* type : types)
+        type->scanForDevices();
+    scanned = true;
+}
+
+StringArray AggregateAudioIODeviceType::getDeviceNames(bool wantInputNames) const
+{
+    return StringArray(deviceName);
+}
+
+int AggregateAudioIODeviceType::getDefaultDeviceIndex(bool forInput) const
+{
+    return 0;
+}
+
+int AggregateAudioIODeviceType::getIndexOfDevice(AudioIODevice* device, bool asInput) const
+{
+    return device != nullptr && device->getName() == deviceName ? 0 : -1;
+}
+
+bool AggregateAudioIODeviceType::hasSeparateInputsAndOutputs() const
+{
+    return false;
+}
+
+AudioIODevice* AggregateAudioIODeviceType::createDevice(const String& outputDeviceName, const String& inputDeviceName)
+{
+    if (!scanned)
+        scanForDevices();
+
+    Array<int> typeIndices;
+    StringArray names;
+    findMembers(typeIndices, names);
+
+    ScopedPointer<AggregateAudioIODevice> aggregate = new AggregateAudioIODevice();
+    for (int i = 0; i < names.size(); i++)
+    {
+        AudioIODevice* device = types[typeIndices[i]]->createDevice(String::empty, names[i]);
+        if (device != nullptr)
+            aggregate->addMember(device);
+    }
+
+    return aggregate->getNumMembers() > 0 ? aggregate.release() : nullptr;
+}
+
+void AggregateAudioIODeviceType::findMembers(Array<int>& typeIndices, StringArray& names) const
+{
+    if (members.size() > 0)
+    {
+        for (int i = 0; i < members.size(); i++)
+        {
+            const String typeName = members[i].upToFirstOccurrenceOf(":", false, false).trim();
+            const String name = members[i].fromFirstOccurrenceOf(":", false, false).trim();
+            for (int t = 0; t < types.size(); t++)
+            {
+                if (types[t]->getTypeName() == typeName && types[t]->getDeviceNames(true).contains(name))
+                {
+                    typeIndices.add(t);
+                    names.add(name);
+                    break;
+                }
+            }
+        }
+        return;
+    }
+
+    for (int t = 0; t < types.size(); t++)
+    {
+        const StringArray inputs = types[t]->getDeviceNames(true);
+        if (inputs.size() > 0)
+        {
+            for (int i = 0; i < inputs.size(); i++)
+            {
+                typeIndices.add(t);
+                names.add(inputs[i]);
+            }
+            return;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+//
+//  AggregateAudioDevice.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__AggregateAudioDevice__
+#define __SwivelAutotune__AggregateAudioDevice__
+
+#include "CoreJuceHeader.h"
+
+/** An audio device type with one device, "Aggregate", whose inputs are the inputs of several real
+    devices one after the other, for instruments with more strings than one interface has inputs.
+
+    The first member is the clock. The others each feed a FIFO from their own callbacks, and the
+    first member's callback takes a block from each FIFO, resampled slightly faster or slower to keep
+    the FIFO at a steady level, so the other devices' clocks drifting doesn't make them slowly fall
+    behind or overrun. Their inputs arrive a fixed couple of blocks later than the first member's,
+    which is the same as any other latency as far as the analysis is concerned.
+ */
+class AggregateAudioIODeviceType : public AudioIODeviceType
+{
+public:
+    /** Members are "type:device", a device type's name then the name of one of its input devices,
+        eg. "ALSA:USB Audio CODEC". With no members it uses every input device of the first type
+        that has any. */
+    AggregateAudioIODeviceType(const StringArray& members = StringArray());
+
+    void scanForDevices() override;
+    StringArray getDeviceNames(bool wantInputNames) const override;
+    int getDefaultDeviceIndex(bool forInput) const override;
+    int getIndexOfDevice(AudioIODevice* device, bool asInput) const override;
+    bool hasSeparateInputsAndOutputs() const override;
+    AudioIODevice* createDevice(const String& outputDeviceName, const String& inputDeviceName) override;
+
+    static const char* const deviceName;
+
+private:
+    // the platform's own types, to make the members with
+    OwnedArray<AudioIODeviceType> types;
+    StringArray members;
+    bool scanned;
+
+    /** Works out which devices to use, as type index and device name */
+    void findMembers(Array<int>& typeIndices, StringArray& names) const;
+
+    JUCE_DECLARE_NON_COPYABLE (AggregateAudioIODeviceType)
+};
+
+#endif /* defined(__SwivelAutotune__AggregateAudioDevice__) */
@@ -7,17 +7,23 @@
 //
 
 #include "AnalysisThread.h"
+#include "RealtimeChecker.h"
+#include "Trace.h"
 
-AnalysisThread::AnalysisThread(AudioDeviceManager *manager, MidiOutput *mout, OwnedArray<SwivelString, CriticalSection> *strings, MainComponent* m)
+AnalysisThread::AnalysisThread(AudioDeviceManager *manager, MidiScheduler *mout, OwnedArray<SwivelString, CriticalSection> *strings, Listener* l)
 :   Thread("Analysis Thread"),
     deviceManager(manager),
     midiOut(mout),
     swivelStrings(strings),
-    console(nullptr),
-    main(m),
+    calibrateAll(true),
+    logger(nullptr),
+    listener(l),
+    latencies(&ownLatencies),
     audio(nullptr),
     spectrum(nullptr),
-    failed(false)
+    failed(false),
+    windowType(Windowing::HANN),
+    tableBuilder(1)
 {
     
 }
@@ -30,10 +36,22 @@ AnalysisThread::~AnalysisThread()
 //====================================================================================================================
 void AnalysisThread::run()
 {
-    if (swivelStrings->size() == 0)
+    if (calibrateAll)
+    {
+        const ScopedLock sl(swivelStrings->getLock());
+        toCalibrate = Array<SwivelString*>(swivelStrings->getRawDataPointer(), swivelStrings->size());
+    }
+    if (toCalibrate.size() == 0)
         throw std::invalid_argument("Can't process without any info");
     
     log("New thread started\n");
+    if (!scheduling.isDefault())
+    {
+        const Result scheduled = scheduling.applyToCurrentThread();
+        log(scheduled ? "Analysis thread scheduled " + scheduling.toString() + "\n"
+                      : "Couldn't schedule the analysis thread " + scheduling.toString() + ": " + scheduled.getErrorMessage() + "\n",
+            scheduled ? LogQueue::info : LogQueue::warning);
+    }
     // set up buffers
     log("Allocating buffers\n");
     audio    = (double*)       fftw_malloc(sizeof(double)*fft_size);
@@ -47,68 +65,233 @@ void AnalysisThread::run()
     }
     log("Generating FFT plan\n");
     int64 time = Time::getHighResolutionTicks();
-    fftw_plan plan = fftw_plan_dft_r2c_1d(fft_size, audio, spectrum, FFTW_EXHAUSTIVE);
+    {
+        Trace::ScopedEvent event("fft plan");
+        plan = fftw_plan_dft_r2c_1d(fft_size, audio, spectrum, FFTW_EXHAUSTIVE);
+    }
     log(String("Generated, took: ") + String(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks()-time)) + " s\n");
     
     if (saveWisdom)
     {
         log("saving plan for later\n");
         if(!fftw_export_wisdom_to_filename(("./fftwisdom" + std::to_string(fft_size)).data()))
-            log("failed writing to file\n");
+            log("failed writing to file\n", LogQueue::warning);
     }
     
-    for (int i = 0; i < swivelStrings->size(); i++) // for each string
+    // one capture for the whole run, so the strings never have to be added to the device
+    // and nothing from before an onset is lost
+    capture = new CaptureRing(*midiOut);
+    capture->setThresholds((float) rmsUp, (float) rmsDown);
+    deviceManager->addAudioCallback(capture);
+    
+    // the pipeline, in order of excitation
+    OwnedArray<Stage> pipeline;
+    int next = 0;
+    
+    while (next < toCalibrate.size() || pipeline.size() > 0)
     {
-        SwivelString* current = (*swivelStrings)[i];
-        if (current->isReadyToTransform()) // then this must have been done before
-            current->reset();
-        // make sure they're good to go on the audio front
-        current->initialiseAudioParameters(plan, audio, spectrum, fft_size,
-                                           deviceManager->getCurrentAudioDevice()->getCurrentSampleRate(),
-                                           overlap, rmsUp, rmsDown);
-        // make sure we're good to go
-        if (!current->isFullyInitialised())
-        {
-            log("ERROR: string not fully initialised, probably missing file data\n");
-            break;
-        }
+        uint32 now = midiOut->getMillisecondCounter();
         
-        // send the midi
-        log("Sending MIDI\n");
+        // let in the next strings, only ever one waiting to be excited at a time
+        bool waiting = false;
+        for (Stage* stage : pipeline)
+            waiting = waiting || !stage->excited;
         
-        midiOut->sendBlockOfMessages(*current->getMidiBuffer(), Time::getMillisecondCounter()+100, 44100);
-        log("Midi begun, waiting: " + String(current->getWaitTime()+100) + "ms\n");
-        
-        current->setAnalysisThread(this); // all ready to go
-        
-        // wait the specified time
-        wait(current->getWaitTime()+1000);
-        log("Starting listening\n");
-        deviceManager->addAudioCallback(current);
-        
-        // somehow know when it has done its work
-        if (!wait(15000))
+        if (!waiting && next < toCalibrate.size())
         {
-            log("Processing timeout expired\n");
+            Stage* stage = admit(toCalibrate[next++]);
+            if (stage == nullptr)
+                next = toCalibrate.size(); // no more, but let the ones going finish
+            else
+                pipeline.add(stage);
         }
-        else
+        
+        for (int i = 0; i < pipeline.size(); i++)
         {
-         log("Determined pitch: " + String(current->getBestFreq()) + "\n");
+            Stage* stage = pipeline[i];
+            if (!stage->excited)
+            {
+                if (now >= stage->excitableAt && !channelIsBusy(stage->string->getAudioChannel(), pipeline))
+                    excite(stage);
+                continue;
+            }
+            
+            if (!stage->listening && stage->probe->poll())
+                startListening(stage);
+            
+            if (stage->listening)
+                feed(stage);
+            
+            if (stage->string->hasFinishedListening())
+            {
+                tableBuilder.addJob(new TableBuildJob(stage->string, this), true);
+                pipeline.remove(i--);
+            }
+            else if (now >= stage->timeoutAt)
+            {
+                log(stage->listening ? "Processing timeout expired\n" : "Never heard the string\n", LogQueue::warning);
+                pipeline.remove(i--);
+            }
         }
         
-        //tidy up
-        deviceManager->removeAudioCallback(current);
-        
         if (threadShouldExit())
         {
             failed = true;
             break;
         }
+        
+        // check back in a bit for the timed things
+        Trace::ScopedEvent event("wait");
+        midiOut->waitFor(*this, 10);
     }
+    
+    //tidy up
+    deviceManager->removeAudioCallback(capture);
+    log(latencies->getSummary());
+    
+    if (failed)
+        tableBuilder.removeAllJobs(true, 1000);
+    else
+        while (tableBuilder.getNumJobs() > 0)
+            wait(10);
+    
+#ifdef DEBUG
+    log(RealtimeChecker::report(), LogQueue::debug);
+    RealtimeChecker::clear();
+#endif
+    
     // and exit gracefully
     exitThread();
 }
 
+AnalysisThread::Stage* AnalysisThread::admit(SwivelString* current)
+{
+    Trace::ScopedEvent event("admit");
+    
+    if (current->isReadyToTransform()) // then this must have been done before
+        current->reset();
+    // make sure they're good to go on the audio front
+    current->initialiseAudioParameters(plan, audio, spectrum, fft_size,
+                                       deviceManager->getCurrentAudioDevice()->getCurrentSampleRate(),
+                                       overlap, rmsUp, rmsDown, windowType);
+    // make sure we're good to go
+    if (!current->isFullyInitialised())
+    {
+        log("ERROR: string not fully initialised, probably missing file data\n", LogQueue::error);
+        return nullptr;
+    }
+    if (current->getAudioChannel() >= deviceManager->getCurrentAudioDevice()->getActiveInputChannels().countNumberOfSetBits())
+    {
+        log("ERROR: string on channel " + String(current->getMidiChannel()) + " is routed to an input that isn't open\n", LogQueue::error);
+        return nullptr;
+    }
+    if (current->getMidiPort() >= midiOut->getNumPorts())
+    {
+        log("ERROR: string on channel " + String(current->getMidiChannel()) + " is on MIDI port " + String(current->getMidiPort())
+            + " which isn't open\n", LogQueue::error);
+        return nullptr;
+    }
+    current->setAnalysisThread(this); // all ready to go
+    
+    // get it into position, this is fine to do while another string is ringing
+    log("Sending MIDI\n");
+    uint32 start = midiOut->getMillisecondCounter() + sendOffset;
+    midiOut->sendBlockOfMessages(current->getMidiPort(), *current->getPreparationBuffer(), start, 44100);
+    
+    Stage* stage = new Stage();
+    stage->string = current;
+    stage->excitableAt = start + (uint32) current->getPreparationTime() - sendOffset;
+    stage->timeoutAt = 0;
+    stage->readPosition = 0;
+    stage->excited = false;
+    stage->listening = false;
+    return stage;
+}
+
+void AnalysisThread::excite(Stage* stage)
+{
+    Trace::ScopedEvent event("excite");
+    
+    uint32 at = midiOut->getMillisecondCounter() + sendOffset;
+    midiOut->sendBlockOfMessages(stage->string->getMidiPort(), *stage->string->getExcitationBuffer(), at, 44100);
+    
+    // look for it in the capture from when the message goes out
+    stage->probe = new LatencyProbe(*capture, stage->string->getAudioChannel(), at);
+    stage->excited = true;
+    
+    // don't wait forever for a string that isn't going to sound, though if it's never been heard give it a while
+    const int port = stage->string->getMidiPort(), channel = stage->string->getMidiChannel();
+    if (latencies->hasMeasurement(port, channel))
+        stage->timeoutAt = at + (uint32) jmax((double) onsetTimeout, 4.0 * latencies->getExpectedLatency(port, channel));
+    else
+        stage->timeoutAt = at + listenTimeout;
+    log("Midi begun\n");
+}
+
+void AnalysisThread::startListening(Stage* stage)
+{
+    Trace::instant("onset");
+    
+    const double latency = stage->probe->getLatency();
+    latencies->addMeasurement(stage->string->getMidiPort(), stage->string->getMidiChannel(), latency);
+    log("Onset heard after " + String(latency, 1) + "ms, starting listening\n");
+    
+    stage->listening = true;
+    stage->readPosition = stage->probe->getOnsetSample();
+    stage->timeoutAt = midiOut->getMillisecondCounter() + listenTimeout;
+}
+
+void AnalysisThread::feed(Stage* stage)
+{
+    Trace::ScopedEvent event("feed");
+    const int channel = stage->string->getAudioChannel();
+    const int chunkSize = CaptureRing::chunkSize;
+    const int64 available = capture->getNumChunksWritten();
+    int64 chunk = stage->readPosition / chunkSize;
+    
+    while (!stage->string->hasFinishedListening() && chunk < available)
+    {
+        // as much as there is up to a feed's worth, stopping where the gate closes
+        int length = 0;
+        bool closed = false;
+        bool overrun = false;
+        for (bool open; length < feedSize / chunkSize && chunk + length < available; length++)
+        {
+            if (!capture->readGate(channel, chunk + length, open))
+                overrun = true;
+            else if (!open)
+                closed = true;
+            if (overrun || closed)
+                break;
+        }
+        
+        if (!overrun && length > 0)
+            overrun = !capture->read(channel, chunk * chunkSize, feedBuffer, length * chunkSize);
+        
+        if (overrun)
+        {
+            // fallen so far behind the capture has gone round, skip to what's still there
+            log("Capture overrun, skipping ahead\n", LogQueue::warning);
+            chunk = (capture->getOldestAvailable() + chunkSize - 1) / chunkSize;
+            continue;
+        }
+        
+        stage->string->processSamples(feedBuffer, length * chunkSize);
+        chunk += length;
+        if (closed)
+            stage->string->stopListening();
+    }
+    stage->readPosition = chunk * chunkSize;
+}
+
+bool AnalysisThread::channelIsBusy(int channel, const OwnedArray<Stage>& pipeline) const
+{
+    for (Stage* stage : pipeline)
+        if (stage->excited && stage->string->getAudioChannel() == channel)
+            return true;
+    return false;
+}
+
 void AnalysisThread::exitThread()
 {
     if (audio != nullptr)
@@ -117,19 +300,35 @@ void AnalysisThread::exitThread()
         free(spectrum);
     
     if (failed)
-        (new AnalysisEndMessage(Result::fail("Thread exited early, state undefined."), main))->post();
+        (new AnalysisEndMessage(Result::fail("Thread exited early, state undefined."), listener))->post();
     else
-        (new AnalysisEndMessage(Result::ok(), main))->post();
+        (new AnalysisEndMessage(Result::ok(), listener))->post();
 }
 
 
 //=====================================================================================================================
-void AnalysisThread::setConsole(TextEditor* where)
+void AnalysisThread::setLog(LogQueue* where)
 {
-    console = where;
+    logger = where;
 }
 
-void AnalysisThread::setProcessingParams(int size, int overlap, double upThresh, double downThresh)
+void AnalysisThread::setLatencyProfile(LatencyProfile* profile)
+{
+    latencies = profile != nullptr ? profile : &ownLatencies;
+}
+
+void AnalysisThread::setScheduling(const ThreadScheduling& newScheduling)
+{
+    scheduling = newScheduling;
+}
+
+void AnalysisThread::setStringsToCalibrate(const Array<SwivelString*>& strings)
+{
+    toCalibrate = strings;
+    calibrateAll = false;
+}
+
+void AnalysisThread::setProcessingParams(int size, int overlap, double upThresh, double downThresh, Windowing::WindowType window)
 {
     fft_size = size;
     this->overlap = overlap; // just to be clear
@@ -138,21 +337,40 @@ void AnalysisThread::setProcessingParams(int size, int overlap, double upThresh,
     
     rmsUp   = upThresh;
     rmsDown = downThresh;
+    
+    windowType = window;
 }
 
 //=====================================================================================================================
-void AnalysisThread::log(String msg)
+void AnalysisThread::log(String msg, LogQueue::Level level)
 {
-    if (console == nullptr)
+    if (logger == nullptr)
         return;
     
-    MessageManagerLock mml; // get a lock on the message manager thread
-    console->insertTextAtCaret(msg); // write the mesage
-    //std::cout << msg;
+    logger->push(msg, level); // never waits for the message thread
+}
+
+//======================================================================================================================
+AnalysisThread::TableBuildJob::TableBuildJob(SwivelString* s, AnalysisThread* o)
+:   ThreadPoolJob("Table Builder"),
+    string(s),
+    owner(o)
+{
+    
+}
+
+ThreadPoolJob::JobStatus AnalysisThread::TableBuildJob::runJob()
+{
+    {
+        Trace::ScopedEvent event("table build");
+        string->processFrequencies();
+    }
+    owner->log("Determined pitch: " + String(string->getBestFreq()) + "\n");
+    return jobHasFinished;
 }
 
 //======================================================================================================================
 void AnalysisThread::AnalysisEndMessage::messageCallback()
 {
-    main->notifyResult(result);
+    listener->analysisFinished(result);
 }
\ No newline at end of file
@@ -9,23 +9,43 @@
 #ifndef __SwivelAutotune__AnalysisThread__
 #define __SwivelAutotune__AnalysisThread__
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#include "CoreJuceHeader.h"
 #include "String.h"
-
-class MainComponent;
-#include "MainComponent.h"
+#include "LogQueue.h"
+#include "Windowing.h"
+#include "MidiScheduler.h"
+#include "CaptureRing.h"
+#include "LatencyProbe.h"
+#include "ThreadScheduling.h"
 
 /** A thread to perform our analysis.
  *  Note that this thread will likely not
  *  respond to 'threadShouldExit()'
  *  messages, because it doesn't make 
  *  much sense to
+ *
+ *  Strings are calibrated as a pipeline: while one string is being listened to the next one
+ *  is already having its MIDI sent, and the lookup tables are built on a separate worker.
+ *  Strings that share an audio channel are never excited while another is using that channel.
+ *
+ *  All the inputs are captured and gated by a CaptureRing for the whole run, which is the only
+ *  audio callback. After each excitation a LatencyProbe finds the onset in the capture, and the
+ *  string is fed the gated audio from there on this thread, so listening never starts late and
+ *  nothing has to wait for a worst case delay.
  */
 class AnalysisThread : public Thread
 {
 public:
+    /** Gets told how the analysis went, on the message thread */
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        virtual void analysisFinished(Result result) = 0;
+    };
+    
     // Constructs a new thread, needs a few references to get going
-    AnalysisThread(AudioDeviceManager *manager, MidiOutput *mout, OwnedArray<SwivelString, CriticalSection> *strings, MainComponent* m);
+    AnalysisThread(AudioDeviceManager *manager, MidiScheduler *mout, OwnedArray<SwivelString, CriticalSection> *strings, Listener* l);
     ~AnalysisThread();
     
     /** Run method, gets called in a new thread when start() is called,
@@ -33,33 +53,81 @@ public:
      *  run in a new thread */
     void run() override;
     
-    /** Sets the console to use for output. If nullptr nothing is output */
-    void setConsole(TextEditor* where);
-    /** Sets the FFT size and overlap, onset threshold up and onset threshold down (in that order)*/
-    void setProcessingParams(int size, int overlap, double rmsUp, double rmsDown);
+    /** Sets the queue to log to. If nullptr nothing is output */
+    void setLog(LogQueue* where);
+    /** Sets where measured latencies are kept, so they can outlive the thread. By default it keeps its own */
+    void setLatencyProfile(LatencyProfile* profile);
+    /** How the thread should be scheduled, applied when it starts. Failing to only gets a warning */
+    void setScheduling(const ThreadScheduling& newScheduling);
+    /** Only calibrates these of the strings, eg. the ones a coordinator handed this instance, in this
+        order. Set it before starting, by default it's all of them */
+    void setStringsToCalibrate(const Array<SwivelString*>& strings);
+    /** Sets the FFT size and overlap, onset threshold up, onset threshold down and window (in that order)*/
+    void setProcessingParams(int size, int overlap, double rmsUp, double rmsDown, Windowing::WindowType window);
     
     class AnalysisEndMessage : public CallbackMessage
     {
     public:
-        AnalysisEndMessage(Result r, MainComponent* m) : result(r), main(m) {};
+        AnalysisEndMessage(Result r, Listener* l) : result(r), listener(l) {};
         void messageCallback();
         
     private:
         Result result;
-        MainComponent* main;
+        Listener* listener;
     };
     
 private:
+    //==================================================================================
+    /** Builds a string's lookup table off the analysis thread */
+    class TableBuildJob : public ThreadPoolJob
+    {
+    public:
+        TableBuildJob(SwivelString* s, AnalysisThread* o);
+        JobStatus runJob() override;
+        
+    private:
+        SwivelString* string;
+        AnalysisThread* owner;
+    };
+    
+    /** Where a string is in the pipeline, times are from the MIDI scheduler's clock */
+    struct Stage
+    {
+        SwivelString* string;
+        uint32 excitableAt; // when the preparation messages will have been sent
+        uint32 timeoutAt;   // when to give up waiting for the onset, then listening
+        int64 readPosition; // the next sample of the capture to give the string
+        bool excited;
+        bool listening;
+        ScopedPointer<LatencyProbe> probe; // finds the onset in the capture
+    };
+    
+    // how far ahead of time MIDI gets handed to the output's background thread, just enough for it to wake up
+    static const int sendOffset = 20;
+    // how long to wait for a string that has been heard before to sound, at least
+    static const int onsetTimeout = 2000;
+    // how long to listen before giving up
+    static const int listenTimeout = 15000;
+    // how much of the capture the strings are given at a time
+    static const int feedSize = 512;
+    
+    //==================================================================================
     // The audio input device
     AudioDeviceManager* deviceManager;
-    MidiOutput* midiOut;
+    MidiScheduler* midiOut;
     OwnedArray<SwivelString, CriticalSection>* swivelStrings;
-    TextEditor* console;
-    MainComponent* main;
+    Array<SwivelString*> toCalibrate;
+    bool calibrateAll;
+    LogQueue* logger;
+    Listener* listener;
+    LatencyProfile* latencies;
+    LatencyProfile ownLatencies;
+    ThreadScheduling scheduling;
     
     // processing buffers
     double* audio;
     fftw_complex* spectrum;
+    fftw_plan plan;
     // processing params
     int fft_size;
     int overlap;
@@ -67,10 +135,27 @@ private:
     bool failed;
     double rmsUp;
     double rmsDown;
+    Windowing::WindowType windowType;
+    
+    // makes the tables while the next string is going
+    ThreadPool tableBuilder;
     
+    // every input, for the whole run
+    ScopedPointer<CaptureRing> capture;
+    float feedBuffer[feedSize];
     
-    void log(String message);
+    void log(String message, LogQueue::Level level = LogQueue::info);
     void exitThread();
+    /** Sets up the next string and sends its preparation messages, returns nullptr if it couldn't */
+    Stage* admit(SwivelString* string);
+    /** Sends the message which actually makes the noise */
+    void excite(Stage* stage);
+    /** Records the latency once the probe has found the onset, and starts the string from there */
+    void startListening(Stage* stage);
+    /** Gives the string everything captured since last time */
+    void feed(Stage* stage);
+    /** True if a string that has already been excited is using the given audio channel */
+    bool channelIsBusy(int channel, const OwnedArray<Stage>& pipeline) const;
 };
 
 #endif /* defined(__SwivelAutotune__AnalysisThread__) */
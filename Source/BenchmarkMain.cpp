@@ -0,0 +1,492 @@
+//
+//  BenchmarkMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  Times the hot paths of the analysis and the MIDI transform and writes the results out as JSON,
+//  so two runs can be diffed to spot regressions. Build it in release, the realtime checker in
+//  debug builds makes the audio callback numbers meaningless.
+//
+//  On Linux the CPU's counters (cycles, instructions, cache and branch misses) are read around the
+//  same measured code and reported per FFT frame, message or call next to the timings. If perf is
+//  locked down (perf_event_paranoid above 2) or there's no PMU, as in most VMs, they're left out.
+//
+//      swivel-bench [output file, default ./benchmarks.json]
+//
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include "CoreJuceHeader.h"
+#include "String.h"
+#include "SwivelStringFileParser.h"
+#include "PerfCounters.h"
+
+namespace
+{
+    const double sampleRate = 44100.0;
+    const int blockSize = 512;
+    // the same options the GUI offers
+    const int FFTSizes[] = { 512, 1024, 2048, 4096, 8192, 16384, 32768 };
+    const int overlapOptions[] = { 1, 2, 3, 4 };
+    const Windowing::WindowType windows[] = { Windowing::HANN, Windowing::HAMMING, Windowing::BLACKMAN, Windowing::RECTANGULAR };
+    const char* windowNames[] = { "hann", "hamming", "blackman", "rectangular" };
+    // somewhere between the measured fundamentals below
+    const double fundamental = 106.0;
+
+    /** One string's worth of data file, the same shape as newxml.xml */
+    String makeStringXml(int number, int midiChannel)
+    {
+        String status(176 + ((midiChannel-1) & 0xf)); // control change on the string's channel
+        return "<swivelstring number=\"" + String(number) + "\">\n"
+               "    <measurements fundamental=\"116\">\n"
+               "        145.34,150.73,156.11,159,166.88,174.95,180.34,188.41,193.79,199.18,209.94,220.71,228.79,242.24,255.7,271.85,290.69,306.84,325,344.53\n"
+               "    </measurements>\n"
+               "    <measurements fundamental=\"106\">\n"
+               "        129.2,134.58,139.96,145.34,148.04,156.11,161.49,166.88,172.26,177.64,185.72,193.79,201.87,209.94,220.72,236.86,247.63,269.16,288.01,306.84\n"
+               "    </measurements>\n"
+               "    <measurements fundamental=\"96\">\n"
+               "        118.43,123.81,129.2,131.81,137.27,142.65,145.35,150.73,156.11,161.59,169.57,177.64,185.72,191.11,201.87,215.33,228.79,247.63,263.78,285.31\n"
+               "    </measurements>\n"
+               "    <targets>\n"
+               "        110.0,116.54,123.47,130.81,138.59,146.83,155.56,164.81,174.61,185,196,207.65,220,233.08,246.94,261.63,277.18,293.66,311.13,329.63,349.23,369.99,392,415.3,440\n"
+               "    </targets>\n"
+               "    <midimsbs>\n"
+               "        100,95,90,85,80,75,70,65,60,55,50,45,40,35,30,25,20,15,10,5\n"
+               "    </midimsbs>\n"
+               "    <midimessages>\n"
+               "        <message time=\"0.1\">\n"
+               "            " + status + ",8,90\n"
+               "        </message>\n"
+               "        <message time=\"0.1\">\n"
+               "            " + status + ",9,127\n"
+               "        </message>\n"
+               "        <message time=\"0.6\">\n"
+               "            " + status + ",7,127\n"
+               "        </message>\n"
+               "    </midimessages>\n"
+               "</swivelstring>\n";
+    }
+
+    /** A few decaying partials, roughly what a plucked string gives */
+    void synthesise(float* out, int numSamples, double f0)
+    {
+        for (int i = 0; i < numSamples; i++)
+        {
+            double t = i / sampleRate;
+            double sample = 0;
+            for (int partial = 1; partial <= 6; partial++)
+                sample += std::exp(-t * partial) / partial * std::sin(2.0 * M_PI * f0 * partial * t);
+            out[i] = (float) (0.3 * sample);
+        }
+    }
+
+    // juce's high resolution ticks are only microseconds on linux, which is too coarse for most of these
+    typedef std::chrono::steady_clock Clock;
+    
+    int64 now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    //==========================================================================================
+    /** Collects timings and boils them down */
+    class Samples
+    {
+    public:
+        /** Adds a measurement which covered the given number of operations */
+        void add(int64 elapsed, int operations = 1)
+        {
+            nanoseconds.add((double) elapsed / operations);
+        }
+
+        var toVar() const
+        {
+            Array<double> sorted(nanoseconds);
+            DefaultElementComparator<double> comparator;
+            sorted.sort(comparator);
+
+            double total = 0;
+            for (int i = 0; i < sorted.size(); i++)
+                total += sorted[i];
+
+            DynamicObject* stats = new DynamicObject();
+            stats->setProperty("samples", sorted.size());
+            stats->setProperty("mean",    sorted.size() > 0 ? total / sorted.size() : 0.0);
+            stats->setProperty("min",     sorted.getFirst());
+            stats->setProperty("median",  sorted[sorted.size() / 2]);
+            stats->setProperty("p99",     sorted[jmin(sorted.size() - 1, (int) (sorted.size() * 0.99))]);
+            stats->setProperty("max",     sorted.getLast());
+            return var(stats);
+        }
+
+    private:
+        Array<double> nanoseconds;
+    };
+}
+
+//==============================================================================================
+/** Friend of SwivelString, so it can time the private parts on their own */
+class SwivelStringBenchmarks
+{
+public:
+    SwivelStringBenchmarks(const File& scratchDirectory)
+    :   scratch(scratchDirectory)
+    {
+        scratch.createDirectory();
+        stringFile = scratch.getChildFile("string.xml");
+        stringFile.replaceWithText(makeStringXml(45, 1));
+    }
+
+    ~SwivelStringBenchmarks()
+    {
+        scratch.deleteRecursively();
+    }
+
+    Result runAll()
+    {
+        // everything after this takes the string file for granted
+        ScopedPointer<SwivelString> check = makeString();
+        if (check == nullptr)
+            return Result::fail("Couldn't read " + stringFile.getFullPathName());
+
+        if (!counters.isAvailable())
+            std::cout << "No hardware counters: " << counters.getError() << std::endl;
+
+        benchmarkCallback();
+        benchmarkBestFrequency();
+        benchmarkLookupTable();
+        benchmarkTransform();
+        benchmarkParser();
+        return Result::ok();
+    }
+
+    var getResults() const
+    {
+        DynamicObject* root = new DynamicObject();
+        root->setProperty("unit", "ns");
+#ifdef DEBUG
+        root->setProperty("build", "debug");
+#else
+        root->setProperty("build", "release");
+#endif
+        root->setProperty("date", Time::getCurrentTime().toString(true, true));
+        root->setProperty("counters", counters.isAvailable() ? var(true) : var(counters.getError()));
+        root->setProperty("benchmarks", results);
+        return var(root);
+    }
+
+private:
+    File scratch;
+    File stringFile;
+    Array<var> results;
+    // results go in here so the optimiser can't skip the work
+    volatile double sink = 0;
+    PerfCounters counters;
+
+    //==========================================================================================
+    /** Each benchmark resets the counters, then has them running only around the timed bits, and
+        passes in how many of what the counts should be divided by */
+    void addResult(const String& name, DynamicObject* params, const Samples& samples, int64 operations, const char* per)
+    {
+        DynamicObject* result = new DynamicObject();
+        result->setProperty("name", name);
+        result->setProperty("params", var(params));
+        result->setProperty("time", samples.toVar());
+
+        String countersSummary;
+        if (counters.isAvailable() && operations > 0)
+        {
+            int64 values[PerfCounters::numCounters];
+            counters.read(values);
+
+            DynamicObject* perOperation = new DynamicObject();
+            perOperation->setProperty("per", per);
+            perOperation->setProperty("count", operations);
+            for (int i = 0; i < PerfCounters::numCounters; i++)
+                if (values[i] >= 0)
+                    perOperation->setProperty(PerfCounters::getName((PerfCounters::Counter) i), (double) values[i] / operations);
+            if (values[PerfCounters::cycles] > 0 && values[PerfCounters::instructions] >= 0)
+            {
+                const double ipc = (double) values[PerfCounters::instructions] / values[PerfCounters::cycles];
+                perOperation->setProperty("ipc", ipc);
+                countersSummary << ", " << String((double) values[PerfCounters::cycles] / operations, 0) << " cycles/" << per
+                                << " ipc " << String(ipc, 2);
+            }
+            if (values[PerfCounters::llcMisses] >= 0)
+                countersSummary << " llc misses/" << per << " " << String((double) values[PerfCounters::llcMisses] / operations, 2);
+            result->setProperty("counters", var(perOperation));
+        }
+        results.add(var(result));
+
+        std::cout << name << " " << JSON::toString(var(params), true) << " median "
+                  << samples.toVar()["median"].toString() << " ns" << countersSummary << std::endl;
+    }
+
+    /** A string from the generated data file, ready for audio parameters. nullptr if it couldn't be read */
+    SwivelString* makeString()
+    {
+        ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(stringFile);
+        if (data == nullptr || data->size() == 0)
+            return nullptr;
+        ScopedPointer<SwivelStringFileParser::StringDataBundle> bundle = data->getFirst();
+
+        SwivelString* string = new SwivelString();
+        string->initialiseFromBundle(bundle);
+        return string;
+    }
+
+    /** Fills in the estimates as if the callback had found them */
+    static void fakeEstimates(SwivelString& string, int count, Random& random)
+    {
+        string.freqs.clearQuick();
+        for (int i = 0; i < count; i++)
+            string.freqs.add(fundamental + (random.nextDouble() - 0.5) * (i % 4 == 0 ? 20.0 : 0.5));
+    }
+
+    //==========================================================================================
+    // per block, every FFT size x overlap x window
+    void benchmarkCallback()
+    {
+        const int length = (int) sampleRate * 4;
+        HeapBlock<float> signal(length);
+        synthesise(signal, length, fundamental);
+
+        for (int fftSize : FFTSizes)
+        {
+            double* in = (double*) fftw_malloc(sizeof(double)*fftSize);
+            fftw_complex* out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex)*fftSize);
+            fftw_plan plan = fftw_plan_dft_r2c_1d(fftSize, in, out, FFTW_MEASURE);
+
+            for (int overlap : overlapOptions)
+                for (int w = 0; w < numElementsInArray(windows); w++)
+                {
+                    ScopedPointer<SwivelString> string = makeString();
+                    // gate opens on anything and never closes, so every block gets processed
+                    string->initialiseAudioParameters(plan, in, out, fftSize, sampleRate, overlap, 0.0, -1.0, windows[w]);
+
+                    Samples samples;
+                    int64 processed = 0;
+                    counters.reset();
+                    for (int position = 0; position + blockSize <= length; position += blockSize)
+                    {
+                        const float* channels[1] = { signal + position };
+
+                        counters.resume();
+                        int64 start = now();
+                        string->audioDeviceIOCallback(channels, 1, nullptr, 0, blockSize);
+                        samples.add(now() - start);
+                        counters.pause();
+                        processed += blockSize;
+
+                        // it stops after enough estimates, keep it going
+                        if (string->finished)
+                        {
+                            string->freqs.clearQuick();
+                            string->finished = false;
+                        }
+                    }
+
+                    DynamicObject* params = new DynamicObject();
+                    params->setProperty("fft_size", fftSize);
+                    params->setProperty("overlap", overlap);
+                    params->setProperty("window", windowNames[w]);
+                    params->setProperty("block_size", blockSize);
+                    // the first frame needs a whole FFT's worth, then there's one every hop
+                    const int hop = fftSize / overlap;
+                    addResult("audioDeviceIOCallback", params, samples, processed >= fftSize ? (processed - fftSize) / hop + 1 : 0, "frame");
+                }
+
+            fftw_destroy_plan(plan);
+            fftw_free(in);
+            fftw_free(out);
+        }
+    }
+
+    void benchmarkBestFrequency()
+    {
+        const int counts[] = { 5, 10, 20, 50, 100, 1000 };
+        ScopedPointer<SwivelString> string = makeString();
+        Random random(1);
+
+        for (int count : counts)
+        {
+            Samples samples;
+            counters.reset();
+            for (int i = 0; i < 200; i++)
+            {
+                fakeEstimates(*string, count, random); // it sorts them, so new ones each time
+
+                counters.resume();
+                int64 start = now();
+                double best = string->calculateBestFrequency();
+                samples.add(now() - start);
+                counters.pause();
+                sink += best;
+            }
+
+            DynamicObject* params = new DynamicObject();
+            params->setProperty("estimates", count);
+            addResult("calculateBestFrequency", params, samples, 200, "call");
+        }
+    }
+
+    void benchmarkLookupTable()
+    {
+        ScopedPointer<SwivelString> string = makeString();
+        Random random(2);
+
+        Samples whole;
+        counters.reset();
+        for (int i = 0; i < 200; i++)
+        {
+            fakeEstimates(*string, 20, random);
+            string->note_key_table.clear();
+
+            counters.resume();
+            int64 start = now();
+            string->processFrequencies();
+            whole.add(now() - start);
+            counters.pause();
+        }
+        addResult("processFrequencies", new DynamicObject(), whole, 200, "call");
+
+        // just the table, from the measurements nearest the fundamental
+        Array<double> derived(*(*string->measurements)[1]);
+        string->determined_pitch = fundamental;
+        Samples table;
+        counters.reset();
+        for (int i = 0; i < 200; i++)
+        {
+            string->note_key_table.clear();
+
+            counters.resume();
+            int64 start = now();
+            string->fillLookupTable(derived);
+            table.add(now() - start);
+            counters.pause();
+        }
+        addResult("fillLookupTable", new DynamicObject(), table, 200, "call");
+    }
+
+    void benchmarkTransform()
+    {
+        ScopedPointer<SwivelString> string = makeString();
+        Random random(3);
+        fakeEstimates(*string, 20, random);
+        string->processFrequencies();
+        jassert(string->isReadyToTransform());
+
+        const int channel = string->getMidiChannel();
+        const int batch = 1000;
+
+        // the transform is quicker than the timer resolution, so time batches
+        // MidiMessage points into itself, so it can't go in a juce::Array
+        std::vector<MidiMessage> noteOns, bends;
+        for (int i = 0; i < batch; i++)
+        {
+            noteOns.push_back(MidiMessage::noteOn(channel, string->num + i % 23, (uint8) 100));
+            bends.push_back(MidiMessage::pitchWheel(channel, (i * 16) & 0x3fff));
+        }
+
+        const char* names[] = { "note_on", "pitch_bend" };
+        std::vector<MidiMessage>* messages[] = { &noteOns, &bends };
+        for (int type = 0; type < 2; type++)
+        {
+            Samples samples;
+            counters.reset();
+            for (int i = 0; i < 200; i++)
+            {
+                // pitch bends are relative to the last note
+                string->transform(noteOns[i % batch]);
+
+                counters.resume();
+                int64 start = now();
+                for (const MidiMessage& message : *messages[type])
+                    sink += string->transform(message).getRawData()[1];
+                samples.add(now() - start, batch);
+                counters.pause();
+            }
+
+            DynamicObject* params = new DynamicObject();
+            params->setProperty("message", names[type]);
+            addResult("transform", params, samples, 200 * batch, "message");
+        }
+    }
+
+    void benchmarkParser()
+    {
+        const int sizes[] = { 1, 10, 100, 1000 };
+
+        for (int size : sizes)
+        {
+            String text;
+            for (int i = 0; i < size; i++)
+                text << makeStringXml(i, i % 16 + 1);
+            File library = scratch.getChildFile("library" + String(size) + ".xml");
+            library.replaceWithText(text);
+
+            Samples samples;
+            const int runs = jmax(3, 1000 / size);
+            counters.reset();
+            for (int i = 0; i < runs; i++)
+            {
+                counters.resume();
+                int64 start = now();
+                ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(library);
+                samples.add(now() - start);
+                counters.pause();
+
+                if (data == nullptr)
+                {
+                    std::cerr << "Couldn't read " << library.getFullPathName() << std::endl;
+                    return;
+                }
+                for (int b = 0; b < data->size(); b++)
+                    delete data->getUnchecked(b);
+            }
+
+            DynamicObject* params = new DynamicObject();
+            params->setProperty("strings", size);
+            params->setProperty("bytes", (int64) library.getSize());
+            addResult("parseFile", params, samples, runs, "file");
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (SwivelStringBenchmarks)
+};
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    File output = File::getCurrentWorkingDirectory().getChildFile(argc > 1 ? argv[1] : "benchmarks.json");
+
+    var results;
+    {
+        SwivelStringBenchmarks benchmarks(File::getSpecialLocation(File::tempDirectory).getChildFile("swivel-bench"));
+        try
+        {
+            Result ran = benchmarks.runAll();
+            if (!ran)
+            {
+                std::cerr << ran.getErrorMessage() << std::endl;
+                return 1;
+            }
+        }
+        catch (SwivelStringFileParser::ParseException const &e)
+        {
+            std::cerr << "Parse Error: " << e.what() << std::endl;
+            return 1;
+        }
+        results = benchmarks.getResults();
+    }
+
+    if (!output.replaceWithText(JSON::toString(results)))
+    {
+        std::cerr << "Couldn't write " << output.getFullPathName() << std::endl;
+        return 1;
+    }
+    std::cout << "Written to " << output.getFullPathName() << std::endl;
+    return 0;
+}
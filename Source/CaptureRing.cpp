@@ -0,0 +1,197 @@
+//
+//  CaptureRing.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "CaptureRing.h"
+#include "RealtimeChecker.h"
+#include "Trace.h"
+#include "Levels.h"
+
+CaptureRing::CaptureRing(MidiScheduler& c, int capacityBits)
+:   clock(c),
+    capacity(1 << capacityBits),
+    buffer(1, 1),
+    numChannels(0),
+    sampleRate(44100.0),
+    written(0),
+    chunksWritten(0),
+    numChunkSlots(capacity / chunkSize),
+    up(0.001f),
+    down(0.001f),
+    anchorTime(0),
+    anchorSample(-1)
+{
+
+}
+
+void CaptureRing::setThresholds(float newUp, float newDown)
+{
+    up = newUp;
+    down = newDown;
+}
+
+void CaptureRing::audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                                        float** outputChannelData, int numOutputChannels, int numSamples)
+{
+    RealtimeChecker::ScopedRealtimeSection realtime;
+    Trace::ScopedEvent event("capture block");
+
+    const int64 start = written.load(std::memory_order_relaxed);
+    const int offset = (int) (start & (capacity - 1));
+    const int first = jmin(numSamples, capacity - offset); // up to the end of the ring, the rest wraps
+
+    for (int c = 0; c < numChannels; c++)
+    {
+        float* ring = buffer.getSampleData(c);
+        if (c < numInputChannels && inputChannelData[c] != nullptr)
+        {
+            memcpy(ring + offset, inputChannelData[c], sizeof(float) * first);
+            memcpy(ring, inputChannelData[c] + first, sizeof(float) * (numSamples - first));
+        }
+        else
+        {
+            FloatVectorOperations::clear(ring + offset, first);
+            FloatVectorOperations::clear(ring, numSamples - first);
+        }
+
+        // levels a chunk at a time, blocks don't have to line up with the chunks
+        int64 position = start;
+        for (int done = 0; done < numSamples;)
+        {
+            const int length = jmin(chunkSize - (int) (position & (chunkSize - 1)), numSamples - done);
+            if (c < numInputChannels && inputChannelData[c] != nullptr)
+                partial[c] += Levels::sumOfSquares(inputChannelData[c] + done, length);
+            done += length;
+            position += length;
+            if ((position & (chunkSize - 1)) == 0)
+                completeChunk(c, position / chunkSize - 1);
+        }
+    }
+
+    // the block has only just arrived, so its end is now, everything after goes by the sample count
+    if (anchorSample.load(std::memory_order_relaxed) < 0)
+    {
+        anchorTime = clock.getMillisecondCounter();
+        anchorSample.store(start + numSamples, std::memory_order_release);
+    }
+
+    written.store(start + numSamples, std::memory_order_release);
+    chunksWritten.store((start + numSamples) / chunkSize, std::memory_order_release);
+}
+
+void CaptureRing::completeChunk(int channel, int64 chunk)
+{
+    float* channelLevels = levels + channel * numChunkSlots;
+    channelLevels[chunk & (numChunkSlots - 1)] = partial[channel] / chunkSize;
+    partial[channel] = 0;
+
+    float total = 0;
+    const int count = (int) jmin((int64) gateChunks, chunk + 1);
+    for (int i = 0; i < count; i++)
+        total += channelLevels[(chunk - i) & (numChunkSlots - 1)];
+    const float level = std::sqrt(total / count);
+
+    if (!open[channel] && level >= up)
+    {
+        open[channel] = true;
+        Trace::instant("gate open");
+    }
+    else if (open[channel] && level <= down)
+    {
+        open[channel] = false;
+        Trace::instant("gate closed");
+    }
+
+    gates[channel * numChunkSlots + (chunk & (numChunkSlots - 1))] = open[channel];
+}
+
+void CaptureRing::audioDeviceAboutToStart(AudioIODevice* device)
+{
+    // not in the callback yet, so it's fine to allocate
+    numChannels = jmax(1, device->getActiveInputChannels().countNumberOfSetBits());
+    sampleRate = device->getCurrentSampleRate();
+    buffer.setSize(numChannels, capacity);
+    buffer.clear();
+    levels.calloc((size_t) (numChannels * numChunkSlots));
+    gates.calloc((size_t) (numChannels * numChunkSlots));
+    partial.calloc((size_t) numChannels);
+    open.calloc((size_t) numChannels);
+    written = 0;
+    chunksWritten = 0;
+    anchorSample = -1;
+}
+
+void CaptureRing::audioDeviceStopped()
+{
+
+}
+
+//==============================================================================================
+int CaptureRing::getNumChannels() const
+{
+    return numChannels;
+}
+
+double CaptureRing::getSampleRate() const
+{
+    return sampleRate;
+}
+
+int64 CaptureRing::getNumSamplesWritten() const
+{
+    return written.load(std::memory_order_acquire);
+}
+
+int64 CaptureRing::getOldestAvailable() const
+{
+    // leaving room for the block that might be being written over the oldest part right now
+    return jmax((int64) 0, getNumSamplesWritten() - capacity + capacity / 8);
+}
+
+bool CaptureRing::hasClock() const
+{
+    return anchorSample.load(std::memory_order_acquire) >= 0;
+}
+
+double CaptureRing::getTimeOfSample(int64 sample) const
+{
+    return anchorTime + (sample - anchorSample.load(std::memory_order_acquire)) * 1000.0 / sampleRate;
+}
+
+int64 CaptureRing::getSampleAtTime(double time) const
+{
+    return anchorSample.load(std::memory_order_acquire) + (int64) std::ceil((time - anchorTime) * sampleRate / 1000.0);
+}
+
+bool CaptureRing::read(int channel, int64 start, float* dest, int numSamples) const
+{
+    if (channel < 0 || channel >= numChannels || start < 0 || start + numSamples > getNumSamplesWritten())
+        return false;
+
+    const int offset = (int) (start & (capacity - 1));
+    const int first = jmin(numSamples, capacity - offset);
+    const float* ring = buffer.getSampleData(channel);
+    memcpy(dest, ring + offset, sizeof(float) * first);
+    memcpy(dest + first, ring, sizeof(float) * (numSamples - first));
+
+    // if the writer has gone past it since, some of that might be newer audio
+    return start >= getOldestAvailable();
+}
+
+int64 CaptureRing::getNumChunksWritten() const
+{
+    return chunksWritten.load(std::memory_order_acquire);
+}
+
+bool CaptureRing::readGate(int channel, int64 chunk, bool& isOpen) const
+{
+    if (channel < 0 || channel >= numChannels || chunk < 0 || chunk >= getNumChunksWritten())
+        return false;
+
+    isOpen = gates[channel * numChunkSlots + (chunk & (numChunkSlots - 1))];
+    return chunk * chunkSize >= getOldestAvailable();
+}
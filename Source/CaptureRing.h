@@ -0,0 +1,102 @@
+//
+//  CaptureRing.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__CaptureRing__
+#define __SwivelAutotune__CaptureRing__
+
+#include <atomic>
+#include "CoreJuceHeader.h"
+#include "MidiScheduler.h"
+
+/** Keeps the last few seconds of every active input, so nothing before a string is looked at is lost.
+    It's added as an audio callback once and left there; the analysis reads back whatever it wants
+    from its own thread. It's the only callback, however many strings and inputs there are.
+
+    It also runs the onset gate for every input: each chunk of chunkSize samples gets its level
+    in one pass per channel, and the gate opens and closes on the level of the last few chunks.
+    The gate state is kept alongside the audio, so the analysis only ever sees gated audio.
+
+    There's one writer (the audio callback) and any number of readers, readers find out
+    afterwards if what they copied was overwritten while they were copying it.
+
+    Sample positions count from the first block after the device started, and the first block also
+    ties them to the scheduler's clock, so MIDI send times can be turned into sample positions.
+ */
+class CaptureRing : public AudioIODeviceCallback
+{
+public:
+    /** Keeps 2^capacityBits samples per channel */
+    CaptureRing(MidiScheduler& clock, int capacityBits = 18);
+    
+    /** The gate opens when the level goes up to up and closes when it's down to down. Set it before
+        adding the callback */
+    void setThresholds(float up, float down);
+
+    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                               float** outputChannelData, int numOutputChannels, int numSamples) override;
+    void audioDeviceAboutToStart(AudioIODevice* device) override;
+    void audioDeviceStopped() override;
+
+    int getNumChannels() const;
+    double getSampleRate() const;
+    /** One past the newest sample */
+    int64 getNumSamplesWritten() const;
+    /** The oldest sample that is still there */
+    int64 getOldestAvailable() const;
+
+    /** False until the first block has come in, the times below mean nothing until then */
+    bool hasClock() const;
+    /** When the given sample arrived, on the scheduler's clock */
+    double getTimeOfSample(int64 sample) const;
+    /** Which sample arrived at the given time on the scheduler's clock */
+    int64 getSampleAtTime(double time) const;
+
+    /** Copies samples [start, start+numSamples) of a channel. Returns false if they haven't all
+        been written yet or some had already been overwritten, in which case dest is rubbish */
+    bool read(int channel, int64 start, float* dest, int numSamples) const;
+
+    /** One past the newest complete chunk */
+    int64 getNumChunksWritten() const;
+    /** Gets whether the gate was open for the chunk starting at sample chunk * chunkSize.
+        Returns false if it hasn't been written yet or has been overwritten */
+    bool readGate(int channel, int64 chunk, bool& isOpen) const;
+
+    // the gate works to within this many samples
+    static const int chunkSize = 64;
+    // and looks at the level over this many chunks, one on its own is only a fraction of a cycle of a low string
+    static const int gateChunks = 8;
+
+private:
+    MidiScheduler& clock;
+    const int capacity;
+    AudioSampleBuffer buffer;
+    int numChannels;
+    double sampleRate;
+
+    std::atomic<int64> written;
+    std::atomic<int64> chunksWritten;
+
+    // the gate, per channel: levels (mean square) and states per chunk, kept as long as the audio is
+    const int numChunkSlots;
+    HeapBlock<float> levels;
+    HeapBlock<bool> gates;
+    HeapBlock<float> partial; // sum of squares so far of the chunk being filled
+    HeapBlock<bool> open;
+    float up, down;
+
+    // the scheduler's time at the end of the first block, and which sample that was.
+    // The sound card's clock will drift from it a little, which is fine over a calibration
+    double anchorTime;
+    std::atomic<int64> anchorSample;
+
+    void completeChunk(int channel, int64 chunk);
+
+    JUCE_DECLARE_NON_COPYABLE (CaptureRing)
+};
+
+#endif /* defined(__SwivelAutotune__CaptureRing__) */
@@ -0,0 +1,172 @@
+//
+//  ConsoleComponent.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "ConsoleComponent.h"
+
+ConsoleComponent::ConsoleComponent(int maxLines)
+:   lines(maxLines),
+    visible(maxLines),
+    first(0),
+    minimumLevel(LogQueue::debug),
+    list("Console"),
+    exportButton("Export...")
+{
+    list.setModel(this);
+    list.setRowHeight(14);
+    list.setOutlineThickness(1);
+    addAndMakeVisible(&list);
+    
+    levelBox.addItem("Debug", LogQueue::debug+1);
+    levelBox.addItem("Info", LogQueue::info+1);
+    levelBox.addItem("Warning", LogQueue::warning+1);
+    levelBox.addItem("Error", LogQueue::error+1);
+    levelBox.setSelectedId(LogQueue::debug+1, dontSendNotification);
+    levelBox.setTooltip("Hide lines less important than this, they are still kept for export");
+    levelBox.addListener(this);
+    addAndMakeVisible(&levelBox);
+    
+    exportButton.setTooltip("Save everything kept to a text file");
+    exportButton.addListener(this);
+    addAndMakeVisible(&exportButton);
+}
+
+//==============================================================================================
+void ConsoleComponent::addText(const String& text, Level level)
+{
+    const String all = partial.isEmpty() ? text : partial + text;
+    
+    // walked with a pointer, String's index-based searches count from the start every time and
+    // batches from the log queue can be long
+    String::CharPointerType lineStart(all.getCharPointer()), t(lineStart);
+    while (!t.isEmpty())
+    {
+        const String::CharPointerType lineEnd(t);
+        if (t.getAndAdvance() == '\n')
+        {
+            addLine(String(lineStart, lineEnd), level);
+            lineStart = t;
+        }
+    }
+    partial = String(lineStart);
+    
+    // only bother following the end if we were already there
+    bool atEnd = list.getVerticalPosition() >= 1.0 || getNumRows() <= list.getNumRowsOnScreen();
+    list.updateContent();
+    if (atEnd)
+        list.scrollToEnsureRowIsOnscreen(getNumRows()-1);
+    list.repaint();
+}
+
+void ConsoleComponent::addLine(const String& text, Level level)
+{
+    if (lines.isFull())
+    {
+        // the oldest line goes, and with it the oldest visible one if that was it
+        if (visible.size() > 0 && visible.front() == first)
+            visible.popFront();
+        first++;
+    }
+    
+    Line line = { text, level };
+    lines.push(line);
+    if (level >= minimumLevel)
+        visible.push(first + lines.size() - 1);
+}
+
+void ConsoleComponent::setMinimumLevel(Level level)
+{
+    minimumLevel = level;
+    levelBox.setSelectedId(level+1, dontSendNotification);
+    
+    visible.clear();
+    for (int i = 0; i < lines.size(); i++)
+        if (lines[i].level >= minimumLevel)
+            visible.push(first + i);
+    
+    list.updateContent();
+    list.scrollToEnsureRowIsOnscreen(getNumRows()-1);
+    list.repaint();
+}
+
+bool ConsoleComponent::exportToFile(const File& file) const
+{
+    const char* names[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+    
+    file.deleteFile();
+    FileOutputStream out(file);
+    if (out.failedToOpen())
+        return false;
+    
+    for (int i = 0; i < lines.size(); i++)
+        out << names[lines[i].level] << "\t" << lines[i].text << "\n";
+    if (partial.isNotEmpty())
+        out << names[LogQueue::info] << "\t" << partial << "\n";
+    
+    out.flush();
+    return true;
+}
+
+void ConsoleComponent::clear()
+{
+    lines.clear();
+    visible.clear();
+    first = 0;
+    partial = String::empty;
+    list.updateContent();
+    list.repaint();
+}
+
+//==============================================================================================
+void ConsoleComponent::resized()
+{
+    list.setBounds(0, 0, getWidth()-90, getHeight());
+    levelBox.setBounds(getWidth()-85, 0, 85, 20);
+    exportButton.setBounds(getWidth()-85, 25, 85, 20);
+}
+
+int ConsoleComponent::getNumRows()
+{
+    return visible.size();
+}
+
+void ConsoleComponent::paintListBoxItem(int row, Graphics& g, int width, int height, bool selected)
+{
+    if (row < 0 || row >= visible.size())
+        return;
+    
+    const Line& line = lines[(int) (visible[row] - first)];
+    
+    switch (line.level)
+    {
+        case LogQueue::debug:   g.setColour(Colours::grey);       break;
+        case LogQueue::warning: g.setColour(Colours::darkorange); break;
+        case LogQueue::error:   g.setColour(Colours::red);        break;
+        case LogQueue::info:
+        default:      g.setColour(Colours::black);      break;
+    }
+    g.setFont(Font(Font::getDefaultMonospacedFontName(), height-2, Font::plain));
+    g.drawText(line.text, 4, 0, width-4, height, Justification::centredLeft, true);
+}
+
+void ConsoleComponent::comboBoxChanged(ComboBox* box)
+{
+    if (&levelBox == box)
+        setMinimumLevel((Level) (levelBox.getSelectedId()-1));
+}
+
+void ConsoleComponent::buttonClicked(Button* button)
+{
+    if (&exportButton == button)
+    {
+        FileChooser chooser("Export console",
+                            File::getCurrentWorkingDirectory().getChildFile("swivel-log.txt"),
+                            "*.txt");
+        if (chooser.browseForFileToSave(true) && !exportToFile(chooser.getResult()))
+            addText("Couldn't write to " + chooser.getResult().getFullPathName() + "\n", LogQueue::error);
+    }
+}
@@ -0,0 +1,98 @@
+//
+//  ConsoleComponent.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__ConsoleComponent__
+#define __SwivelAutotune__ConsoleComponent__
+
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LogQueue.h"
+
+/** A read-only log view that stays cheap however long the session runs.
+    Only the most recent lines are kept, in a ring, so adding a line is constant time and
+    memory is bounded. Only the rows on screen are ever drawn. Lines below the chosen level
+    are hidden but still kept, and everything kept can be exported to a text file.
+    Only use from the message thread; other threads should go through a LogQueue.
+ */
+class ConsoleComponent : public Component,
+                         public LogQueue::Target,
+                         private ListBoxModel,
+                         ComboBox::Listener,
+                         Button::Listener
+{
+public:
+    typedef LogQueue::Level Level;
+    
+    ConsoleComponent(int maxLines = 10000);
+    
+    /** Appends text. Text is split into lines on '\n', anything after the last one is held until the next call */
+    void addText(const String& text, Level level = LogQueue::info) override;
+    /** Hides lines below the given level */
+    void setMinimumLevel(Level level);
+    /** Writes every line currently kept, whatever the level filter, returns false if it couldn't */
+    bool exportToFile(const File& file) const;
+    /** Forgets everything */
+    void clear();
+    
+    void resized() override;
+    
+private:
+    /** Fixed capacity ring, pushing when full overwrites the oldest */
+    template <typename Type>
+    class Ring
+    {
+    public:
+        Ring(int capacity) : data(capacity), head(0), count(0) {}
+        void push(const Type& t)
+        {
+            data[(head + count) % data.size()] = t;
+            if (count < (int) data.size()) count++;
+            else head = (head + 1) % data.size();
+        }
+        void popFront()                      { head = (head + 1) % data.size(); count--; }
+        const Type& front() const            { return data[head]; }
+        const Type& operator[](int i) const  { return data[(head + i) % data.size()]; }
+        int size() const                     { return count; }
+        bool isFull() const                  { return count == (int) data.size(); }
+        void clear()                         { head = 0; count = 0; }
+    private:
+        std::vector<Type> data;
+        int head, count;
+    };
+    
+    struct Line
+    {
+        String text;
+        Level level;
+    };
+    
+    void addLine(const String& text, Level level);
+    
+    int getNumRows() override;
+    void paintListBoxItem(int row, Graphics& g, int width, int height, bool selected) override;
+    void comboBoxChanged(ComboBox* box) override;
+    void buttonClicked(Button* button) override;
+    
+    // every line kept, oldest first
+    Ring<Line> lines;
+    // the sequence numbers of the lines that pass the filter, oldest first
+    Ring<int64> visible;
+    // sequence number of lines.front()
+    int64 first;
+    Level minimumLevel;
+    // the start of a line that hasn't had its '\n' yet
+    String partial;
+    
+    ListBox list;
+    ComboBox levelBox;
+    TextButton exportButton;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ConsoleComponent)
+};
+
+#endif /* defined(__SwivelAutotune__ConsoleComponent__) */
@@ -0,0 +1,582 @@
+//
+//  Coordination.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <sys/socket.h>
+#include "Coordination.h"
+
+MemoryBlock Coordination::encode(const var& message)
+{
+    const String json(JSON::toString(message, true));
+    return MemoryBlock(json.toRawUTF8(), json.getNumBytesAsUTF8());
+}
+
+var Coordination::decode(const MemoryBlock& message)
+{
+    const var parsed(JSON::parse(message.toString()));
+    return parsed.isObject() ? parsed : var::null;
+}
+
+Result Coordination::parseAddress(const String& address, String& host, int& port)
+{
+    host = address.upToFirstOccurrenceOf(":", false, false).trim();
+    port = address.containsChar(':') ? address.fromFirstOccurrenceOf(":", false, false).getIntValue() : defaultPort;
+    if (host.isEmpty() || port <= 0 || port > 65535)
+        return Result::fail("Coordinator address should be host:port, not " + address);
+    return Result::ok();
+}
+
+var Coordination::describeString(const SwivelString& string)
+{
+    DynamicObject* description = new DynamicObject();
+    description->setProperty("port", string.getMidiPort());
+    description->setProperty("channel", string.getMidiChannel());
+    return var(description);
+}
+
+var Coordination::describeTable(const SwivelString& string)
+{
+    var description(describeString(string));
+    DynamicObject* object = description.getDynamicObject();
+    object->setProperty("frequency", string.getBestFreq());
+    object->setProperty("first_note", string.getFirstNote());
+
+    // a pitch bend for each note, or what's wrong with it
+    Array<var> table;
+    for (int note = string.getFirstNote(); note < string.getFirstNote() + string.getNumNotes(); note++)
+    {
+        const uint16 entry = string.getTableEntry(note);
+        if (entry == SwivelString::OPEN_NOTE)
+            table.add("open");
+        else if (entry == SwivelString::OFFSTRING_NOTE)
+            table.add("off");
+        else if (entry == SwivelString::INVALID_NOTE)
+            table.add("invalid");
+        else
+            table.add((int) entry);
+    }
+    object->setProperty("table", table);
+    return description;
+}
+
+bool Coordination::isString(const var& description, const SwivelString& string)
+{
+    return (int) description["port"] == string.getMidiPort() && (int) description["channel"] == string.getMidiChannel();
+}
+
+String Coordination::getKey(const var& description)
+{
+    return String((int) description["port"]) + "." + String((int) description["channel"]);
+}
+
+void Coordination::hangUp(InterprocessConnection& connection)
+{
+    if (StreamingSocket* socket = connection.getSocket())
+        ::shutdown(socket->getRawSocketHandle(), SHUT_RDWR);
+}
+
+void Coordination::close(InterprocessConnection& connection)
+{
+    hangUp(connection);
+    const uint32 giveUpAt = Time::getMillisecondCounter() + 1000;
+    while (connection.getSocket() != nullptr && Time::getMillisecondCounter() < giveUpAt)
+        Thread::sleep(1);
+    connection.disconnect();
+}
+
+//==============================================================================================
+CoordinatorClient::CoordinatorClient(const String& instanceName, OwnedArray<SwivelString, CriticalSection>* strings, Listener* l)
+:   name(instanceName),
+    swivelStrings(strings),
+    listener(l),
+    logger(nullptr),
+    tablesSent(false),
+    finished(false)
+{
+
+}
+
+CoordinatorClient::~CoordinatorClient()
+{
+    Coordination::close(*this);
+}
+
+void CoordinatorClient::setLog(LogQueue* where)
+{
+    logger = where;
+}
+
+Result CoordinatorClient::connect(const String& address)
+{
+    String host;
+    int port;
+    Result parsed = Coordination::parseAddress(address, host, port);
+    if (!parsed)
+        return parsed;
+    if (!connectToSocket(host, port, 5000))
+        return Result::fail("Couldn't reach the coordinator at " + host + ":" + String(port));
+
+    Array<var> strings;
+    {
+        const ScopedLock sl(swivelStrings->getLock());
+        for (SwivelString* string : *swivelStrings)
+            strings.add(Coordination::describeString(*string));
+    }
+    DynamicObject* hello = new DynamicObject();
+    hello->setProperty("type", "hello");
+    hello->setProperty("name", name);
+    hello->setProperty("strings", strings);
+    send(var(hello));
+
+    if (logger != nullptr)
+        logger->push("Connected to the coordinator at " + host + ":" + String(port) + " as " + name + ", waiting to start\n");
+    return Result::ok();
+}
+
+void CoordinatorClient::calibrationFinished(Result result, double seconds)
+{
+    // nobody to tell
+    if (finished)
+        return;
+
+    Array<var> strings;
+    for (SwivelString* string : assigned)
+    {
+        var description(Coordination::describeString(*string));
+        description.getDynamicObject()->setProperty("ready", string->isReadyToTransform());
+        description.getDynamicObject()->setProperty("frequency", string->isReadyToTransform() ? string->getBestFreq() : 0.0);
+        strings.add(description);
+    }
+
+    DynamicObject* message = new DynamicObject();
+    message->setProperty("type", "result");
+    message->setProperty("ok", result.wasOk());
+    message->setProperty("error", result.getErrorMessage());
+    message->setProperty("seconds", seconds);
+    message->setProperty("strings", strings);
+    send(var(message));
+}
+
+void CoordinatorClient::connectionMade()
+{
+
+}
+
+void CoordinatorClient::connectionLost()
+{
+    // once it has the tables that's the coordinator done with us
+    finish(tablesSent ? Result::ok() : Result::fail("Lost the coordinator"));
+}
+
+void CoordinatorClient::messageReceived(const MemoryBlock& block)
+{
+    const var message(Coordination::decode(block));
+    const String type(message["type"].toString());
+
+    if (type == "calibrate")
+    {
+        // in the coordinator's order, which is the order it'll go in
+        assigned.clear();
+        const var wanted(message["strings"]); // [] gives a copy, it has to outlive the array
+        if (const Array<var>* strings = wanted.getArray())
+        {
+            const ScopedLock sl(swivelStrings->getLock());
+            for (const var& description : *strings)
+                for (SwivelString* string : *swivelStrings)
+                    if (Coordination::isString(description, *string))
+                        assigned.add(string);
+        }
+        if (logger != nullptr)
+            logger->push("The coordinator wants " + String(assigned.size()) + " strings calibrated\n");
+        listener->calibrationRequested(assigned);
+    }
+    else if (type == "tune")
+        tune(message["strings"]);
+    else if (logger != nullptr)
+        logger->push("Unknown message from the coordinator: " + type + "\n", LogQueue::warning);
+}
+
+void CoordinatorClient::send(const var& message)
+{
+    if (!sendMessage(Coordination::encode(message)) && logger != nullptr)
+        logger->push("Couldn't send to the coordinator\n", LogQueue::warning);
+}
+
+void CoordinatorClient::tune(const var& frequencies)
+{
+    int tuned = 0;
+    Array<var> tables;
+    {
+        const ScopedLock sl(swivelStrings->getLock());
+        for (SwivelString* string : *swivelStrings)
+        {
+            // ours are already done, anything else another instance found
+            if (!assigned.contains(string))
+                if (const Array<var>* strings = frequencies.getArray())
+                    for (const var& description : *strings)
+                        if (Coordination::isString(description, *string) && (double) description["frequency"] > 0)
+                        {
+                            string->setOpenFrequency(description["frequency"]);
+                            tuned++;
+                        }
+
+            if (string->isReadyToTransform())
+                tables.add(Coordination::describeTable(*string));
+        }
+    }
+    if (logger != nullptr)
+        logger->push("Tuned " + String(tuned) + " strings from other instances\n");
+
+    DynamicObject* message = new DynamicObject();
+    message->setProperty("type", "tables");
+    message->setProperty("strings", tables);
+    send(var(message));
+    tablesSent = true;
+}
+
+void CoordinatorClient::finish(Result result)
+{
+    if (finished)
+        return;
+    finished = true;
+    listener->coordinationFinished(result);
+}
+
+//==============================================================================================
+/** One instance as the coordinator sees it */
+class Coordinator::Instance : public InterprocessConnection
+{
+public:
+    Instance(Coordinator& c)
+    :   greeted(false),
+        reported(false),
+        tabled(false),
+        lost(false),
+        ok(false),
+        seconds(0),
+        sentAt(0),
+        reportedAt(0),
+        owner(c)
+    {
+
+    }
+
+    ~Instance()
+    {
+        Coordination::close(*this);
+    }
+
+    void connectionMade() override                  {}
+    void connectionLost() override                  { owner.instanceLost(*this); }
+    void messageReceived(const MemoryBlock& message) override { owner.handleMessage(*this, Coordination::decode(message)); }
+
+    void send(const var& message)
+    {
+        sendMessage(Coordination::encode(message));
+    }
+
+    /** Still in it, and has got as far as the state needs */
+    bool isDone(State state) const
+    {
+        return lost || (state == calibrating ? reported : state == tuning ? tabled : false);
+    }
+
+    String name, host;
+    Array<var> strings;  // what it has
+    Array<var> assigned; // what it's been given
+    bool greeted, reported, tabled, lost, ok;
+    String error;
+    double seconds;      // what it says calibrating took
+    double sentAt, reportedAt;
+    var results, tables;
+
+private:
+    Coordinator& owner;
+
+    JUCE_DECLARE_NON_COPYABLE (Instance)
+};
+
+//==============================================================================================
+Coordinator::Coordinator(int instancesWanted, Listener* l)
+:   numInstances(instancesWanted),
+    listener(l),
+    logger(nullptr),
+    state(waitingForInstances),
+    startedAt(0),
+    calibratedAt(0)
+{
+
+}
+
+Coordinator::~Coordinator()
+{
+    stop();
+    instances.clear();
+}
+
+void Coordinator::setLog(LogQueue* where)
+{
+    logger = where;
+}
+
+Result Coordinator::start(int port)
+{
+    if (!beginWaitingForSocket(port))
+        return Result::fail("Couldn't listen on port " + String(port));
+    log("Waiting for " + String(numInstances) + " instances on port " + String(port) + "\n");
+    return Result::ok();
+}
+
+InterprocessConnection* Coordinator::createConnectionObject()
+{
+    // on the server's thread, the rest is on the message thread
+    Instance* instance = new Instance(*this);
+    instances.add(instance);
+    return instance;
+}
+
+void Coordinator::handleMessage(Instance& instance, const var& message)
+{
+    const String type(message["type"].toString());
+
+    if (type == "hello" && state == waitingForInstances && !instance.greeted)
+    {
+        instance.greeted = true;
+        instance.name = message["name"].toString();
+        instance.host = instance.getConnectedHostName();
+        const var strings(message["strings"]);
+        if (const Array<var>* array = strings.getArray())
+            instance.strings = *array;
+        log(instance.name + " (" + instance.host + ") has " + String(instance.strings.size()) + " strings\n");
+    }
+    else if (type == "result" && state == calibrating && !instance.reported)
+    {
+        instance.reported = true;
+        instance.reportedAt = Time::getMillisecondCounterHiRes();
+        instance.ok = message["ok"];
+        instance.error = message["error"].toString();
+        instance.seconds = message["seconds"];
+        instance.results = message["strings"];
+        log(instance.name + (instance.ok ? " calibrated " + String(instance.assigned.size()) + " strings in " + String(instance.seconds, 2) + "s\n"
+                                         : " failed: " + instance.error + "\n"),
+            instance.ok ? LogQueue::info : LogQueue::warning);
+    }
+    else if (type == "tables" && state == tuning && !instance.tabled)
+    {
+        instance.tabled = true;
+        instance.tables = message["strings"];
+    }
+    else
+    {
+        log("Unexpected " + type + " from " + (instance.name.isEmpty() ? instance.getConnectedHostName() : instance.name) + "\n", LogQueue::warning);
+        return;
+    }
+    update();
+}
+
+void Coordinator::instanceLost(Instance& instance)
+{
+    if (instance.lost || state == finished)
+        return;
+    instance.lost = true;
+    if (state != closing)
+        log((instance.name.isEmpty() ? String("An instance") : instance.name) + " went away\n",
+            state == waitingForInstances ? LogQueue::info : LogQueue::warning);
+    update();
+}
+
+void Coordinator::update()
+{
+    const ScopedLock sl(instances.getLock());
+
+    if (state == waitingForInstances)
+    {
+        int greeted = 0;
+        for (Instance* instance : instances)
+            if (instance->greeted && !instance->lost)
+                greeted++;
+        if (greeted < numInstances)
+            return;
+
+        // everyone's here, they all start together
+        balance();
+        state = calibrating;
+        startedAt = Time::getMillisecondCounterHiRes();
+        for (Instance* instance : instances)
+        {
+            if (!instance->greeted || instance->lost)
+                continue;
+            DynamicObject* message = new DynamicObject();
+            message->setProperty("type", "calibrate");
+            message->setProperty("strings", instance->assigned);
+            instance->sentAt = Time::getMillisecondCounterHiRes();
+            instance->send(var(message));
+        }
+        return;
+    }
+
+    for (Instance* instance : instances)
+        if (instance->greeted && !instance->isDone(state))
+            return;
+
+    if (state == calibrating)
+    {
+        calibratedAt = Time::getMillisecondCounterHiRes();
+        log("All calibrated in " + String((calibratedAt - startedAt) / 1000.0, 2) + "s\n");
+
+        // what each string's calibrating instance found, for all the others that have it
+        Array<var> frequencies;
+        for (Instance* instance : instances)
+            if (const Array<var>* results = instance->results.getArray())
+                for (const var& result : *results)
+                    if (result["ready"])
+                        frequencies.add(result);
+
+        state = tuning;
+        for (Instance* instance : instances)
+        {
+            if (!instance->greeted || instance->lost)
+                continue;
+            DynamicObject* message = new DynamicObject();
+            message->setProperty("type", "tune");
+            message->setProperty("strings", frequencies);
+            instance->send(var(message));
+        }
+        return;
+    }
+
+    if (state == tuning)
+    {
+        // they carry on once they've been hung up on, and it's finished when they've all gone
+        state = closing;
+        for (Instance* instance : instances)
+            if (instance->greeted && !instance->lost)
+                Coordination::hangUp(*instance);
+        return;
+    }
+
+    if (state == closing)
+    {
+        state = finished;
+
+        // every string that was given out should have come back calibrated
+        StringArray missing;
+        for (Instance* instance : instances)
+        {
+            if (!instance->greeted)
+                continue;
+            for (const var& description : instance->assigned)
+            {
+                bool ready = false;
+                if (const Array<var>* results = instance->results.getArray())
+                    for (const var& result : *results)
+                        ready = ready || (Coordination::getKey(result) == Coordination::getKey(description) && (bool) result["ready"]);
+                if (!ready)
+                    missing.add(Coordination::getKey(description) + " (" + instance->name + ")");
+            }
+        }
+        listener->coordinationFinished(missing.size() == 0 ? Result::ok()
+                                                           : Result::fail("Not calibrated: " + missing.joinIntoString(", ")));
+    }
+}
+
+void Coordinator::balance()
+{
+    // who has each string
+    std::map<String, Array<Instance*>> owners;
+    std::map<String, var> descriptions;
+    std::vector<String> keys;
+    for (Instance* instance : instances)
+    {
+        if (!instance->greeted || instance->lost)
+            continue;
+        for (const var& description : instance->strings)
+        {
+            const String key(Coordination::getKey(description));
+            if (descriptions.count(key) == 0)
+            {
+                keys.push_back(key);
+                descriptions[key] = description;
+            }
+            owners[key].add(instance);
+        }
+    }
+
+    // the strings with the least choice go first, then each goes to whoever has the least so far
+    std::stable_sort(keys.begin(), keys.end(),
+                     [&owners] (const String& a, const String& b) { return owners[a].size() < owners[b].size(); });
+    for (const String& key : keys)
+    {
+        Instance* least = nullptr;
+        for (Instance* instance : owners[key])
+            if (least == nullptr || instance->assigned.size() < least->assigned.size())
+                least = instance;
+        least->assigned.add(descriptions[key]);
+    }
+
+    for (Instance* instance : instances)
+    {
+        if (!instance->greeted || instance->lost)
+            continue;
+        StringArray given;
+        for (const var& description : instance->assigned)
+            given.add(Coordination::getKey(description));
+        log(instance->name + " gets " + String(given.size()) + " of its " + String(instance->strings.size()) + " strings"
+            + (given.size() > 0 ? ": " + given.joinIntoString(", ") : String::empty) + "\n");
+    }
+}
+
+var Coordinator::getSnapshot() const
+{
+    const ScopedLock sl(instances.getLock());
+    Array<var> instanceList, strings;
+
+    for (Instance* instance : instances)
+    {
+        if (!instance->greeted)
+            continue;
+        DynamicObject* entry = new DynamicObject();
+        entry->setProperty("name", instance->name);
+        entry->setProperty("host", instance->host);
+        entry->setProperty("strings", instance->strings.size());
+        entry->setProperty("assigned", instance->assigned.size());
+        entry->setProperty("ok", instance->reported && instance->ok);
+        entry->setProperty("error", instance->lost && !instance->reported ? String("went away") : instance->error);
+        entry->setProperty("seconds", instance->seconds);
+        // from the coordinator sending calibrate to getting the result, so it counts the network as well
+        entry->setProperty("round_trip_seconds", instance->reported ? (instance->reportedAt - instance->sentAt) / 1000.0 : 0.0);
+        entry->setProperty("tables", instance->tables.isArray() ? instance->tables : var(Array<var>()));
+        instanceList.add(var(entry));
+
+        if (const Array<var>* results = instance->results.getArray())
+            for (const var& result : *results)
+            {
+                DynamicObject* string = new DynamicObject();
+                string->setProperty("port", result["port"]);
+                string->setProperty("channel", result["channel"]);
+                string->setProperty("calibrated_by", instance->name);
+                string->setProperty("ready", result["ready"]);
+                string->setProperty("frequency", result["frequency"]);
+                strings.add(var(string));
+            }
+    }
+
+    DynamicObject* root = new DynamicObject();
+    root->setProperty("seconds", calibratedAt > 0 ? (calibratedAt - startedAt) / 1000.0 : 0.0);
+    root->setProperty("instances", instanceList);
+    root->setProperty("strings", strings);
+    return var(root);
+}
+
+void Coordinator::log(const String& message, LogQueue::Level level)
+{
+    if (logger != nullptr)
+        logger->push(message, level);
+}
@@ -0,0 +1,166 @@
+//
+//  Coordination.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__Coordination__
+#define __SwivelAutotune__Coordination__
+
+#include "CoreJuceHeader.h"
+#include "String.h"
+#include "LogQueue.h"
+
+/** Calibrating an instrument that's spread over several instances (swivel-headless or swivel-sim,
+    on one machine or several), run from swivel-coordinator.
+
+    Each instance connects to the coordinator and says which strings it has, by MIDI port and
+    channel. Once they're all there the coordinator shares the strings out, so each is calibrated by
+    exactly one of the instances that has it and none of them has more than its share, and tells them
+    all to start at once. When they've all reported back it sends every instance the open frequencies
+    the others found, so a string wired to more than one instance ends up with the same tables on all
+    of them, and collects every instance's tables into one snapshot.
+
+    The messages are JSON objects over an InterprocessConnection, each with a "type":
+        hello      instance -> coordinator   name, strings [{port, channel}]
+        calibrate  coordinator -> instance   strings [{port, channel}] to calibrate, can be none
+        result     instance -> coordinator   ok, error, seconds, strings [{port, channel, ready, frequency}]
+        tune       coordinator -> instance   strings [{port, channel, frequency}] from everyone
+        tables     instance -> coordinator   strings [{port, channel, frequency, first_note, table}]
+
+    Once it has everyone's tables the coordinator hangs up, which is the instances' cue to carry on.
+ */
+namespace Coordination
+{
+    const int defaultPort = 9123;
+
+    MemoryBlock encode(const var& message);
+    /** A void var if it isn't a JSON object */
+    var decode(const MemoryBlock& message);
+    /** "host:port", the port defaults to defaultPort */
+    Result parseAddress(const String& address, String& host, int& port);
+
+    /** The string's port and channel, which is what tells strings apart across instances */
+    var describeString(const SwivelString& string);
+    /** The same plus its open frequency and lookup table. Only once it's ready to transform */
+    var describeTable(const SwivelString& string);
+    /** Whether a description from a message is of the given string */
+    bool isString(const var& description, const SwivelString& string);
+    /** "port.channel", for logging and for the coordinator to key on */
+    String getKey(const var& description);
+
+    /** Ends the conversation by shutting the socket down under the connection, so its own thread
+        sees the end, lets go of the socket and calls connectionLost(). JUCE's disconnect() races
+        that thread when the other end has already gone, so disconnect() is only for tidying up */
+    void hangUp(InterprocessConnection& connection);
+    /** hangUp(), give the thread a moment to let go, then disconnect(). For destructors */
+    void close(InterprocessConnection& connection);
+}
+
+//==============================================================================================
+/** An instance's end: says which strings it has, calibrates the ones it's given when it's told to,
+    and takes the open frequencies the other instances found for the rest. Callbacks are on the
+    message thread */
+class CoordinatorClient : public InterprocessConnection
+{
+public:
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        /** Time to calibrate these, which may be none. Call calibrationFinished() when it's done */
+        virtual void calibrationRequested(const Array<SwivelString*>& strings) = 0;
+        /** The tables are all in place, or the coordinator went away before they were */
+        virtual void coordinationFinished(Result result) = 0;
+    };
+
+    /** Nothing's done to the strings until the coordinator says so, and not while they're being calibrated */
+    CoordinatorClient(const String& instanceName, OwnedArray<SwivelString, CriticalSection>* strings, Listener* listener);
+    ~CoordinatorClient();
+
+    void setLog(LogQueue* where);
+    /** Connects to "host:port" and says hello */
+    Result connect(const String& address);
+    /** Reports back how the calibration went and how long it took */
+    void calibrationFinished(Result result, double seconds);
+
+    void connectionMade() override;
+    void connectionLost() override;
+    void messageReceived(const MemoryBlock& message) override;
+
+private:
+    const String name;
+    OwnedArray<SwivelString, CriticalSection>* swivelStrings;
+    Listener* listener;
+    LogQueue* logger;
+    Array<SwivelString*> assigned;
+    bool tablesSent;
+    bool finished;
+
+    void send(const var& message);
+    /** Takes the other instances' frequencies, then sends back every table and waits to be hung up on */
+    void tune(const var& strings);
+    void finish(Result result);
+
+    JUCE_DECLARE_NON_COPYABLE (CoordinatorClient)
+};
+
+//==============================================================================================
+/** The coordinator's end, see Coordination. Everything but accepting connections happens on the
+    message thread, so it needs a dispatch loop */
+class Coordinator : private InterprocessConnectionServer
+{
+public:
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        /** Every instance has sent its tables, or given up. Fails if any string didn't get calibrated */
+        virtual void coordinationFinished(Result result) = 0;
+    };
+
+    /** Waits for this many instances before starting */
+    Coordinator(int numInstances, Listener* listener);
+    ~Coordinator();
+
+    void setLog(LogQueue* where);
+    Result start(int port);
+    /** Everything so far: each instance with its timings and tables, and each string with the
+        instance that calibrated it and what it found */
+    var getSnapshot() const;
+
+private:
+    class Instance;
+
+    enum State
+    {
+        waitingForInstances,
+        calibrating,
+        tuning,
+        closing,
+        finished
+    };
+
+    const int numInstances;
+    Listener* listener;
+    LogQueue* logger;
+    State state;
+    OwnedArray<Instance, CriticalSection> instances;
+    double startedAt;
+    double calibratedAt;
+
+    InterprocessConnection* createConnectionObject() override;
+    void handleMessage(Instance& instance, const var& message);
+    void instanceLost(Instance& instance);
+    /** Moves on to the next state if everyone's ready for it */
+    void update();
+    /** Shares the strings out between the instances that have them */
+    void balance();
+    void log(const String& message, LogQueue::Level level = LogQueue::info);
+
+    JUCE_DECLARE_NON_COPYABLE (Coordinator)
+};
+
+#endif /* defined(__SwivelAutotune__Coordination__) */
@@ -0,0 +1,199 @@
+//
+//  CoordinatorMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  Calibrates an instrument spread over several instances together, see Coordination.h. Waits for
+//  the instances to connect, shares the strings out between them, starts them all at once and
+//  writes a snapshot of every instance's timings and tables once they've finished.
+//
+//      swivel-coordinator --instances n [--port 9123] [--snapshot coordination.json] [--timeout 600]
+//
+//  The instances are swivel-headless with coordinator = host:port in its config, or swivel-sim with
+//  --coordinator host:port. The snapshot is written even if it fails or times out, with whatever
+//  there was by then.
+//
+
+#include <csignal>
+#include <iostream>
+#include "CoreJuceHeader.h"
+#include "Coordination.h"
+#include "LogQueue.h"
+
+namespace
+{
+    volatile std::sig_atomic_t quitRequested = 0;
+
+    void requestQuit(int)
+    {
+        quitRequested = 1;
+    }
+
+    struct Options
+    {
+        int instances = 0;
+        int port = Coordination::defaultPort;
+        File snapshot = File::getCurrentWorkingDirectory().getChildFile("coordination.json");
+        int timeout = 600; // seconds
+    };
+
+    Result parseOptions(const StringArray& args, Options& options)
+    {
+        for (int i = 0; i < args.size(); i++)
+        {
+            const String& arg = args[i];
+            if (i + 1 >= args.size())
+                return Result::fail("Missing value for " + arg);
+
+            const String value = args[++i];
+            if (arg == "--instances")
+                options.instances = value.getIntValue();
+            else if (arg == "--port")
+                options.port = value.getIntValue();
+            else if (arg == "--snapshot")
+                options.snapshot = File::getCurrentWorkingDirectory().getChildFile(value);
+            else if (arg == "--timeout")
+                options.timeout = value.getIntValue();
+            else
+                return Result::fail("Unknown option: " + arg);
+        }
+
+        if (options.instances < 1)
+            return Result::fail("Usage: swivel-coordinator --instances n [options], see CoordinatorMain.cpp");
+        if (options.timeout < 1)
+            return Result::fail("--timeout should be at least a second");
+        return Result::ok();
+    }
+}
+
+//==============================================================================================
+class CoordinatorRunner : public  Coordinator::Listener,
+                          public  LogQueue::Target,
+                          private Timer
+{
+public:
+    CoordinatorRunner(const Options& o)
+    :   options(o),
+        coordinator(o.instances, this),
+        exitCode(0),
+        startedAt(Time::getMillisecondCounter())
+    {
+        logQueue.setTarget(this);
+        coordinator.setLog(&logQueue);
+    }
+
+    ~CoordinatorRunner()
+    {
+        stopTimer();
+        logQueue.drain();
+    }
+
+    Result start()
+    {
+        Result result = coordinator.start(options.port);
+        if (result)
+            startTimer(100);
+        return result;
+    }
+
+    int getExitCode() const { return exitCode; }
+
+    //==========================================================================================
+    void coordinationFinished(Result result) override
+    {
+        if (result)
+            logQueue.push("Every string calibrated\n");
+        else
+        {
+            logQueue.push(result.getErrorMessage() + "\n", LogQueue::error);
+            exitCode = 1;
+        }
+        finish();
+    }
+
+    void addText(const String& text, LogQueue::Level level) override
+    {
+        if (level >= LogQueue::warning)
+            std::cerr << text << std::flush;
+        else
+            std::cout << text << std::flush;
+    }
+
+private:
+    const Options& options;
+    LogQueue logQueue;
+    Coordinator coordinator;
+    int exitCode;
+    uint32 startedAt;
+
+    // signals can't touch the message manager, so keep an eye out for them here
+    void timerCallback() override
+    {
+        if (quitRequested)
+        {
+            logQueue.push("Quitting\n");
+            exitCode = 1;
+            finish();
+        }
+        else if (Time::getMillisecondCounter() - startedAt > (uint32) options.timeout * 1000)
+        {
+            logQueue.push("Timed out after " + String(options.timeout) + "s\n", LogQueue::error);
+            exitCode = 1;
+            finish();
+        }
+    }
+
+    void finish()
+    {
+        stopTimer();
+        if (options.snapshot.replaceWithText(JSON::toString(coordinator.getSnapshot())))
+            logQueue.push("Snapshot written to " + options.snapshot.getFullPathName() + "\n");
+        else
+            logQueue.push("Couldn't write " + options.snapshot.getFullPathName() + "\n", LogQueue::error);
+        MessageManager::getInstance()->stopDispatchLoop();
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (CoordinatorRunner)
+};
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add(argv[i]);
+
+    Options options;
+    Result parsed = parseOptions(args, options);
+    if (!parsed)
+    {
+        std::cerr << parsed.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    std::signal(SIGINT, requestQuit);
+    std::signal(SIGTERM, requestQuit);
+
+    MessageManager::getInstance()->setCurrentThreadAsMessageThread();
+
+    int exitCode = 0;
+    {
+        CoordinatorRunner runner(options);
+        Result started = runner.start();
+        if (started)
+        {
+            MessageManager::getInstance()->runDispatchLoop();
+            exitCode = runner.getExitCode();
+        }
+        else
+        {
+            std::cerr << started.getErrorMessage() << std::endl;
+            exitCode = 1;
+        }
+    }
+
+    DeletedAtShutdown::deleteAll();
+    MessageManager::deleteInstance();
+    return exitCode;
+}
@@ -0,0 +1,28 @@
+//
+//  CoreJuceHeader.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+/**
+    Includes only the JUCE modules that work without a display. Anything that the headless
+    build shares with the app includes this rather than JuceHeader.h, so it never pulls in the
+    GUI modules.
+*/
+
+#ifndef SwivelAutotune_CoreJuceHeader_h
+#define SwivelAutotune_CoreJuceHeader_h
+
+#include "../JuceLibraryCode/AppConfig.h"
+#include "../JuceLibraryCode/modules/juce_core/juce_core.h"
+#include "../JuceLibraryCode/modules/juce_events/juce_events.h"
+#include "../JuceLibraryCode/modules/juce_audio_basics/juce_audio_basics.h"
+#include "../JuceLibraryCode/modules/juce_audio_formats/juce_audio_formats.h"
+#include "../JuceLibraryCode/modules/juce_audio_devices/juce_audio_devices.h"
+
+#if ! DONT_SET_USING_JUCE_NAMESPACE
+ using namespace juce;
+#endif
+
+#endif
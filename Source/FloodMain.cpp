@@ -0,0 +1,467 @@
+//
+//  FloodMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  Floods the MIDI thru (the same MidiThru the app and the headless build use) with dense traffic
+//  and reports whether it kept up: throughput, messages dropped and latency percentiles per string.
+//  The strings in the data file are calibrated against the simulated rig first, then one or more
+//  virtual sources play into the thru as if they were MIDI inputs, and a virtual sink counts what
+//  comes out. Exits with 1 if anything was lost or p99 went over --max-p99, so it can gate a deploy.
+//
+//      swivel-flood datafile [--rate 20000] [--seconds 10] [--sources 1] [--notes 0.05]
+//                            [--replay file.mid] [--speed 1] [--max-p99 us] [--stats file] [--seed n]
+//
+//  --rate is messages a second across all the sources, mostly pitch bends spread over every string
+//  with --notes of them note ons and offs. --replay plays a MIDI file's channel messages on a loop
+//  instead, --speed times faster. Only strings on MIDI port 0 are flooded.
+//
+
+#include <atomic>
+#include <iostream>
+#include "CoreJuceHeader.h"
+#include "String.h"
+#include "SwivelStringFileParser.h"
+#include "SimulatedRig.h"
+#include "MidiThru.h"
+
+namespace
+{
+    struct Options
+    {
+        File dataFile;
+        double rate = 20000.0;
+        double seconds = 10.0;
+        int sources = 1;
+        double notes = 0.05;
+        File replay;
+        double speed = 1.0;
+        int64 maxP99 = 0; // no limit
+        File stats;
+        int64 seed = 1;
+    };
+
+    Result parseOptions(const StringArray& args, Options& options)
+    {
+        if (args.size() == 0 || args[0].startsWith("--"))
+            return Result::fail("Usage: swivel-flood datafile [options], see FloodMain.cpp");
+        options.dataFile = File::getCurrentWorkingDirectory().getChildFile(args[0]);
+
+        for (int i = 1; i < args.size(); i++)
+        {
+            const String& arg = args[i];
+            if (i + 1 >= args.size())
+                return Result::fail("Missing value for " + arg);
+
+            const String value = args[++i];
+            if (arg == "--rate")
+                options.rate = value.getDoubleValue();
+            else if (arg == "--seconds")
+                options.seconds = value.getDoubleValue();
+            else if (arg == "--sources")
+                options.sources = value.getIntValue();
+            else if (arg == "--notes")
+                options.notes = value.getDoubleValue();
+            else if (arg == "--replay")
+                options.replay = File::getCurrentWorkingDirectory().getChildFile(value);
+            else if (arg == "--speed")
+                options.speed = value.getDoubleValue();
+            else if (arg == "--max-p99")
+                options.maxP99 = value.getLargeIntValue();
+            else if (arg == "--stats")
+                options.stats = File::getCurrentWorkingDirectory().getChildFile(value);
+            else if (arg == "--seed")
+                options.seed = value.getLargeIntValue();
+            else
+                return Result::fail("Unknown option: " + arg);
+        }
+
+        if (options.rate <= 0 || options.seconds <= 0 || options.speed <= 0)
+            return Result::fail("--rate, --seconds and --speed should be more than 0");
+        if (options.sources < 1 || options.sources > 16)
+            return Result::fail("--sources should be 1-16");
+        return Result::ok();
+    }
+
+    /** A string the flood can play, by channel */
+    struct Target
+    {
+        int channel;
+        int lowestNote;
+    };
+
+    //==========================================================================================
+    /** Calibrates a string off a simulated pluck somewhere in its measured range, the same way the
+        analysis thread would, so it's ready to transform */
+    Result calibrate(SwivelString& string, SwivelStringFileParser::StringDataBundle* bundle, Random& random)
+    {
+        const double sampleRate = 44100.0;
+        const int fftSize = 8192;
+        const int blockSize = 512;
+
+        double lowest = bundle->fundamentals->getFirst(), highest = lowest;
+        for (int f = 0; f < bundle->fundamentals->size(); f++)
+        {
+            lowest = jmin(lowest, (*bundle->fundamentals)[f]);
+            highest = jmax(highest, (*bundle->fundamentals)[f]);
+        }
+
+        SimulatedRig rig(1, sampleRate, random.nextInt64());
+        SimulatedRig::StringModel model;
+        model.openFrequency = lowest + (highest - lowest) * (0.1 + 0.8 * random.nextDouble());
+        rig.addString(model);
+        MidiBuffer pluck;
+        pluck.addEvent(MidiMessage::controllerEvent(model.midiChannel, model.excitationController, 127), 0);
+        rig.sendBlockOfMessages(model.midiPort, pluck, 0, sampleRate);
+
+        string.initialiseFromBundle(bundle);
+        double* in = (double*) fftw_malloc(sizeof(double)*fftSize);
+        fftw_complex* out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex)*fftSize);
+        fftw_plan plan = fftw_plan_dft_r2c_1d(fftSize, in, out, FFTW_ESTIMATE);
+        string.initialiseAudioParameters(plan, in, out, fftSize, sampleRate, 2, 0.001, 0.001, Windowing::HANN);
+
+        HeapBlock<float> block(blockSize);
+        for (int fed = 0; fed < sampleRate * 8 && !string.hasFinishedListening(); fed += blockSize)
+        {
+            float* channels[1] = { block };
+            rig.render(channels, 1, blockSize);
+            const float* inputs[1] = { block };
+            string.audioDeviceIOCallback(inputs, 1, nullptr, 0, blockSize);
+        }
+        string.processFrequencies();
+
+        fftw_destroy_plan(plan);
+        fftw_free(in);
+        fftw_free(out);
+
+        if (!string.isReadyToTransform())
+            return Result::fail("Couldn't calibrate the string on channel " + String(string.getMidiChannel()));
+        return Result::ok();
+    }
+}
+
+//==============================================================================================
+/** Counts what comes out of the thru, only ever called from its thread */
+class CountingSink : public MidiThru::Sink
+{
+public:
+    CountingSink() : delivered(0), lastAt(0) {}
+
+    void handleOutgoingMessage(int, const MidiMessage&) override
+    {
+        lastAt.store(Time::getMillisecondCounterHiRes(), std::memory_order_relaxed);
+        delivered.fetch_add(1, std::memory_order_release);
+    }
+
+    int64 getNumDelivered() const { return delivered.load(std::memory_order_acquire); }
+    double getLastDeliveryTime() const { return lastAt.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64> delivered;
+    std::atomic<double> lastAt;
+
+    JUCE_DECLARE_NON_COPYABLE (CountingSink)
+};
+
+//==============================================================================================
+/** Plays into the thru the way a MIDI input's driver would, from its own thread, either made up
+    traffic at a steady rate or a MIDI file on a loop */
+class FloodSource : public Thread
+{
+public:
+    FloodSource(int index, MidiThru& t, const Array<Target>& targets, const Options& o)
+    :   Thread("Flood Source " + String(index)),
+        thru(t),
+        strings(targets),
+        options(o),
+        rate(o.rate / o.sources),
+        random(o.seed + index),
+        offered(0),
+        unrouted(0),
+        next(index)
+    {
+        zeromem(routed, sizeof(routed));
+        for (const Target& target : strings)
+            routed[target.channel-1] = true;
+        for (int i = 0; i < 16; i++)
+        {
+            bends[i] = 8192;
+            notesOn[i] = -1;
+        }
+    }
+
+    ~FloodSource()
+    {
+        stopThread(2000);
+    }
+
+    /** Loads the file to replay, instead of making traffic up */
+    Result loadReplay(const File& file)
+    {
+        FileInputStream stream(file);
+        MidiFile midiFile;
+        if (stream.failedToOpen() || !midiFile.readFrom(stream))
+            return Result::fail("Couldn't read " + file.getFullPathName());
+
+        midiFile.convertTimestampTicksToSeconds();
+        for (int t = 0; t < midiFile.getNumTracks(); t++)
+            replay.addSequence(*midiFile.getTrack(t), 0, 0, std::numeric_limits<double>::max());
+        replay.updateMatchedPairs();
+
+        // only what the thru would take from a driver
+        for (int i = replay.getNumEvents(); --i >= 0;)
+        {
+            const MidiMessage& message = replay.getEventPointer(i)->message;
+            if (message.getChannel() == 0 || message.getRawDataSize() > 3)
+                replay.deleteEvent(i, false);
+        }
+        if (replay.getNumEvents() == 0)
+            return Result::fail("No channel messages in " + file.getFullPathName());
+        return Result::ok();
+    }
+
+    /** Messages played on channels with a string, which should all come out of the thru */
+    int64 getNumOffered() const { return offered; }
+    /** Messages played on channels without one, which the thru drops on purpose */
+    int64 getNumUnrouted() const { return unrouted; }
+
+    void run() override
+    {
+        // each string has to have had a note before bends mean anything
+        for (const Target& target : strings)
+            play(MidiMessage::noteOn(target.channel, target.lowestNote + 12, (uint8) 100));
+
+        const double start = Time::getMillisecondCounterHiRes();
+        const double end = start + options.seconds * 1000.0;
+        int replayIndex = 0;
+        double replayStart = start;
+
+        for (double now = start; now < end && !threadShouldExit(); now = Time::getMillisecondCounterHiRes())
+        {
+            if (replay.getNumEvents() > 0)
+            {
+                // everything that's due, round again once the file's done
+                for (;;)
+                {
+                    if (replayIndex >= replay.getNumEvents())
+                    {
+                        replayStart += jmax(1.0, replay.getEndTime() * 1000.0 / options.speed);
+                        replayIndex = 0;
+                    }
+                    const MidiMessage& message = replay.getEventPointer(replayIndex)->message;
+                    if (replayStart + message.getTimeStamp() * 1000.0 / options.speed > now)
+                        break;
+                    play(message);
+                    replayIndex++;
+                }
+            }
+            else
+            {
+                const int64 due = (int64) ((now - start) * rate / 1000.0);
+                while (offered < due)
+                    play(makeMessage());
+            }
+
+            // drivers deliver in bursts about this often anyway
+            wait(1);
+        }
+    }
+
+private:
+    MidiThru& thru;
+    const Array<Target>& strings;
+    const Options& options;
+    const double rate;
+    Random random;
+    MidiMessageSequence replay;
+    int64 offered;
+    int64 unrouted;
+    bool routed[16];
+    int next; // round the strings
+    int bends[16];
+    int notesOn[16];
+
+    void play(const MidiMessage& message)
+    {
+        MidiMessage stamped(message, Time::getMillisecondCounterHiRes() * 0.001);
+        thru.handleIncomingMidiMessage(nullptr, stamped);
+        if (routed[message.getChannel()-1])
+            offered++;
+        else
+            unrouted++;
+    }
+
+    /** Pitch bend sweeps on every string in turn, with the odd note on or off */
+    MidiMessage makeMessage()
+    {
+        const Target& target = strings.getReference(next++ % strings.size());
+        const int c = target.channel - 1;
+
+        if (random.nextDouble() < options.notes)
+        {
+            if (notesOn[c] >= 0)
+            {
+                const int note = notesOn[c];
+                notesOn[c] = -1;
+                return MidiMessage::noteOff(target.channel, note);
+            }
+            // away from the ends of the string, the bends reach a couple of semitones either side
+            notesOn[c] = target.lowestNote + 2 + random.nextInt(20);
+            return MidiMessage::noteOn(target.channel, notesOn[c], (uint8) 100);
+        }
+
+        bends[c] = (bends[c] + 67) & 0x3fff;
+        return MidiMessage::pitchWheel(target.channel, bends[c]);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (FloodSource)
+};
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add(argv[i]);
+
+    Options options;
+    Result parsed = parseOptions(args, options);
+    if (!parsed)
+    {
+        std::cerr << parsed.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    // strings, all calibrated
+    OwnedArray<SwivelString, CriticalSection> swivelStrings;
+    OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+    Array<Target> targets;
+    try
+    {
+        ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(options.dataFile);
+        if (data == nullptr)
+        {
+            std::cerr << "Couldn't open " << options.dataFile.getFullPathName() << std::endl;
+            return 1;
+        }
+        bundles.addArray(*data);
+    }
+    catch (SwivelStringFileParser::ParseException const &e)
+    {
+        std::cerr << "Parse Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    Random random(options.seed);
+    for (SwivelStringFileParser::StringDataBundle* bundle : bundles)
+    {
+        if (bundle->port != 0)
+        {
+            std::cerr << "Skipping string " << bundle->num << ", it's on MIDI port " << bundle->port << std::endl;
+            continue;
+        }
+        const int lowestNote = bundle->num;
+        SwivelString* string = new SwivelString();
+        swivelStrings.add(string);
+        Result calibrated = calibrate(*string, bundle, random);
+        if (!calibrated)
+        {
+            std::cerr << calibrated.getErrorMessage() << std::endl;
+            return 1;
+        }
+        Target target = { string->getMidiChannel(), lowestNote };
+        targets.add(target);
+    }
+    if (targets.size() == 0)
+    {
+        std::cerr << "No strings on MIDI port 0 in " << options.dataFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    // the thru, with the sink in place of a real output
+    CountingSink sink;
+    MidiThru thru(&swivelStrings);
+    thru.setBypassed(true);
+    thru.setSink(0, &sink);
+    Result routed = thru.updateRouting();
+    if (!routed)
+    {
+        std::cerr << routed.getErrorMessage() << std::endl;
+        return 1;
+    }
+    thru.setBypassed(false);
+
+    OwnedArray<FloodSource> sources;
+    for (int i = 0; i < options.sources; i++)
+    {
+        FloodSource* source = new FloodSource(i, thru, targets, options);
+        sources.add(source);
+        if (options.replay != File::nonexistent)
+        {
+            Result loaded = source->loadReplay(options.replay);
+            if (!loaded)
+            {
+                std::cerr << loaded.getErrorMessage() << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::cout << "Flooding " << targets.size() << " strings from " << options.sources << " source(s) for "
+              << options.seconds << "s" << std::endl;
+    const double start = Time::getMillisecondCounterHiRes();
+    for (FloodSource* source : sources)
+        source->startThread(9);
+    for (FloodSource* source : sources)
+        source->waitForThreadToExit(-1);
+    const double stopped = Time::getMillisecondCounterHiRes();
+
+    int64 offered = 0, unrouted = 0;
+    for (FloodSource* source : sources)
+    {
+        offered += source->getNumOffered();
+        unrouted += source->getNumUnrouted();
+    }
+
+    // let the thru catch up, anything not out in a couple of seconds isn't coming
+    int64 dropped = 0;
+    for (double waited = 0; waited < 2000.0; waited += 10.0)
+    {
+        dropped += thru.getNumDropped();
+        if (sink.getNumDelivered() + dropped >= offered)
+            break;
+        Thread::sleep(10);
+    }
+    dropped += thru.getNumDropped();
+
+    const int64 delivered = sink.getNumDelivered();
+    const int64 missing = jmax((int64) 0, offered - delivered - dropped);
+    const double sendingSeconds = (stopped - start) / 1000.0;
+    const double deliveringSeconds = jmax(1.0, sink.getLastDeliveryTime() - start) / 1000.0;
+
+    std::cout << "Offered   " << offered << " (" << String(roundToInt(offered / sendingSeconds)) << " msg/s)";
+    if (unrouted > 0)
+        std::cout << ", and " << unrouted << " on channels without a string";
+    std::cout << "\nDelivered " << delivered << " (" << String(roundToInt(delivered / deliveringSeconds)) << " msg/s)\n"
+              << "Dropped   " << dropped << " (queue full)\n"
+              << "Missing   " << missing << "\n\n"
+              << thru.getStats().getSummary() << std::flush;
+
+    if (options.stats != File::nonexistent)
+    {
+        Result dumped = thru.getStats().dump(options.stats);
+        if (!dumped)
+            std::cerr << dumped.getErrorMessage() << std::endl;
+    }
+
+    bool keptUp = dropped == 0 && missing == 0;
+    const int64 p99 = thru.getStats().getOverall().getValueAtPercentile(99.0);
+    if (options.maxP99 > 0 && p99 > options.maxP99)
+    {
+        std::cout << "p99 " << p99 << "us is over the limit of " << options.maxP99 << "us" << std::endl;
+        keptUp = false;
+    }
+    std::cout << (keptUp ? "Kept up" : "Didn't keep up") << std::endl;
+    return keptUp ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+//
+//  HeadlessConfig.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "HeadlessConfig.h"
+
+HeadlessConfig::HeadlessConfig()
+:   sampleRate(44100.0),
+    bufferSize(512),
+    numInputs(2),
+    fftSize(8192),
+    overlap(2),
+    window(Windowing::HANN),
+    thresholdUp(0.001),
+    thresholdDown(0.001),
+    statsFile(File::getCurrentWorkingDirectory().getChildFile("thru-stats.json")),
+    lockMemory(false),
+    jackPorts(1),
+    coordinatorName(SystemStats::getComputerName())
+{
+
+}
+
+Result HeadlessConfig::load(const File& file)
+{
+    if (!file.existsAsFile())
+        return Result::fail("Config file " + file.getFullPathName() + " doesn't exist");
+    
+    StringArray lines;
+    file.readLines(lines);
+    
+    for (int i = 0; i < lines.size(); i++)
+    {
+        String line = lines[i].upToFirstOccurrenceOf("#", false, false).trim();
+        if (line.isEmpty())
+            continue;
+        
+        if (!line.containsChar('='))
+            return Result::fail("Line " + String(i+1) + " of config isn't key = value: " + line);
+        
+        Result result = set(line.upToFirstOccurrenceOf("=", false, false).trim().toLowerCase(),
+                            line.fromFirstOccurrenceOf("=", false, false).trim(),
+                            file);
+        if (!result)
+            return Result::fail("Line " + String(i+1) + " of config: " + result.getErrorMessage());
+    }
+    
+    if (dataFile == File::nonexistent)
+        return Result::fail("Config needs a datafile");
+    // JACK has its own MIDI ports
+    if (!isJack())
+    {
+        if (midiIns.size() == 0 || midiOuts.size() == 0)
+            return Result::fail("Config needs both midi.in and midi.out");
+        if (midiIns.size() != midiOuts.size())
+            return Result::fail("Config needs as many midi.out ports as midi.in ports, they go in pairs");
+    }
+    for (auto& route : routes)
+        if (route.first.first >= getNumMidiPorts())
+            return Result::fail("route." + String(route.first.first) + "." + String(route.first.second) + " is for a MIDI port that "
+                                + (isJack() ? "is more than jack.ports" : "isn't in midi.in"));
+    
+    return Result::ok();
+}
+
+int HeadlessConfig::getAudioChannelFor(int midiPort, int midiChannel) const
+{
+    auto found = routes.find(std::make_pair(midiPort, midiChannel));
+    return found != routes.end() ? found->second : 0;
+}
+
+bool HeadlessConfig::isJack() const
+{
+    return jackClient.isNotEmpty();
+}
+
+int HeadlessConfig::getNumMidiPorts() const
+{
+    return isJack() ? jackPorts : midiIns.size();
+}
+
+//==============================================================================================
+Result HeadlessConfig::set(const String& key, const String& value, const File& file)
+{
+    if (key == "datafile")
+        dataFile = file.getSiblingFile(value); // relative to the config, absolute paths work too
+    else if (key == "audio.type")
+        audioType = value;
+    else if (key == "audio.device")
+        audioDevice = value;
+    else if (key == "audio.samplerate")
+        sampleRate = value.getDoubleValue();
+    else if (key == "audio.buffersize")
+        bufferSize = value.getIntValue();
+    else if (key == "audio.inputs")
+        numInputs = value.getIntValue();
+    else if (key == "audio.aggregate")
+        aggregate = splitPorts(value);
+    else if (key.startsWith("route."))
+    {
+        // route.<channel> for the first port, route.<port>.<channel> for any of them
+        String address = key.fromFirstOccurrenceOf("route.", false, false);
+        int port = 0;
+        if (address.containsChar('.'))
+        {
+            port = address.upToFirstOccurrenceOf(".", false, false).getIntValue();
+            address = address.fromFirstOccurrenceOf(".", false, false);
+        }
+        int channel = address.getIntValue();
+        if (channel < 1 || channel > 16)
+            return Result::fail("MIDI channel should be 1-16, not " + key);
+        if (port < 0)
+            return Result::fail("MIDI port can't be negative: " + key);
+        routes[std::make_pair(port, channel)] = value.getIntValue();
+    }
+    else if (key == "midi.in")
+        midiIns = splitPorts(value);
+    else if (key == "midi.out")
+        midiOuts = splitPorts(value);
+    else if (key == "fft.size")
+    {
+        fftSize = value.getIntValue();
+        if (fftSize <= 0 || !isPowerOfTwo(fftSize))
+            return Result::fail("fft.size should be a power of two");
+    }
+    else if (key == "fft.overlap")
+    {
+        overlap = value.getIntValue();
+        if (overlap < 1 || overlap > 4)
+            return Result::fail("fft.overlap should be 1-4");
+    }
+    else if (key == "window")
+    {
+        String name = value.toLowerCase();
+        if (name == "hann")
+            window = Windowing::HANN;
+        else if (name == "hamming")
+            window = Windowing::HAMMING;
+        else if (name == "blackman")
+            window = Windowing::BLACKMAN;
+        else if (name == "rectangular" || name == "rectangle")
+            window = Windowing::RECTANGULAR;
+        else
+            return Result::fail("Unknown window: " + value);
+    }
+    else if (key == "threshold.up")
+        thresholdUp = value.getDoubleValue();
+    else if (key == "threshold.down")
+        thresholdDown = value.getDoubleValue();
+    else if (key == "stats.file")
+        statsFile = file.getSiblingFile(value);
+    else if (key == "trace.file")
+        traceFile = file.getSiblingFile(value);
+    else if (key.startsWith("sched.") || key.startsWith("cpus."))
+    {
+        ThreadScheduling* scheduling = findScheduling(key);
+        if (scheduling == nullptr)
+            return Result::fail("Unknown thread in " + key + ", should be analysis, thru or audio");
+        return key.startsWith("sched.") ? scheduling->parsePolicy(value) : scheduling->parseCpus(value);
+    }
+    else if (key == "memory.lock")
+        lockMemory = value.equalsIgnoreCase("yes") || value.equalsIgnoreCase("true") || value == "1";
+    else if (key == "jack.client")
+        jackClient = value;
+    else if (key == "jack.ports")
+    {
+        jackPorts = value.getIntValue();
+        if (jackPorts < 1 || jackPorts > 16)
+            return Result::fail("jack.ports should be 1-16");
+    }
+    else if (key == "jack.connect")
+    {
+        for (const String& connection : splitPorts(value))
+        {
+            if (!connection.containsChar('>'))
+                return Result::fail("JACK connections are source > destination, not " + connection);
+            jackSources.add(connection.upToFirstOccurrenceOf(">", false, false).trim());
+            jackDestinations.add(connection.fromFirstOccurrenceOf(">", false, false).trim());
+        }
+    }
+    else if (key == "coordinator")
+        coordinator = value;
+    else if (key == "coordinator.name")
+        coordinatorName = value;
+    else if (key == "tables.shm")
+    {
+        if (!value.startsWithChar('/') || value.lastIndexOfChar('/') != 0 || value.length() < 2)
+            return Result::fail("tables.shm should be a shared memory name like /swivel-tables, not " + value);
+        tablesShm = value;
+    }
+    else
+        return Result::fail("Unknown key: " + key);
+    
+    return Result::ok();
+}
+
+ThreadScheduling* HeadlessConfig::findScheduling(const String& key)
+{
+    const String thread = key.fromFirstOccurrenceOf(".", false, false);
+    if (thread == "analysis")
+        return &analysisScheduling;
+    if (thread == "thru")
+        return &thruScheduling;
+    if (thread == "audio")
+        return &audioScheduling;
+    return nullptr;
+}
+
+StringArray HeadlessConfig::splitPorts(const String& value)
+{
+    StringArray ports;
+    ports.addTokens(value, ",", String::empty);
+    ports.trim();
+    ports.removeEmptyStrings();
+    return ports;
+}
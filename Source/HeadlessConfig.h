@@ -0,0 +1,122 @@
+//
+//  HeadlessConfig.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__HeadlessConfig__
+#define __SwivelAutotune__HeadlessConfig__
+
+#include <map>
+#include "CoreJuceHeader.h"
+#include "Windowing.h"
+#include "ThreadScheduling.h"
+
+/** Everything the GUI would normally ask for, read from a file instead.
+    The file is one "key = value" per line, # starts a comment. Anything left out keeps the default.
+ 
+        datafile         = strings.xml           (required)
+        audio.type       = ALSA                  (default: whatever comes first)
+        audio.device     = hw:0                  (default: the default device)
+        audio.samplerate = 44100
+        audio.buffersize = 512
+        audio.inputs     = 2                     (how many input channels to open)
+        audio.aggregate  = ALSA:hw:0, ALSA:hw:1  (several interfaces as one, inputs numbered on from
+                                                  each other; type and device are ignored)
+        route.<midi channel> = <audio input>     (eg. route.3 = 1, strings default to input 0)
+        route.<port>.<midi channel> = <audio input>   (the same for strings on other MIDI ports)
+        midi.in          = name of input port    (required, a comma separated list for more than one)
+        midi.out         = name of output port   (required, as many as there are inputs)
+        fft.size         = 8192
+        fft.overlap      = 2
+        window           = hann | hamming | blackman | rectangular
+        threshold.up     = 0.001
+        threshold.down   = 0.001
+        stats.file       = thru-stats.json       (where SIGUSR1 writes the thru's latencies)
+        trace.file       = calibration.json      (a timeline of the calibration for chrome://tracing,
+                                                  off unless it's set)
+        sched.analysis   = other | fifo:<1-99> | rr:<1-99>   (scheduling for the analysis thread,
+        sched.thru       = fifo:70                            the MIDI thru's thread and the audio
+        sched.audio      = fifo:80                            device's thread, default unchanged)
+        cpus.analysis    = 2,3                   (CPUs each of those can run on, default any)
+        cpus.thru        = 1
+        cpus.audio       = 0
+        memory.lock      = no                    (mlockall, so the realtime threads never page fault)
+        jack.client      = swivel                (run as this JACK client instead, audio.* other than
+                                                  inputs and midi.* are ignored, see JackSession)
+        jack.ports       = 1                     (how many MIDI ports it has)
+        jack.connect     = system:capture_1 > in_1, midi_out_1 > rig:midi_in
+                                                 (connections to make once it's running, ours can
+                                                  go without the client's name)
+        coordinator      = 192.168.1.10:9123     (calibrate along with other instances, as and when
+                                                  swivel-coordinator says, see Coordination.h)
+        coordinator.name = rack-2                (what it's called there, default the hostname)
+        tables.shm       = /swivel-tables        (publish the note tables in shared memory for other
+                                                  software to read, see SwivelTables.h, off unless set)
+ */
+class HeadlessConfig
+{
+public:
+    HeadlessConfig();
+    
+    /** Reads the file, fails on anything it doesn't understand */
+    Result load(const File& file);
+    
+    /** Gets the audio input a string's MIDI port and channel are routed to */
+    int getAudioChannelFor(int midiPort, int midiChannel) const;
+    /** Whether it's running as a JACK client */
+    bool isJack() const;
+    /** How many MIDI ports there are, either in midi.in or in JACK */
+    int getNumMidiPorts() const;
+    
+    File dataFile;
+    
+    String audioType;
+    String audioDevice;
+    double sampleRate;
+    int bufferSize;
+    int numInputs;
+    StringArray aggregate; // "type:device" each, empty for just the one device
+    
+    // port n is midiIns[n] and midiOuts[n], the port a string is on is in the data file
+    StringArray midiIns;
+    StringArray midiOuts;
+    
+    int fftSize;
+    int overlap;
+    Windowing::WindowType window;
+    double thresholdUp;
+    double thresholdDown;
+    
+    File statsFile;
+    File traceFile; // nonexistent for no trace
+    
+    ThreadScheduling analysisScheduling;
+    ThreadScheduling thruScheduling;
+    ThreadScheduling audioScheduling;
+    bool lockMemory;
+    
+    String jackClient; // empty when it isn't using JACK
+    int jackPorts;
+    // connection n is from jackSources[n] to jackDestinations[n]
+    StringArray jackSources;
+    StringArray jackDestinations;
+    
+    String coordinator; // "host:port", empty to calibrate on its own
+    String coordinatorName;
+    
+    String tablesShm; // empty for none
+    
+private:
+    // (midi port, midi channel) -> audio input
+    std::map<std::pair<int, int>, int> routes;
+    
+    Result set(const String& key, const String& value, const File& file);
+    static StringArray splitPorts(const String& value);
+    /** The scheduling a sched.* or cpus.* key is about, nullptr if it isn't one of ours */
+    ThreadScheduling* findScheduling(const String& key);
+};
+
+#endif /* defined(__SwivelAutotune__HeadlessConfig__) */
@@ -0,0 +1,516 @@
+//
+//  HeadlessMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  Entry point for the display-less build. Reads a config file, calibrates the strings and then
+//  sits there doing MIDI thru until it gets SIGINT or SIGTERM. None of the GUI modules are used.
+//  SIGUSR1 logs the thru's latencies and writes them to the config's stats.file. With trace.file
+//  set the calibration is traced and written there once it's finished. With jack.client set it's a
+//  JACK client instead, and the capture, the analysis' MIDI and the thru all happen in the JACK cycle.
+//  With coordinator set it waits for swivel-coordinator to start the calibration, and only calibrates
+//  the strings it's given. With tables.shm set the finished tables are published in shared memory
+//  too, for sequencers that do their own retargeting.
+//
+//      swivel-headless [config file, default ./swivel.conf]
+//
+
+#include <csignal>
+#include <iostream>
+#include "CoreJuceHeader.h"
+#include "HeadlessConfig.h"
+#include "AggregateAudioDevice.h"
+#include "AnalysisThread.h"
+#include "MidiThru.h"
+#include "Trace.h"
+#include "LogQueue.h"
+#include "Coordination.h"
+#include "TablePublisher.h"
+#if SWIVEL_JACK
+ #include "JackSession.h"
+#endif
+
+namespace
+{
+    volatile std::sig_atomic_t quitRequested = 0;
+    volatile std::sig_atomic_t statsRequested = 0;
+    
+    void requestQuit(int)
+    {
+        quitRequested = 1;
+    }
+    
+    void requestStats(int)
+    {
+        statsRequested = 1;
+    }
+}
+
+//==============================================================================================
+/** Owns everything MainComponent would, minus the widgets */
+class HeadlessRunner : public  AnalysisThread::Listener,
+                       public  CoordinatorClient::Listener,
+                       public  LogQueue::Target,
+                       private Timer
+{
+public:
+    HeadlessRunner(const HeadlessConfig& c)
+    :   config(c),
+        thru(&swivelStrings),
+        exitCode(0),
+        audioSchedulingReported(false),
+        startedAt(0),
+        waitingForCoordinator(false)
+    {
+        logQueue.setTarget(this);
+    }
+    
+    ~HeadlessRunner()
+    {
+        stopTimer();
+        if (analysisThread != nullptr)
+            analysisThread->stopThread(15000);
+        for (MidiInput* in : midiIns)
+            in->stop();
+        for (MidiOutput* out : midiOuts)
+            out->stopBackgroundThread();
+        if (audioScheduler != nullptr)
+            deviceManager.removeAudioCallback(audioScheduler);
+        deviceManager.closeAudioDevice();
+#if SWIVEL_JACK
+        // before the thru goes, the cycle's using it
+        if (jack != nullptr)
+            jack->close();
+#endif
+        logQueue.drain();
+    }
+    
+    /** Opens everything and starts the analysis, the rest happens in the dispatch loop */
+    Result start()
+    {
+        if (config.lockMemory)
+        {
+            const Result locked = ThreadScheduling::lockMemory();
+            logQueue.push(locked ? String("Memory locked\n") : locked.getErrorMessage() + "\n", locked ? LogQueue::info : LogQueue::warning);
+        }
+        
+        Result result = config.isJack() ? openJack() : openAudio();
+        if (result && !config.isJack())
+            result = openMidi();
+        if (result)
+            result = loadStrings();
+        if (result && config.tablesShm.isNotEmpty())
+            result = tables.open(config.tablesShm);
+        if (!result)
+            return result;
+        
+        applyScheduling();
+        // nothing goes through until the tables are made
+        thru.setBypassed(true);
+        for (MidiInput* in : midiIns)
+            in->start();
+        for (MidiOutput* out : midiOuts)
+            out->startBackgroundThread();
+        
+        MidiScheduler* scheduler;
+#if SWIVEL_JACK
+        if (jack != nullptr)
+            scheduler = jack;
+        else
+#endif
+            scheduler = midiScheduler = new MidiOutputScheduler(Array<MidiOutput*>(midiOuts.getRawDataPointer(), midiOuts.size()));
+        analysisThread = new AnalysisThread(&deviceManager, scheduler, &swivelStrings, this);
+        analysisThread->setLog(&logQueue);
+        analysisThread->setProcessingParams(config.fftSize, config.overlap, config.thresholdUp, config.thresholdDown, config.window);
+        analysisThread->setScheduling(config.analysisScheduling);
+        startTimer(100);
+        
+        // the coordinator says when, and which
+        if (config.coordinator.isNotEmpty())
+        {
+            coordinator = new CoordinatorClient(config.coordinatorName, &swivelStrings, this);
+            coordinator->setLog(&logQueue);
+            waitingForCoordinator = true;
+            return coordinator->connect(config.coordinator);
+        }
+        
+        startAnalysis(swivelStrings.size());
+        return Result::ok();
+    }
+    
+    int getExitCode() const { return exitCode; }
+    
+    //==========================================================================================
+    void analysisFinished(Result result) override
+    {
+        analysisThread->stopThread(100);
+        
+        if (Trace::isRecording())
+        {
+            Trace::stop();
+            const Result written = Trace::writeJson(config.traceFile);
+            logQueue.push(written ? "Trace written to " + config.traceFile.getFullPathName() + "\n" : written.getErrorMessage() + "\n",
+                          written ? LogQueue::info : LogQueue::warning);
+        }
+        
+        if (coordinator != nullptr)
+            coordinator->calibrationFinished(result, (Time::getMillisecondCounterHiRes() - startedAt) / 1000.0);
+        
+        if (result)
+        {
+            // from here on it's only the thru, which sends straight away, so there's no call for the rest to stay awake
+            if (audioScheduler != nullptr)
+                deviceManager.removeAudioCallback(audioScheduler);
+            deviceManager.closeAudioDevice();
+            for (MidiOutput* out : midiOuts)
+                out->stopBackgroundThread();
+            
+            // with a coordinator the rest of the strings are still to come
+            if (!waitingForCoordinator)
+                startThru();
+        }
+        else
+        {
+            logQueue.push(result.getErrorMessage() + "\n", LogQueue::error);
+            exitCode = 1;
+            MessageManager::getInstance()->stopDispatchLoop();
+        }
+    }
+    
+    void calibrationRequested(const Array<SwivelString*>& strings) override
+    {
+        if (strings.size() == 0)
+        {
+            startedAt = Time::getMillisecondCounterHiRes();
+            coordinator->calibrationFinished(Result::ok(), 0.0);
+            return;
+        }
+        analysisThread->setStringsToCalibrate(strings);
+        startAnalysis(strings.size());
+    }
+    
+    void coordinationFinished(Result result) override
+    {
+        waitingForCoordinator = false;
+        if (!result && startedAt == 0)
+        {
+            // it went before it even got started, so there's nothing to carry on with
+            logQueue.push(result.getErrorMessage() + "\n", LogQueue::error);
+            exitCode = 1;
+            MessageManager::getInstance()->stopDispatchLoop();
+            return;
+        }
+        
+        // whatever it managed, the strings calibrated here are still good
+        if (!result)
+            logQueue.push(result.getErrorMessage() + ", carrying on with what there is\n", LogQueue::warning);
+        if (!analysisThread->isThreadRunning())
+            startThru();
+    }
+    
+    void addText(const String& text, LogQueue::Level level) override
+    {
+        if (level >= LogQueue::warning)
+            std::cerr << text << std::flush;
+        else
+            std::cout << text << std::flush;
+    }
+    
+private:
+    const HeadlessConfig& config;
+    
+    AudioDeviceManager deviceManager;
+    // one of each per port
+    OwnedArray<MidiInput> midiIns;
+    OwnedArray<MidiOutput> midiOuts;
+    ScopedPointer<MidiOutputScheduler> midiScheduler;
+    ScopedPointer<ThreadScheduling::AudioCallback> audioScheduler;
+#if SWIVEL_JACK
+    ScopedPointer<JackSession> jack;
+#endif
+    
+    OwnedArray<SwivelString, CriticalSection> swivelStrings;
+    OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+    
+    LogQueue logQueue;
+    MidiThru thru;
+    ScopedPointer<AnalysisThread> analysisThread;
+    ScopedPointer<CoordinatorClient> coordinator;
+    TablePublisher tables;
+    int exitCode;
+    bool audioSchedulingReported;
+    double startedAt;
+    bool waitingForCoordinator;
+    
+    //==========================================================================================
+    void startAnalysis(int numStrings)
+    {
+        logQueue.push("Analysing " + String(numStrings) + " strings\n");
+        if (config.traceFile != File::nonexistent)
+            Trace::start();
+        startedAt = Time::getMillisecondCounterHiRes();
+        analysisThread->startThread(0);
+    }
+    
+    void startThru()
+    {
+        for (SwivelString* string : swivelStrings)
+            logQueue.push("String on channel: " + String(string->getMidiChannel()) + " is at " + String(string->getBestFreq()) + "Hz"
+                          + (string->isReadyToTransform() ? "\n" : " (not calibrated)\n"));
+        logQueue.push("Calibrated, MIDI thru running\n");
+        thru.setBypassed(false);
+        
+        if (tables.isOpen())
+        {
+            tables.publish(swivelStrings);
+            logQueue.push("Tables published to " + tables.getName() + " (generation " + String(tables.getGeneration()) + ")\n");
+        }
+    }
+    
+    //==========================================================================================
+    // signals can't touch the message manager, so keep an eye out for them here
+    void timerCallback() override
+    {
+        // the audio thread can't log, so it gets reported once it's had a go
+        if (audioScheduler != nullptr && !audioSchedulingReported && audioScheduler->hasTried())
+        {
+            audioSchedulingReported = true;
+            const Result scheduled = audioScheduler->getResult();
+            logQueue.push(scheduled ? "Audio thread scheduled " + config.audioScheduling.toString() + "\n"
+                                    : "Couldn't schedule the audio thread " + config.audioScheduling.toString() + ": " + scheduled.getErrorMessage() + "\n",
+                          scheduled ? LogQueue::info : LogQueue::warning);
+        }
+        
+        const int lost = thru.getNumDropped();
+        if (lost > 0)
+            logQueue.push("MIDI thru queue full, " + String(lost) + " messages dropped\n", LogQueue::warning);
+#if SWIVEL_JACK
+        if (jack != nullptr)
+        {
+            const int notSent = jack->getNumDropped();
+            if (notSent > 0)
+                logQueue.push("JACK MIDI full, " + String(notSent) + " messages dropped\n", LogQueue::warning);
+            if (!jack->isRunning())
+            {
+                logQueue.push("The JACK server has gone\n", LogQueue::error);
+                exitCode = 1;
+                stopTimer();
+                MessageManager::getInstance()->stopDispatchLoop();
+                return;
+            }
+        }
+#endif
+        
+        if (statsRequested)
+        {
+            statsRequested = 0;
+            logQueue.push(thru.getStats().getSummary());
+            Result dumped = thru.getStats().dump(config.statsFile);
+            logQueue.push(dumped ? "Thru stats written to " + config.statsFile.getFullPathName() + "\n" : dumped.getErrorMessage() + "\n",
+                          dumped ? LogQueue::info : LogQueue::error);
+        }
+        
+        if (quitRequested)
+        {
+            logQueue.push("Quitting\n");
+            stopTimer();
+            MessageManager::getInstance()->stopDispatchLoop();
+        }
+    }
+    
+    Result openAudio()
+    {
+        String error = deviceManager.initialise(config.numInputs, 0, nullptr, true);
+        if (error.isNotEmpty())
+            return Result::fail("Couldn't open audio: " + error);
+        
+        if (config.aggregate.size() > 0)
+        {
+            // added after initialise, before it the manager would take it as the only type there is
+            deviceManager.addAudioDeviceType(new AggregateAudioIODeviceType(config.aggregate));
+            deviceManager.setCurrentAudioDeviceType("Aggregate", true);
+        }
+        else if (config.audioType.isNotEmpty())
+            deviceManager.setCurrentAudioDeviceType(config.audioType, true);
+        
+        AudioDeviceManager::AudioDeviceSetup setup;
+        deviceManager.getAudioDeviceSetup(setup);
+        if (config.aggregate.size() > 0)
+            setup.inputDeviceName = AggregateAudioIODeviceType::deviceName;
+        else if (config.audioDevice.isNotEmpty())
+            setup.inputDeviceName = config.audioDevice;
+        setup.outputDeviceName = String::empty;
+        setup.sampleRate = config.sampleRate;
+        setup.bufferSize = config.bufferSize;
+        setup.useDefaultInputChannels = false;
+        setup.inputChannels.clear();
+        setup.inputChannels.setRange(0, config.numInputs, true);
+        
+        error = deviceManager.setAudioDeviceSetup(setup, true);
+        if (error.isNotEmpty())
+            return Result::fail("Couldn't open audio: " + error);
+        if (deviceManager.getCurrentAudioDevice() == nullptr)
+            return Result::fail("No audio device");
+        
+        AudioIODevice* device = deviceManager.getCurrentAudioDevice();
+        logQueue.push("Audio: " + device->getName() + " at " + String(device->getCurrentSampleRate()) + "Hz, "
+                      + String(device->getActiveInputChannels().countNumberOfSetBits()) + " inputs\n");
+        return Result::ok();
+    }
+    
+    /** Joins the JACK server, which does the audio and MIDI in place of openAudio() and openMidi() */
+    Result openJack()
+    {
+#if SWIVEL_JACK
+        jack = new JackSession(config.jackClient, config.numInputs, config.jackPorts);
+        jack->setThru(&thru);
+        Result result = jack->open();
+        if (!result)
+            return result;
+        for (int port = 0; port < config.jackPorts; port++)
+            thru.setSink(port, jack);
+        
+        // added before the manager makes its own types, so it's the only one
+        deviceManager.addAudioDeviceType(new JackAudioIODeviceType(*jack));
+        deviceManager.setCurrentAudioDeviceType("Swivel JACK", true);
+        
+        AudioDeviceManager::AudioDeviceSetup setup;
+        setup.inputDeviceName = JackAudioIODeviceType::deviceName;
+        setup.sampleRate = jack->getSampleRate();
+        setup.bufferSize = jack->getBufferSize();
+        setup.useDefaultInputChannels = false;
+        setup.inputChannels.setRange(0, config.numInputs, true);
+        
+        String error = deviceManager.initialise(config.numInputs, 0, nullptr, false, String::empty, &setup);
+        if (error.isNotEmpty() || deviceManager.getCurrentAudioDevice() == nullptr)
+            return Result::fail("Couldn't open the JACK inputs: " + error);
+        
+        // the other end may not be there yet, they can always be connected by hand
+        for (int i = 0; i < config.jackSources.size(); i++)
+        {
+            const Result connected = jack->connect(config.jackSources[i], config.jackDestinations[i]);
+            if (!connected)
+                logQueue.push(connected.getErrorMessage() + "\n", LogQueue::warning);
+        }
+        
+        logQueue.push("JACK: " + jack->getClientName() + " at " + String(jack->getSampleRate()) + "Hz, "
+                      + String(jack->getBufferSize()) + " frames a cycle, " + String(config.numInputs) + " inputs, "
+                      + String(config.jackPorts) + " MIDI ports\n");
+        return Result::ok();
+#else
+        return Result::fail("jack.client is set, but this was built without JACK");
+#endif
+    }
+    
+    /** The thru's and the audio device's threads, the analysis does its own when it starts */
+    void applyScheduling()
+    {
+        if (!config.thruScheduling.isDefault())
+        {
+            const Result scheduled = thru.setScheduling(config.thruScheduling);
+            logQueue.push(scheduled ? "MIDI thru thread scheduled " + config.thruScheduling.toString() + "\n"
+                                    : "Couldn't schedule the MIDI thru thread " + config.thruScheduling.toString() + ": " + scheduled.getErrorMessage() + "\n",
+                          scheduled ? LogQueue::info : LogQueue::warning);
+        }
+        
+        if (!config.audioScheduling.isDefault())
+        {
+            audioScheduler = new ThreadScheduling::AudioCallback(config.audioScheduling);
+            deviceManager.addAudioCallback(audioScheduler);
+        }
+    }
+    
+    Result openMidi()
+    {
+        if (config.midiIns.size() > MidiThru::maxPorts)
+            return Result::fail("Too many MIDI ports, there can be " + String(MidiThru::maxPorts));
+        
+        for (int port = 0; port < config.midiIns.size(); port++)
+        {
+            MidiInput* in = nullptr;
+            int index = MidiInput::getDevices().indexOf(config.midiIns[port]);
+            if (index < 0 || (in = MidiInput::openDevice(index, &thru)) == nullptr)
+                return Result::fail("Couldn't open MIDI input: " + config.midiIns[port]);
+            midiIns.add(in);
+            
+            MidiOutput* out = nullptr;
+            index = MidiOutput::getDevices().indexOf(config.midiOuts[port]);
+            if (index < 0 || (out = MidiOutput::openDevice(index)) == nullptr)
+                return Result::fail("Couldn't open MIDI output: " + config.midiOuts[port]);
+            midiOuts.add(out);
+            
+            thru.setPort(port, in, out);
+        }
+        return Result::ok();
+    }
+    
+    Result loadStrings()
+    {
+        try
+        {
+            ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(config.dataFile);
+            if (data == nullptr)
+                return Result::fail("Couldn't read " + config.dataFile.getFullPathName());
+            bundles.addArray(*data);
+        }
+        catch (SwivelStringFileParser::ParseException const &e)
+        {
+            return Result::fail(String("Parse Error: ") + e.what());
+        }
+        
+        if (bundles.size() == 0)
+            return Result::fail("No strings in " + config.dataFile.getFullPathName());
+        
+        for (int i = 0; i < bundles.size(); i++)
+        {
+            SwivelString* string = new SwivelString();
+            swivelStrings.add(string);
+            string->initialiseFromBundle(bundles[i]);
+            string->setAudioChannel(config.getAudioChannelFor(string->getMidiPort(), string->getMidiChannel()));
+        }
+        return thru.updateRouting();
+    }
+    
+    JUCE_DECLARE_NON_COPYABLE (HeadlessRunner)
+};
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    File configFile = File::getCurrentWorkingDirectory().getChildFile(argc > 1 ? argv[1] : "swivel.conf");
+    
+    HeadlessConfig config;
+    Result loaded = config.load(configFile);
+    if (!loaded)
+    {
+        std::cerr << loaded.getErrorMessage() << std::endl;
+        return 1;
+    }
+    
+    std::signal(SIGINT, requestQuit);
+    std::signal(SIGTERM, requestQuit);
+    std::signal(SIGUSR1, requestStats);
+    
+    MessageManager::getInstance()->setCurrentThreadAsMessageThread();
+    
+    int exitCode = 0;
+    {
+        HeadlessRunner runner(config);
+        Result started = runner.start();
+        if (started)
+        {
+            MessageManager::getInstance()->runDispatchLoop();
+            exitCode = runner.getExitCode();
+        }
+        else
+        {
+            std::cerr << started.getErrorMessage() << std::endl;
+            exitCode = 1;
+        }
+    }
+    
+    DeletedAtShutdown::deleteAll();
+    MessageManager::deleteInstance();
+    return exitCode;
+}
@@ -0,0 +1,319 @@
+//
+//  JackRigMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  The simulated rig as a JACK client, for trying swivel-headless' JACK mode without an instrument
+//  or any hardware at all, eg. on jackd's dummy backend. MIDI into midi_in_1 (midi_in_2 for the
+//  strings on port 1 and so on) plucks and bends the strings at the frame it arrives on, their sound
+//  comes out of out_1 onwards. Each string's open frequency is printed at the start so it can be
+//  checked against what the calibration comes up with. Runs until SIGINT or SIGTERM.
+//
+//      swivel-jackrig datafile [--client swivel-rig] [--outputs 1] [--detune cents] [--noise level]
+//                              [--latency ms] [--seed n]
+//
+//  --outputs is how many audio outputs the strings are spread over, in the order the file has them.
+//  With the default of one they're all on out_1, which is where swivel-headless listens unless it
+//  has route.* set.
+//
+
+#include <csignal>
+#include <iostream>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include "CoreJuceHeader.h"
+#include "SimulatedRig.h"
+#include "SwivelStringFileParser.h"
+#include "String.h"
+
+namespace
+{
+    volatile std::sig_atomic_t quitRequested = 0;
+
+    void requestQuit(int)
+    {
+        quitRequested = 1;
+    }
+
+    struct Options
+    {
+        File dataFile;
+        String client = "swivel-rig";
+        int outputs = 1;
+        double detune = 5.0;
+        double noise = 0.001;
+        double latency = 0.0;
+        int64 seed = 1;
+    };
+
+    Result parseOptions(const StringArray& args, Options& options)
+    {
+        if (args.size() == 0 || args[0].startsWith("--"))
+            return Result::fail("Usage: swivel-jackrig datafile [options], see JackRigMain.cpp");
+        options.dataFile = File::getCurrentWorkingDirectory().getChildFile(args[0]);
+
+        for (int i = 1; i < args.size(); i++)
+        {
+            const String& arg = args[i];
+            if (i + 1 >= args.size())
+                return Result::fail("Missing value for " + arg);
+
+            const String value = args[++i];
+            if (arg == "--client")
+                options.client = value;
+            else if (arg == "--outputs")
+                options.outputs = value.getIntValue();
+            else if (arg == "--detune")
+                options.detune = value.getDoubleValue();
+            else if (arg == "--noise")
+                options.noise = value.getDoubleValue();
+            else if (arg == "--latency")
+                options.latency = value.getDoubleValue();
+            else if (arg == "--seed")
+                options.seed = value.getLargeIntValue();
+            else
+                return Result::fail("Unknown option: " + arg);
+        }
+
+        if (options.outputs < 1)
+            return Result::fail("--outputs should be at least 1");
+        return Result::ok();
+    }
+
+    /** The controller of the last message, which is the one that plucks */
+    int findExcitationController(const MidiBuffer& buffer)
+    {
+        MidiBuffer::Iterator it(buffer);
+        MidiMessage message;
+        int position;
+        int controller = 7;
+        while (it.getNextEvent(message, position))
+            if (message.isController())
+                controller = message.getControllerNumber();
+        return controller;
+    }
+
+    //==========================================================================================
+    /** Renders the rig in the JACK cycle, MIDI in first so it lands on the frame it came in on */
+    class JackRig
+    {
+    public:
+        JackRig(const Options& o)
+        :   options(o),
+            client(nullptr),
+            running(false)
+        {
+
+        }
+
+        ~JackRig()
+        {
+            close();
+        }
+
+        Result open()
+        {
+            jack_status_t status;
+            client = jack_client_open(options.client.toUTF8(), JackNoStartServer, &status);
+            if (client == nullptr)
+                return Result::fail("Couldn't connect to a JACK server as " + options.client);
+
+            // the rig's clock is in samples, so it has to be at the server's rate
+            Result result = loadStrings((double) jack_get_sample_rate(client));
+            if (!result)
+                return result;
+
+            for (int i = 0; i < options.outputs; i++)
+                outs.add(jack_port_register(client, ("out_" + String(i+1)).toUTF8(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0));
+            for (int i = 0; i < rig->getNumPorts(); i++)
+                midiIns.add(jack_port_register(client, ("midi_in_" + String(i+1)).toUTF8(), JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0));
+            if (outs.contains(nullptr) || midiIns.contains(nullptr))
+                return Result::fail("Couldn't register the rig's JACK ports");
+
+            channels.malloc((size_t) options.outputs);
+            // room for a busy cycle's worth, the rig only wants the odd message
+            block.ensureSize(4096);
+
+            jack_set_process_callback(client, processCallback, this);
+            jack_on_shutdown(client, shutdownCallback, this);
+            running = true;
+            if (jack_activate(client) != 0)
+                return Result::fail("Couldn't activate " + options.client + " on the JACK server");
+
+            std::cout << "JACK: " << jack_get_client_name(client) << " at " << rig->getSampleRate() << "Hz, "
+                      << options.outputs << " outputs, " << rig->getNumPorts() << " MIDI inputs" << std::endl;
+            return Result::ok();
+        }
+
+        void close()
+        {
+            if (client != nullptr)
+            {
+                if (running)
+                    jack_deactivate(client);
+                jack_client_close(client);
+                client = nullptr;
+            }
+            running = false;
+        }
+
+        bool isRunning() const
+        {
+            return running;
+        }
+
+        void report() const
+        {
+            for (SwivelString* string : swivelStrings)
+            {
+                const double plucked = rig->getPluckedFrequency(string->getMidiPort(), string->getMidiChannel());
+                std::cout << "String on port " << string->getMidiPort() << " channel " << string->getMidiChannel()
+                          << " last plucked at " << plucked << "Hz" << std::endl;
+            }
+        }
+
+    private:
+        const Options& options;
+        jack_client_t* client;
+        volatile bool running;
+        ScopedPointer<SimulatedRig> rig;
+        OwnedArray<SwivelString> swivelStrings; // only for their channels
+        Array<jack_port_t*> outs;
+        Array<jack_port_t*> midiIns;
+        HeapBlock<float*> channels;
+        MidiBuffer block;
+
+        Result loadStrings(double sampleRate)
+        {
+            OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+            try
+            {
+                ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(options.dataFile);
+                if (data == nullptr)
+                    return Result::fail("Couldn't open " + options.dataFile.getFullPathName());
+                bundles.addArray(*data);
+            }
+            catch (SwivelStringFileParser::ParseException const &e)
+            {
+                return Result::fail(String("Parse Error: ") + e.what());
+            }
+
+            if (bundles.size() == 0)
+                return Result::fail("No strings in " + options.dataFile.getFullPathName());
+
+            rig = new SimulatedRig(options.outputs, sampleRate, options.seed);
+            rig->setNoiseLevel(options.noise);
+            rig->setFasterThanRealtime(false);
+            Random random(options.seed);
+
+            for (int i = 0; i < bundles.size(); i++)
+            {
+                SwivelStringFileParser::StringDataBundle* bundle = bundles[i];
+
+                // somewhere inside the measurements, same as swivel-sim
+                double lowest = bundle->fundamentals->getFirst(), highest = lowest;
+                for (double fundamental : *bundle->fundamentals)
+                {
+                    lowest = jmin(lowest, fundamental);
+                    highest = jmax(highest, fundamental);
+                }
+
+                SimulatedRig::StringModel model;
+                model.audioChannel = i % options.outputs;
+                model.openFrequency = lowest + (highest - lowest) * (0.1 + 0.8 * random.nextDouble());
+                model.detune = options.detune;
+                model.latency = options.latency;
+                model.excitationController = findExcitationController(*bundle->midiBuffer);
+
+                SwivelString* string = new SwivelString();
+                swivelStrings.add(string);
+                string->initialiseFromBundle(bundle);
+
+                model.midiChannel = string->getMidiChannel();
+                model.midiPort = string->getMidiPort();
+                rig->addString(model);
+                std::cout << "String on port " << model.midiPort << " channel " << model.midiChannel << " is at "
+                          << model.openFrequency << "Hz, on out_" << model.audioChannel + 1 << std::endl;
+            }
+            return Result::ok();
+        }
+
+        static int processCallback(jack_nframes_t numFrames, void* jackRig)
+        {
+            static_cast<JackRig*>(jackRig)->process(numFrames);
+            return 0;
+        }
+
+        static void shutdownCallback(void* jackRig)
+        {
+            static_cast<JackRig*>(jackRig)->running = false;
+        }
+
+        void process(jack_nframes_t numFrames)
+        {
+            // the cycle starts where the rig's clock has got to
+            const double start = rig->getSecondsRendered() * 1000.0;
+            for (int port = 0; port < midiIns.size(); port++)
+            {
+                void* in = jack_port_get_buffer(midiIns.getUnchecked(port), numFrames);
+                const uint32_t count = jack_midi_get_event_count(in);
+                block.clear();
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    jack_midi_event_t event;
+                    if (jack_midi_event_get(&event, in, i) == 0 && event.size > 0)
+                        block.addEvent(event.buffer, (int) event.size, (int) event.time);
+                }
+                if (count > 0)
+                    rig->sendBlockOfMessages(port, block, start, rig->getSampleRate());
+            }
+
+            for (int i = 0; i < outs.size(); i++)
+                channels[i] = (float*) jack_port_get_buffer(outs.getUnchecked(i), numFrames);
+            rig->render(channels, outs.size(), (int) numFrames);
+        }
+
+        JUCE_DECLARE_NON_COPYABLE (JackRig)
+    };
+}
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add(argv[i]);
+
+    Options options;
+    Result parsed = parseOptions(args, options);
+    if (!parsed)
+    {
+        std::cerr << parsed.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    std::signal(SIGINT, requestQuit);
+    std::signal(SIGTERM, requestQuit);
+
+    JackRig jackRig(options);
+    Result opened = jackRig.open();
+    if (!opened)
+    {
+        std::cerr << opened.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    while (!quitRequested && jackRig.isRunning())
+        Thread::sleep(100);
+
+    const bool serverWentAway = !jackRig.isRunning();
+    jackRig.close();
+    jackRig.report();
+    if (serverWentAway)
+    {
+        std::cerr << "The JACK server has gone" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,446 @@
+//
+//  JackSession.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include <cerrno>
+#include "JackSession.h"
+#include "RealtimeChecker.h"
+
+JackSession::JackSession(const String& clientName, int inputs, int ports)
+:   name(clientName),
+    numInputs(inputs),
+    numPorts(jlimit(1, MidiThru::maxPorts, ports)),
+    client(nullptr),
+    running(false),
+    sampleRate(44100.0),
+    thru(nullptr),
+    dropped(0),
+    fifo(queueSize),
+    queue(queueSize),
+    waiting(queueSize),
+    numWaiting(0),
+    outgoing(queueSize),
+    numOutgoing(0),
+    currentFrame(0),
+    outputBuffers(MidiThru::maxPorts),
+    audioCallback(nullptr),
+    inputChannels(jmax(1, inputs))
+{
+
+}
+
+JackSession::~JackSession()
+{
+    close();
+}
+
+Result JackSession::open()
+{
+    close();
+
+    // a server has to be there already, starting one behind the user's back is no help
+    jack_status_t status;
+    client = jack_client_open(name.toUTF8(), JackNoStartServer, &status);
+    if (client == nullptr)
+        return Result::fail("Couldn't connect to a JACK server as " + name + " (status " + String::toHexString((int) status) + ")");
+
+    sampleRate = (double) jack_get_sample_rate(client);
+
+    for (int i = 0; i < numInputs; i++)
+        audioIns.add(jack_port_register(client, ("in_" + String(i+1)).toUTF8(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0));
+    for (int i = 0; i < numPorts; i++)
+    {
+        midiIns.add(jack_port_register(client, ("midi_in_" + String(i+1)).toUTF8(), JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0));
+        midiOuts.add(jack_port_register(client, ("midi_out_" + String(i+1)).toUTF8(), JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0));
+    }
+    if (audioIns.contains(nullptr) || midiIns.contains(nullptr) || midiOuts.contains(nullptr))
+    {
+        close();
+        return Result::fail("Couldn't register " + name + "'s JACK ports");
+    }
+
+    jack_set_process_callback(client, processCallback, this);
+    jack_on_shutdown(client, shutdownCallback, this);
+    running = true;
+    if (jack_activate(client) != 0)
+    {
+        close();
+        return Result::fail("Couldn't activate " + name + " on the JACK server");
+    }
+    return Result::ok();
+}
+
+void JackSession::close()
+{
+    if (client != nullptr)
+    {
+        // deactivating waits for the last cycle, nothing gets called back after this
+        if (running)
+            jack_deactivate(client);
+        jack_client_close(client);
+        client = nullptr;
+    }
+    running = false;
+    audioIns.clear();
+    midiIns.clear();
+    midiOuts.clear();
+}
+
+bool JackSession::isRunning() const
+{
+    return running;
+}
+
+Result JackSession::connect(const String& source, const String& destination)
+{
+    if (client == nullptr)
+        return Result::fail("Not connected to JACK");
+
+    // ours can be given without the client's name
+    const String prefix(getClientName() + ":");
+    const String from(source.containsChar(':') ? source : prefix + source);
+    const String to(destination.containsChar(':') ? destination : prefix + destination);
+
+    const int error = jack_connect(client, from.toUTF8(), to.toUTF8());
+    if (error != 0 && error != EEXIST)
+        return Result::fail("Couldn't connect JACK port " + from + " to " + to);
+    return Result::ok();
+}
+
+String JackSession::getClientName() const
+{
+    return client != nullptr ? String(jack_get_client_name(client)) : name;
+}
+
+double JackSession::getSampleRate() const
+{
+    return sampleRate;
+}
+
+int JackSession::getBufferSize() const
+{
+    return client != nullptr ? (int) jack_get_buffer_size(client) : 0;
+}
+
+int JackSession::getNumInputs() const
+{
+    return numInputs;
+}
+
+void JackSession::setThru(MidiThru* thruToUse)
+{
+    thru = thruToUse;
+}
+
+int JackSession::getNumDropped()
+{
+    return dropped.exchange(0);
+}
+
+//==============================================================================================
+uint32 JackSession::getMillisecondCounter()
+{
+    // the frame counter wraps after a day or so at 44.1kHz, which only upsets a calibration running over it
+    if (client == nullptr)
+        return 0;
+    return (uint32) ((double) jack_frame_time(client) * 1000.0 / sampleRate);
+}
+
+void JackSession::waitFor(Thread& thread, int milliseconds)
+{
+    // JACK's clock goes at the same speed as the real one
+    thread.wait(milliseconds);
+}
+
+int JackSession::getNumPorts()
+{
+    return numPorts;
+}
+
+void JackSession::sendBlockOfMessages(int port, const MidiBuffer& buffer, double millisecondCounterToStartAt, double samplesPerSecondForBuffer)
+{
+    if (!isPositiveAndBelow(port, numPorts))
+        return;
+
+    const ScopedLock sl(sendLock);
+    MidiBuffer::Iterator it(buffer);
+    const uint8* data;
+    int size, position;
+    while (it.getNextEvent(data, size, position))
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+        if (size > 3 || size1 + size2 == 0)
+        {
+            dropped++;
+            continue;
+        }
+
+        Scheduled& scheduled = queue[size1 > 0 ? start1 : start2];
+        const double ms = millisecondCounterToStartAt + 1000.0 * position / samplesPerSecondForBuffer;
+        // through int64 so it wraps the same way the frame counter does
+        scheduled.frame = (jack_nframes_t) (int64) (ms * sampleRate / 1000.0 + 0.5);
+        scheduled.port = port;
+        scheduled.size = size;
+        memcpy(scheduled.data, data, (size_t) size);
+        fifo.finishedWrite(1);
+    }
+}
+
+void JackSession::handleOutgoingMessage(int port, const MidiMessage& message)
+{
+    addOutgoing(port, currentFrame, message.getRawData(), message.getRawDataSize());
+}
+
+//==============================================================================================
+void JackSession::setAudioCallback(AudioIODeviceCallback* callback, const BigInteger& inputs)
+{
+    const SpinLock::ScopedLockType sl(callbackLock);
+    audioCallback = callback;
+    activeInputs = inputs;
+}
+
+int JackSession::processCallback(jack_nframes_t numFrames, void* session)
+{
+    static_cast<JackSession*>(session)->process(numFrames);
+    return 0;
+}
+
+void JackSession::shutdownCallback(void* session)
+{
+    // the server's gone, the owner finds out by asking
+    static_cast<JackSession*>(session)->running = false;
+}
+
+void JackSession::process(jack_nframes_t numFrames)
+{
+    RealtimeChecker::ScopedRealtimeSection realtime;
+    const jack_nframes_t cycleStart = jack_last_frame_time(client);
+    numOutgoing = 0;
+
+    // the capture first, it's the audio that came in over the last period
+    {
+        const GenericScopedTryLock<SpinLock> lock(callbackLock);
+        if (lock.isLocked() && audioCallback != nullptr)
+        {
+            // packed together like a real device does
+            int numActive = 0;
+            for (int i = 0; i < numInputs; i++)
+                if (activeInputs[i])
+                    inputChannels[numActive++] = (const float*) jack_port_get_buffer(audioIns.getUnchecked(i), numFrames);
+            audioCallback->audioDeviceIOCallback(inputChannels, numActive, nullptr, 0, (int) numFrames);
+        }
+    }
+
+    // the analysis' MIDI: anything due this cycle goes at its frame, anything late at the start
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+    for (int i = 0; i < size1 + size2; i++)
+    {
+        if (numWaiting < queueSize)
+            waiting[numWaiting++] = queue[i < size1 ? start1 + i : start2 + i - size1];
+        else
+            dropped++;
+    }
+    fifo.finishedRead(size1 + size2);
+
+    int kept = 0;
+    for (int i = 0; i < numWaiting; i++)
+    {
+        const Scheduled& scheduled = waiting[i];
+        const int32 offset = (int32) (scheduled.frame - cycleStart);
+        if (offset < (int32) numFrames)
+            addOutgoing(scheduled.port, (jack_nframes_t) jmax(0, offset), scheduled.data, scheduled.size);
+        else
+            waiting[kept++] = scheduled;
+    }
+    numWaiting = kept;
+
+    // the thru: each message comes straight back out on the frame it came in on
+    for (int port = 0; port < numPorts; port++)
+    {
+        void* in = jack_port_get_buffer(midiIns.getUnchecked(port), numFrames);
+        const uint32_t count = jack_midi_get_event_count(in);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            jack_midi_event_t event;
+            if (thru == nullptr || jack_midi_event_get(&event, in, i) != 0 || event.size == 0 || event.size > 3)
+                continue;
+            currentFrame = event.time;
+            thru->sendNow(port, MidiMessage(event.buffer, (int) event.size, (cycleStart + event.time) / sampleRate));
+        }
+    }
+
+    // JACK wants each port's events in order. There are only ever a few, and mostly in order already
+    for (int i = 1; i < numOutgoing; i++)
+    {
+        const Scheduled scheduled = outgoing[i];
+        int j = i;
+        for (; j > 0 && (outgoing[j-1].port > scheduled.port
+                         || (outgoing[j-1].port == scheduled.port && outgoing[j-1].frame > scheduled.frame)); j--)
+            outgoing[j] = outgoing[j-1];
+        outgoing[j] = scheduled;
+    }
+
+    for (int port = 0; port < numPorts; port++)
+    {
+        outputBuffers[port] = jack_port_get_buffer(midiOuts.getUnchecked(port), numFrames);
+        jack_midi_clear_buffer(outputBuffers[port]);
+    }
+    for (int i = 0; i < numOutgoing; i++)
+    {
+        const Scheduled& scheduled = outgoing[i];
+        if (jack_midi_event_write(outputBuffers[scheduled.port], scheduled.frame, scheduled.data, (size_t) scheduled.size) != 0)
+            dropped++;
+    }
+}
+
+void JackSession::addOutgoing(int port, jack_nframes_t frame, const uint8* data, int size)
+{
+    if (numOutgoing >= queueSize || !isPositiveAndBelow(port, numPorts) || size > 3)
+    {
+        dropped++;
+        return;
+    }
+    Scheduled& scheduled = outgoing[numOutgoing++];
+    scheduled.frame = frame;
+    scheduled.port = port;
+    scheduled.size = size;
+    memcpy(scheduled.data, data, (size_t) size);
+}
+
+//==============================================================================================
+/** Called back by the session, so it's the JACK cycle that drives the capture */
+class JackAudioIODevice : public AudioIODevice
+{
+public:
+    JackAudioIODevice(JackSession& s)
+    :   AudioIODevice(JackAudioIODeviceType::deviceName, "JACK"),
+        session(s),
+        deviceOpen(false),
+        callback(nullptr)
+    {
+
+    }
+
+    ~JackAudioIODevice()
+    {
+        close();
+    }
+
+    StringArray getOutputChannelNames() override { return StringArray(); }
+
+    StringArray getInputChannelNames() override
+    {
+        StringArray names;
+        for (int i = 0; i < session.getNumInputs(); i++)
+            names.add("in_" + String(i+1));
+        return names;
+    }
+
+    // whatever the server's running at, there's no choosing
+    int getNumSampleRates() override                { return 1; }
+    double getSampleRate(int) override              { return session.getSampleRate(); }
+    int getNumBufferSizesAvailable() override       { return 1; }
+    int getBufferSizeSamples(int) override          { return session.getBufferSize(); }
+    int getDefaultBufferSize() override             { return session.getBufferSize(); }
+
+    String open(const BigInteger& inputChannels, const BigInteger&, double, int) override
+    {
+        close();
+        if (!session.isRunning())
+            return "The JACK session isn't running";
+        activeInputs = inputChannels;
+        activeInputs.setRange(session.getNumInputs(), activeInputs.getHighestBit() + 1, false);
+        deviceOpen = true;
+        return String::empty;
+    }
+
+    void close() override
+    {
+        stop();
+        deviceOpen = false;
+    }
+
+    bool isOpen() override                          { return deviceOpen; }
+
+    void start(AudioIODeviceCallback* newCallback) override
+    {
+        if (newCallback != nullptr)
+            newCallback->audioDeviceAboutToStart(this);
+        callback = newCallback;
+        session.setAudioCallback(newCallback, activeInputs);
+    }
+
+    void stop() override
+    {
+        AudioIODeviceCallback* old = callback;
+        // once this returns the session's cycle can't be using it
+        session.setAudioCallback(nullptr, BigInteger());
+        callback = nullptr;
+        if (old != nullptr)
+            old->audioDeviceStopped();
+    }
+
+    bool isPlaying() override                       { return callback != nullptr; }
+    String getLastError() override                  { return String::empty; }
+    int getCurrentBufferSizeSamples() override      { return session.getBufferSize(); }
+    double getCurrentSampleRate() override          { return session.getSampleRate(); }
+    int getCurrentBitDepth() override               { return 32; }
+    BigInteger getActiveOutputChannels() const override { return BigInteger(); }
+    BigInteger getActiveInputChannels() const override  { return activeInputs; }
+    int getOutputLatencyInSamples() override        { return 0; }
+    int getInputLatencyInSamples() override         { return 0; }
+
+private:
+    JackSession& session;
+    bool deviceOpen;
+    BigInteger activeInputs;
+    AudioIODeviceCallback* callback;
+
+    JUCE_DECLARE_NON_COPYABLE (JackAudioIODevice)
+};
+
+//==============================================================================================
+const char* const JackAudioIODeviceType::deviceName = "Swivel JACK";
+
+JackAudioIODeviceType::JackAudioIODeviceType(JackSession& s)
+:   AudioIODeviceType("Swivel JACK"),
+    session(s)
+{
+
+}
+
+void JackAudioIODeviceType::scanForDevices()
+{
+
+}
+
+StringArray JackAudioIODeviceType::getDeviceNames(bool wantInputNames) const
+{
+    return StringArray(deviceName);
+}
+
+int JackAudioIODeviceType::getDefaultDeviceIndex(bool forInput) const
+{
+    return 0;
+}
+
+int JackAudioIODeviceType::getIndexOfDevice(AudioIODevice* device, bool asInput) const
+{
+    return device != nullptr && device->getName() == deviceName ? 0 : -1;
+}
+
+bool JackAudioIODeviceType::hasSeparateInputsAndOutputs() const
+{
+    return false;
+}
+
+AudioIODevice* JackAudioIODeviceType::createDevice(const String& outputDeviceName, const String& inputDeviceName)
+{
+    return new JackAudioIODevice(session);
+}
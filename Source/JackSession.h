@@ -0,0 +1,149 @@
+//
+//  JackSession.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__JackSession__
+#define __SwivelAutotune__JackSession__
+
+#include <atomic>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include "CoreJuceHeader.h"
+#include "MidiScheduler.h"
+#include "MidiThru.h"
+
+/** A JACK client that does the capture, the analysis' MIDI and the thru's MIDI all inside the one
+    process cycle, so they're all timed in the same samples on JACK's frame clock (Linux only).
+
+    It registers an audio input for each input the analysis listens to, called in_1, in_2..., and
+    a MIDI input and output for each port, midi_in_1 and midi_out_1 and so on. Then:
+     - it's the analysis' MidiScheduler: what's sent goes out of the port's MIDI output on the frame
+       it's due, and the clock is JACK's frames
+     - JackAudioIODeviceType gives the AudioDeviceManager a device that's called back with the audio
+       inputs from the same cycle
+     - MIDI coming in on a port goes through the thru there and then and out of the port's output on
+       the frame it came in on (it's the thru's sink for every port, see MidiThru::sendNow())
+
+    None of it needs hardware, it runs the same on JACK's dummy backend.
+ */
+class JackSession : public MidiScheduler,
+                    public MidiThru::Sink
+{
+public:
+    JackSession(const String& clientName, int numInputs, int numPorts);
+    ~JackSession();
+
+    /** Connects to the server, which has to be running already, registers the ports and activates */
+    Result open();
+    void close();
+    /** False before open() and once the server has gone away */
+    bool isRunning() const;
+    /** Connects two ports by their full names, or either can be one of ours by its short name */
+    Result connect(const String& source, const String& destination);
+
+    /** The name the server gave us, it may have added a number if ours was taken */
+    String getClientName() const;
+    double getSampleRate() const;
+    int getBufferSize() const;
+    int getNumInputs() const;
+
+    /** MIDI that comes in goes through this, set it before open(). The thru needs the session as
+        the sink for each of its ports */
+    void setThru(MidiThru* thruToUse);
+    /** How many messages didn't fit, either waiting to go out or in a cycle's output, since last time */
+    int getNumDropped();
+
+    //==========================================================================================
+    /** On JACK's frame clock */
+    uint32 getMillisecondCounter() override;
+    void waitFor(Thread& thread, int milliseconds) override;
+    int getNumPorts() override;
+    /** Channel messages only, anything longer is dropped. Any thread */
+    void sendBlockOfMessages(int port, const MidiBuffer& buffer, double millisecondCounterToStartAt, double samplesPerSecondForBuffer) override;
+
+    /** The thru's output, only ever called from inside the process callback */
+    void handleOutgoingMessage(int port, const MidiMessage& message) override;
+
+    //==========================================================================================
+    /** For the device: called back with the active inputs packed together, nullptr to stop */
+    void setAudioCallback(AudioIODeviceCallback* callback, const BigInteger& activeInputs);
+
+    // messages the analysis can have waiting to go out, and that can go out in one cycle
+    static const int queueSize = 1024;
+
+private:
+    /** A message and the frame it goes out on */
+    struct Scheduled
+    {
+        jack_nframes_t frame;
+        int port;
+        int size;
+        uint8 data[3];
+    };
+
+    const String name;
+    const int numInputs;
+    const int numPorts;
+    jack_client_t* client;
+    std::atomic<bool> running;
+    double sampleRate;
+    Array<jack_port_t*> audioIns;
+    Array<jack_port_t*> midiIns;
+    Array<jack_port_t*> midiOuts;
+    MidiThru* thru;
+    std::atomic<int> dropped;
+
+    // from the senders to the callback. The senders take the lock between themselves, the callback never does
+    CriticalSection sendLock;
+    AbstractFifo fifo;
+    HeapBlock<Scheduled> queue;
+    // the callback's own: what it's taken off the queue that isn't due yet, and what's going out this cycle
+    HeapBlock<Scheduled> waiting;
+    int numWaiting;
+    HeapBlock<Scheduled> outgoing;
+    int numOutgoing;
+    jack_nframes_t currentFrame; // where the thru's output goes
+    HeapBlock<void*> outputBuffers;
+
+    // the device's callback, swapped while the process callback isn't using it
+    SpinLock callbackLock;
+    AudioIODeviceCallback* audioCallback;
+    HeapBlock<const float*> inputChannels;
+    BigInteger activeInputs;
+
+    static int processCallback(jack_nframes_t numFrames, void* session);
+    static void shutdownCallback(void* session);
+    void process(jack_nframes_t numFrames);
+    void addOutgoing(int port, jack_nframes_t frame, const uint8* data, int size);
+
+    JUCE_DECLARE_NON_COPYABLE (JackSession)
+};
+
+//==============================================================================================
+/** An audio device type with one device, "Swivel JACK", whose inputs are the session's */
+class JackAudioIODeviceType : public AudioIODeviceType
+{
+public:
+    /** The session has to be open, and outlive anything made by this */
+    JackAudioIODeviceType(JackSession& session);
+
+    void scanForDevices() override;
+    StringArray getDeviceNames(bool wantInputNames) const override;
+    int getDefaultDeviceIndex(bool forInput) const override;
+    int getIndexOfDevice(AudioIODevice* device, bool asInput) const override;
+    bool hasSeparateInputsAndOutputs() const override;
+    AudioIODevice* createDevice(const String& outputDeviceName, const String& inputDeviceName) override;
+
+    static const char* const deviceName;
+
+private:
+    JackSession& session;
+
+    JUCE_DECLARE_NON_COPYABLE (JackAudioIODeviceType)
+};
+
+#endif /* defined(__SwivelAutotune__JackSession__) */
@@ -0,0 +1,123 @@
+//
+//  LatencyProbe.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "LatencyProbe.h"
+
+LatencyProbe::LatencyProbe(const CaptureRing& r, int channel, uint32 send)
+:   ring(r),
+    audioChannel(channel),
+    sendTime(send),
+    scanned(-1),
+    onsetSample(0),
+    detected(false)
+{
+
+}
+
+bool LatencyProbe::poll()
+{
+    if (detected)
+        return true;
+    if (!ring.hasClock())
+        return false;
+
+    // anything before the send is the last string or the servos
+    const int chunkSize = CaptureRing::chunkSize;
+    if (scanned < 0)
+        scanned = (ring.getSampleAtTime(sendTime) + chunkSize - 1) / chunkSize;
+    scanned = jmax(scanned, (ring.getOldestAvailable() + chunkSize - 1) / chunkSize); // only if we've been very slow
+
+    for (bool open; scanned < ring.getNumChunksWritten(); scanned++)
+    {
+        if (ring.readGate(audioChannel, scanned, open) && open)
+        {
+            onsetSample = scanned * chunkSize;
+            detected = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LatencyProbe::hasDetectedOnset() const
+{
+    return detected;
+}
+
+double LatencyProbe::getLatency() const
+{
+    return ring.getTimeOfSample(onsetSample) - sendTime;
+}
+
+int64 LatencyProbe::getOnsetSample() const
+{
+    return onsetSample;
+}
+
+//==============================================================================================
+LatencyProfile::LatencyProfile()
+{
+
+}
+
+void LatencyProfile::addMeasurement(int midiPort, int midiChannel, double latency)
+{
+    const ScopedLock sl(lock);
+    Array<double>& recent = latencies[std::make_pair(midiPort, midiChannel)];
+    recent.add(latency);
+    if (recent.size() > numKept)
+        recent.remove(0);
+}
+
+bool LatencyProfile::hasMeasurement(int midiPort, int midiChannel) const
+{
+    const ScopedLock sl(lock);
+    return latencies.find(std::make_pair(midiPort, midiChannel)) != latencies.end();
+}
+
+double LatencyProfile::getExpectedLatency(int midiPort, int midiChannel) const
+{
+    const ScopedLock sl(lock);
+    auto found = latencies.find(std::make_pair(midiPort, midiChannel));
+    if (found == latencies.end())
+        return 0.0;
+
+    double longest = 0.0;
+    for (double latency : found->second)
+        longest = jmax(longest, latency);
+    return longest;
+}
+
+String LatencyProfile::getSummary() const
+{
+    const ScopedLock sl(lock);
+    String summary;
+    for (auto& entry : latencies)
+    {
+        const Array<double>& recent = entry.second;
+        double shortest = recent.getFirst(), longest = shortest, total = 0;
+        for (double latency : recent)
+        {
+            shortest = jmin(shortest, latency);
+            longest = jmax(longest, latency);
+            total += latency;
+        }
+        summary << "Latency on ";
+        if (entry.first.first > 0)
+            summary << "port " << entry.first.first << " ";
+        summary << "channel " << entry.first.second << ": " << String(shortest, 1) << "-" << String(longest, 1)
+                << "ms, mean " << String(total / recent.size(), 1) << "ms over " << recent.size() << "\n";
+    }
+    return summary;
+}
+
+void LatencyProfile::clear()
+{
+    const ScopedLock sl(lock);
+    latencies.clear();
+}
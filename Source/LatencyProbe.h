@@ -0,0 +1,76 @@
+//
+//  LatencyProbe.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__LatencyProbe__
+#define __SwivelAutotune__LatencyProbe__
+
+#include <map>
+#include "CoreJuceHeader.h"
+#include "CaptureRing.h"
+
+/** Finds when a string started making a noise after its excitation message was sent.
+    It looks through the capture ring's gate from the send time for the first chunk of the
+    string's input where the gate is open, a bit more each time it's polled.
+ */
+class LatencyProbe
+{
+public:
+    /** sendTime is when the excitation is due to be sent, on the scheduler's clock */
+    LatencyProbe(const CaptureRing& ring, int audioChannel, uint32 sendTime);
+
+    /** Looks through whatever has been captured since last time, returns true once the onset has been found */
+    bool poll();
+
+    /** True once an onset has been found, after which the rest is valid */
+    bool hasDetectedOnset() const;
+    /** Time from the send to the onset in ms */
+    double getLatency() const;
+    /** Where the onset is in the capture ring, always the start of a chunk */
+    int64 getOnsetSample() const;
+
+private:
+    const CaptureRing& ring;
+    const int audioChannel;
+    const uint32 sendTime;
+
+    int64 scanned; // the next chunk to look at, -1 until the ring has a clock to work out the send time with
+    int64 onsetSample;
+    bool detected;
+
+    JUCE_DECLARE_NON_COPYABLE (LatencyProbe)
+};
+
+//==============================================================================================
+/** The latencies measured so far for each string (by MIDI port and channel), for keeping an eye on the rig
+    and for knowing how long it's worth waiting for a string to sound.
+    Only the last few measurements are kept so it follows changes to the rig.
+ */
+class LatencyProfile
+{
+public:
+    LatencyProfile();
+
+    void addMeasurement(int midiPort, int midiChannel, double latency);
+    bool hasMeasurement(int midiPort, int midiChannel) const;
+    /** The longest of the recent measurements for the string, in ms */
+    double getExpectedLatency(int midiPort, int midiChannel) const;
+    /** One line per string, for the log */
+    String getSummary() const;
+    void clear();
+
+    // how many measurements are kept per string
+    static const int numKept = 8;
+
+private:
+    CriticalSection lock;
+    std::map<std::pair<int, int>, Array<double>> latencies;
+
+    JUCE_DECLARE_NON_COPYABLE (LatencyProfile)
+};
+
+#endif /* defined(__SwivelAutotune__LatencyProbe__) */
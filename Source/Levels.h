@@ -0,0 +1,64 @@
+//
+//  Levels.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef SwivelAutotune_Levels_h
+#define SwivelAutotune_Levels_h
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+ #include <xmmintrin.h>
+ #define SWIVEL_LEVELS_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+ #include <arm_neon.h>
+ #define SWIVEL_LEVELS_NEON 1
+#endif
+
+/**
+    Signal levels for the onset gate. This runs over every input on every block, so it's
+    done four samples at a time where the processor can, and in plain loops elsewhere.
+ */
+class Levels
+{
+public:
+    /** The sum of the squares of the samples */
+    static float sumOfSquares(const float* data, int size)
+    {
+        int i = 0;
+        float sum = 0;
+#if SWIVEL_LEVELS_SSE
+        __m128 total = _mm_setzero_ps();
+        for (; i + 4 <= size; i += 4)
+        {
+            const __m128 x = _mm_loadu_ps(data + i);
+            total = _mm_add_ps(total, _mm_mul_ps(x, x));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, total);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif SWIVEL_LEVELS_NEON
+        float32x4_t total = vdupq_n_f32(0);
+        for (; i + 4 <= size; i += 4)
+        {
+            const float32x4_t x = vld1q_f32(data + i);
+            total = vmlaq_f32(total, x, x);
+        }
+        sum = (vgetq_lane_f32(total, 0) + vgetq_lane_f32(total, 1)) + (vgetq_lane_f32(total, 2) + vgetq_lane_f32(total, 3));
+#endif
+        for (; i < size; i++) // whatever is left over
+            sum += data[i] * data[i];
+        return sum;
+    }
+
+    /** Root mean square of the samples */
+    static float rms(const float* data, int size)
+    {
+        return size > 0 ? std::sqrt(sumOfSquares(data, size) / size) : 0.0f;
+    }
+};
+
+#endif
@@ -0,0 +1,162 @@
+//
+//  LogQueue.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "LogQueue.h"
+#include <cstdarg>
+
+LogQueue::LogQueue()
+:   records(capacity),
+    writePosition(0),
+    readPosition(0),
+    dropped(0),
+    target(nullptr)
+{
+    // each record's sequence says whose turn it is: == position means free to write,
+    // == position+1 means written and ready to read
+    for (int i = 0; i < capacity; i++)
+        new (&records[i].sequence) std::atomic<uint32>(i);
+    
+#ifdef DEBUG
+    // the thru thread's debug logging can't post, so nothing else would pick it up until the next push()
+    startTimer(50);
+#endif
+}
+
+LogQueue::~LogQueue()
+{
+    stopTimer();
+    cancelPendingUpdate();
+}
+
+void LogQueue::setTarget(Target* where)
+{
+    target = where;
+}
+
+//==============================================================================================
+LogQueue::Record* LogQueue::claim(uint32& position)
+{
+    position = writePosition.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Record* record = &records[position & (capacity-1)];
+        int32 diff = (int32) record->sequence.load(std::memory_order_acquire) - (int32) position;
+        
+        if (diff == 0)
+        {
+            if (writePosition.compare_exchange_weak(position, position+1, std::memory_order_relaxed))
+                return record;
+        }
+        else if (diff < 0) // the reader hasn't got this far yet, we're full
+        {
+            dropped++;
+            return nullptr;
+        }
+        else // someone else got it first
+        {
+            position = writePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void LogQueue::publish(Record* record, uint32 position)
+{
+    record->sequence.store(position+1, std::memory_order_release);
+}
+
+bool LogQueue::push(const String& message, Level level)
+{
+    const char* text = message.toRawUTF8();
+    size_t length = strlen(text);
+    bool queued = true;
+    
+    do
+    {
+        uint32 position;
+        Record* record = claim(position);
+        if (record == nullptr)
+        {
+            queued = false; // still worth a drain, to report it
+            break;
+        }
+        
+        size_t chunk = jmin(length, (size_t) recordSize-1);
+        record->level = level;
+        memcpy(record->text, text, chunk);
+        record->text[chunk] = 0;
+        publish(record, position);
+        
+        text += chunk;
+        length -= chunk;
+    }
+    while (length > 0);
+    
+    // does nothing if there's already one on its way, which there is unless it's been emptied since
+    triggerAsyncUpdate();
+    return queued;
+}
+
+bool LogQueue::pushFormatted(Level level, const char* format, ...)
+{
+    uint32 position;
+    Record* record = claim(position);
+    if (record == nullptr)
+        return false;
+    
+    record->level = level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record->text, recordSize, format, args);
+    va_end(args);
+    
+    publish(record, position);
+    return true;
+}
+
+//==============================================================================================
+void LogQueue::drain()
+{
+    // runs of the same level go to the console together
+    String batch;
+    Level batchLevel = info;
+    
+    int lost = dropped.exchange(0);
+    if (lost > 0 && target != nullptr)
+        target->addText("[" + String(lost) + " log messages dropped]\n", warning);
+    
+    for (;;)
+    {
+        Record* record = &records[readPosition & (capacity-1)];
+        if (record->sequence.load(std::memory_order_acquire) != readPosition+1)
+            break; // nothing more written yet
+        
+        if (record->level != batchLevel && batch.isNotEmpty())
+        {
+            if (target != nullptr)
+                target->addText(batch, batchLevel);
+            batch = String::empty;
+        }
+        batchLevel = record->level;
+        batch << record->text;
+        record->sequence.store(readPosition + capacity, std::memory_order_release); // free for the next lap
+        readPosition++;
+    }
+    
+    if (batch.isNotEmpty() && target != nullptr)
+        target->addText(batch, batchLevel);
+}
+
+void LogQueue::handleAsyncUpdate()
+{
+    drain();
+}
+
+void LogQueue::timerCallback()
+{
+    drain();
+}
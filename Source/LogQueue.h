@@ -0,0 +1,92 @@
+//
+//  LogQueue.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__LogQueue__
+#define __SwivelAutotune__LogQueue__
+
+#include <atomic>
+#include "CoreJuceHeader.h"
+
+/** Gets log messages from any thread onto the console without anyone waiting for the GUI.
+    Messages are copied into fixed-size records in a bounded lock-free queue (any number of
+    producers, the message thread is the only consumer), which is emptied onto the console in
+    batches. push() posts an async update to the message thread if there isn't one on its way
+    already; pushFormatted() never does, since it's for realtime threads and posting locks and
+    allocates, so those wait for the next push() or, in debug builds where the thru thread logs,
+    a 50ms timer. Release builds don't poll at all. If the queue is full the message is dropped and
+    counted rather than blocking.
+    Where the messages end up is up to the Target, so this works with or without a GUI.
+ */
+class LogQueue : private AsyncUpdater,
+                 private Timer
+{
+public:
+    LogQueue();
+    ~LogQueue();
+    
+    enum Level
+    {
+        debug,
+        info,
+        warning,
+        error
+    };
+    
+    /** Something that displays or stores the messages once they are off the queue */
+    class Target
+    {
+    public:
+        virtual ~Target() {}
+        /** Called on the message thread with a run of text at the same level */
+        virtual void addText(const String& text, Level level) = 0;
+    };
+    
+    /** Sets where to write to. If nullptr messages are still consumed but go nowhere */
+    void setTarget(Target* where);
+    
+    /** Queues a message, long ones are split across several records, and wakes the message thread.
+        Not for realtime threads. Returns false if anything was dropped */
+    bool push(const String& message, Level level = info);
+    /** Queues a printf style message, formatted straight into the record so it never allocates
+        or posts anything, safe from realtime threads */
+    bool pushFormatted(Level level, const char* format, ...);
+    
+    /** Moves everything currently queued onto the console, only call from the message thread */
+    void drain();
+    
+    // the size of one record including the terminating null, longer messages are split or truncated
+    static const int recordSize = 128;
+    // number of records, must be a power of 2
+    static const int capacity = 1024;
+    
+private:
+    struct Record
+    {
+        std::atomic<uint32> sequence;
+        Level level;
+        char text[recordSize];
+    };
+    
+    /** Claims a record to write into, or nullptr if full. Must be followed by publish() */
+    Record* claim(uint32& position);
+    void publish(Record* record, uint32 position);
+    
+    void handleAsyncUpdate() override;
+    void timerCallback() override;
+    
+    HeapBlock<Record> records;
+    std::atomic<uint32> writePosition;
+    uint32 readPosition; // only touched by the message thread
+    std::atomic<int> dropped;
+    
+    Target* target;
+    
+    JUCE_DECLARE_NON_COPYABLE (LogQueue)
+};
+
+#endif /* defined(__SwivelAutotune__LogQueue__) */
@@ -8,12 +8,17 @@
 
 #include "MainComponent.h"
 #include "SwivelStringFileParser.h"
+#include "RealtimeChecker.h"
+#include "AggregateAudioDevice.h"
 
 using namespace std;
 
 //==============================================================================================
-MainComponent::MainComponent() : currentString(nullptr), currentChanIndex(-1), running(false)
+MainComponent::MainComponent() : window(Windowing::HANN), currentString(nullptr), currentChanIndex(-1), running(false)
 {
+    // needs doing before any audio starts (does nothing in release)
+    RealtimeChecker::initialise();
+    
     setSize(700, 330);
     
     tabs = new TabbedComponent(TabbedButtonBar::Orientation::TabsAtTop);
@@ -32,8 +37,10 @@ MainComponent::MainComponent() : currentString(nullptr), currentChanIndex(-1), r
     //==========================================================================================
     deviceManager = new AudioDeviceManager();
     deviceManager->initialise(2, 0, nullptr, true);
+    // after initialise, or it would be the only type
+    deviceManager->addAudioDeviceType(new AggregateAudioIODeviceType());
     audioSelector = new AudioDeviceSelectorComponent(*deviceManager,
-                                                     1, 32, //input
+                                                     1, 256, //input, an aggregate can have plenty
                                                      0, 0, //output
                                                      false,
                                                      false,
@@ -41,6 +48,9 @@ MainComponent::MainComponent() : currentString(nullptr), currentChanIndex(-1), r
                                                      true);
     audioSelector->setBounds(0, 10, 300, 300);
     mainTab->addAndMakeVisible(audioSelector);
+    // nothing needs it until a calibration, which opens it again
+    deviceManager->addChangeListener(this);
+    closeAudio();
     
     
     
@@ -84,13 +94,13 @@ MainComponent::MainComponent() : currentString(nullptr), currentChanIndex(-1), r
     windowLabel->setBounds(310, 100, 100, 20);
     mainTab->addAndMakeVisible(windowLabel);
     windowBox = new ComboBox("Window Box");
-    windowBox->addItem("Hann", WindowType::HANN);
-    windowBox->addItem("Hamming", WindowType::HAMMING);
-    windowBox->addItem("Blackman", WindowType::BLACKMAN);
-    windowBox->addItem("Rectangle", WindowType::RECTANGULAR);
-    windowBox->setSelectedId(WindowType::HANN);
+    windowBox->addItem("Hann", Windowing::HANN);
+    windowBox->addItem("Hamming", Windowing::HAMMING);
+    windowBox->addItem("Blackman", Windowing::BLACKMAN);
+    windowBox->addItem("Rectangle", Windowing::RECTANGULAR);
+    windowBox->setSelectedId(Windowing::HANN);
     windowBox->setBounds(310, 120, 100, 20);
-    windowBox->setSelectedId(WindowType::HANN);
+    windowBox->setSelectedId(Windowing::HANN);
     windowBox->addListener(this);
     mainTab->addAndMakeVisible(windowBox);
     
@@ -162,12 +172,22 @@ MainComponent::MainComponent() : currentString(nullptr), currentChanIndex(-1), r
     addAndMakeVisible(goButton);
     
     //console
-    console = new TextEditor("Console");
-    console->setMultiLine(true);
-    console->setReadOnly(true);
-    console->setCaretVisible(false);
+    console = new ConsoleComponent();
     console->setBounds(10, 220, 680, 70);
     /*mainTab->*/addAndMakeVisible(console);
+    logQueue.setTarget(console);
+    thru = new MidiThru(&swivelStrings);
+    thru->setPort(0, nullptr, midiOutBox->getSelectedOutput()); // just the one port here
+#ifdef DEBUG
+    thru->setLog(&logQueue);
+#endif
+    statsTab = new ThruStatsComponent(thru->getStats());
+    statsTab->setSize(700, 300);
+    tabs->addTab("Thru Stats", Colours::lightgrey, statsTab, false);
+    
+    const Result published = tables.open();
+    if (!published)
+        log(published.getErrorMessage() + ", the tables won't be published\n", console, LogQueue::warning);
     
     
     //==========================================================================================
@@ -204,6 +224,7 @@ MainComponent::~MainComponent()
     midiOutBox->getSelectedOutput()->stopBackgroundThread();
     if (analysisThread != nullptr && analysisThread->isThreadRunning())
         analysisThread->stopThread(100);
+    deviceManager->removeChangeListener(this);
 }
 
 //==============================================================================================
@@ -236,16 +257,16 @@ void MainComponent::comboBoxChanged(juce::ComboBox *box)
         String message = "Window: ";
         
         switch (window) {
-            case HANN:
+            case Windowing::HANN:
                 message += "Hann.\n";
                 break;
-            case BLACKMAN:
+            case Windowing::BLACKMAN:
                 message += "Blackman.\n";
                 break;
-            case HAMMING:
+            case Windowing::HAMMING:
                 message += "Hamming.\n";
                 break;
-            case RECTANGULAR:
+            case Windowing::RECTANGULAR:
                 message += "Rectangle.\n";
                 break;
                 
@@ -253,6 +274,7 @@ void MainComponent::comboBoxChanged(juce::ComboBox *box)
                 message += "Unknown. Be worried.\n";
                 break;
         }
+        log(message, console);
     }
     else if (chanBox == box)
         currentChanIndex = chanBox->getSelectedItemIndex();
@@ -276,8 +298,7 @@ void MainComponent::buttonClicked(juce::Button *button)
     {
         if (running == false)
         {
-            begin();
-            running = true;
+            running = begin();
         }
         else // running must == true
         {
@@ -294,12 +315,13 @@ void MainComponent::buttonClicked(juce::Button *button)
         if (button->getButtonText() == "Start MIDI Thru")
         {
             button->setButtonText("Stop MIDI Thru");
-            midiInBox->addMidiInputCallback(this);
+            thru->setPort(0, nullptr, midiOutBox->getSelectedOutput());
+            midiInBox->addMidiInputCallback(thru);
         }
         else if (button->getButtonText() == "Stop MIDI Thru")
         {
             button->setButtonText("Start MIDI Thru");
-            midiInBox->removeMidiInputCallback(this);
+            midiInBox->removeMidiInputCallback(thru);
         }
     }
     else if (chooseButton == button)
@@ -310,7 +332,7 @@ void MainComponent::buttonClicked(juce::Button *button)
             log("String on channel: " + String(currentString->getMidiChannel()) + " set to audio channel: " + String(currentChanIndex) + "\n", console);
         }
         else
-            log("Did nothing, need to select a channel and a string\n", console);
+            log("Did nothing, need to select a channel and a string\n", console, LogQueue::warning);
     }
 }
 
@@ -320,8 +342,9 @@ void MainComponent::changeListenerCallback(juce::ChangeBroadcaster *source)
     {
         if (tabs->getCurrentContentComponent() == audioTab)
         {
-            StringArray names = deviceManager->getCurrentAudioDevice()->getInputChannelNames();
-            chanBox->addItemList(names, 1);
+            if (AudioIODevice* device = deviceManager->getCurrentAudioDevice())
+                inputChannelNames = device->getInputChannelNames();
+            chanBox->addItemList(inputChannelNames, 1);
             
             if (swivelStrings.size() != 0)
                 for (int i = 0; i < swivelStrings.size(); i++)
@@ -338,25 +361,72 @@ void MainComponent::changeListenerCallback(juce::ChangeBroadcaster *source)
             currentString = nullptr;
         }
     }
+    else if (source == deviceManager)
+    {
+        // the selector has opened it to change its settings, let it show them then close it again
+        if (deviceManager->getCurrentAudioDevice() != nullptr && !running)
+            startTimer(closeDelay);
+    }
+}
+
+void MainComponent::timerCallback()
+{
+    stopTimer();
+    if (!running)
+        closeAudio();
+}
+
+Result MainComponent::openAudio()
+{
+    stopTimer();
+    if (deviceManager->getCurrentAudioDevice() == nullptr)
+    {
+        AudioDeviceManager::AudioDeviceSetup setup;
+        deviceManager->getAudioDeviceSetup(setup);
+        if (setup.inputDeviceName.isEmpty())
+            return Result::fail("No audio input chosen");
+        deviceManager->restartLastAudioDevice();
+    }
+    if (deviceManager->getCurrentAudioDevice() == nullptr)
+        return Result::fail("Couldn't open the audio input");
+    return Result::ok();
+}
+
+void MainComponent::closeAudio()
+{
+    if (AudioIODevice* device = deviceManager->getCurrentAudioDevice())
+        inputChannelNames = device->getInputChannelNames();
+    deviceManager->closeAudioDevice();
 }
 
 //===============================================================================================
 // the all important
 
-void MainComponent::begin()
+bool MainComponent::begin()
 {
+    Result opened = openAudio();
+    if (!opened)
+    {
+        log(opened.getErrorMessage() + "\n", console, LogQueue::error);
+        return false;
+    }
     
     log("-----------------------------------------------------\n", console);
     log("---------------------BEGINNING-----------------------\n", console);
     log("-----------------------------------------------------\n", console);
     //initialise string objects
     log(" Initialising background thread\n", console);
-    analysisThread = new AnalysisThread(deviceManager, midiOutBox->getSelectedOutput(), &swivelStrings, this);
+    analysisThread = nullptr; // before the scheduler it was using goes
+    midiScheduler = new MidiOutputScheduler(midiOutBox->getSelectedOutput());
+    analysisThread = new AnalysisThread(deviceManager, midiScheduler, &swivelStrings, this);
+    analysisThread->setLatencyProfile(&latencies);
     midiOutBox->getSelectedOutput()->startBackgroundThread();
 #ifdef DEBUG
-    analysisThread->setConsole(console);
+    analysisThread->setLog(&logQueue);
 #endif
-    analysisThread->setProcessingParams(fft_size, overlap, onsetThresholdUp->getText().getFloatValue(), onsetThresholdDown->getText().getFloatValue());
+    analysisThread->setProcessingParams(fft_size, overlap, onsetThresholdUp->getText().getFloatValue(), onsetThresholdDown->getText().getFloatValue(), window);
+    // don't let anything through while the strings are being changed
+    thru->setBypassed(true);
     // BEGIN
     // MOVED THIS TO OTHER THREAD
 /*    // allocate space for audio
@@ -377,15 +447,7 @@ void MainComponent::begin()
     
     analysisThread->startThread(0);
     goButton->setButtonText("STOP");
-/*    reporter->setString(swivelStrings[0]);
-    reporter->setConsole(console);
-    reporter->startTimer(700);
-    
-   // try out some MIDI
-    MidiOutput* midi = midiOutBox->getSelectedOutput();
-    midi->startBackgroundThread();
-    midi->sendBlockOfMessages(*swivelStrings[0]->getMidiBuffer(), Time::getMillisecondCounter()+1000, deviceManager->getCurrentAudioDevice()->getCurrentSampleRate());
-*/
+    return true;
 }
 
 void MainComponent::end(bool success)
@@ -399,6 +461,10 @@ void MainComponent::end(bool success)
         analysisThread->stopThread(100);
         running = false;
         goButton->setButtonText("GO");
+        thru->setBypassed(false);
+        // the thru sends straight away, so neither of these is needed until next time
+        midiOutBox->getSelectedOutput()->stopBackgroundThread();
+        closeAudio();
     
         for (SwivelString*& string : swivelStrings)
         {
@@ -407,6 +473,7 @@ void MainComponent::end(bool success)
             else
                 log("String on channel: " + String(string->getMidiChannel()) + " is not ready somehow.\n", console);
         }
+        tables.publish(swivelStrings);
     }
     else
     {
@@ -415,13 +482,9 @@ void MainComponent::end(bool success)
         log("-----------------------------------------------------\n", console);
         goButton->setButtonText("GO");
         analysisThread->stopThread(100);
+        thru->setBypassed(false);
         midiOutBox->getSelectedOutput()->stopBackgroundThread();
-        /*reporter->stopTimer();
-     for (int i = 0; i < swivelStrings.size(); i++)
-        deviceManager->removeAudioCallback(swivelStrings[i]);
-     goButton->setButtonText("GO");
-     MidiOutput* midi = midiOutBox->getSelectedOutput();
-     midi->stopBackgroundThread();*/
+        closeAudio();
     }
 }
 
@@ -429,39 +492,10 @@ void MainComponent::endPrematurely()
 {
     log("Ending, may cause analysis thread to crash\n", console);
     analysisThread->stopThread(15000);
+    thru->setBypassed(false);
 }
 
 
-//===============================================================================================
-void MainComponent::handleIncomingMidiMessage(juce::MidiInput *source, const juce::MidiMessage &message)
-{
-    // if we want to print the data to the console, we are going to have to lock the message thread
-#ifdef DEBUG
-    const MessageManagerLock mmLock; // should do it
-    const uint8* data = message.getRawData();
-    log("Received MIDI: " + String(data[0]) + " " + String(data[1]) + " " + String(data[2]) + "\n", console);
-    try {
-#endif
-    // essentially have to switch on the channel to pass it to the right string
-    // would make sense to have a map of strings by channel
-    // as this is potentially a bottleneck
-    // depending how much midi we are piping through
-    // for now the ugly linear version
-    if (!analysisThread->isThreadRunning())
-        for (int i = 0; i < swivelStrings.size(); i++)
-        {
-            if (swivelStrings[i]->getMidiChannel() == message.getChannel())
-                midiOutBox->getSelectedOutput()->sendMessageNow(swivelStrings[i]->transform(message));
-        }
-    //midiOutBox->getSelectedOutput()->sendMessageNow(message);
-        
-#ifdef DEBUG
-    } catch (std::logic_error const &e) {
-        std::cerr << e.what();
-    }
-#endif
-}
-
 void MainComponent::notifyResult(juce::Result result)
 {
     if (result)
@@ -470,17 +504,21 @@ void MainComponent::notifyResult(juce::Result result)
     }
     else
     {
-        log(result.getErrorMessage(), console);
+        log(result.getErrorMessage() + "\n", console, LogQueue::error);
         end(false);
     }
 }
 
+void MainComponent::analysisFinished(juce::Result result)
+{
+    notifyResult(result);
+}
+
 
 //===============================================================================================
-void MainComponent::log(juce::String text, TextEditor* console)
+void MainComponent::log(juce::String text, ConsoleComponent* console, ConsoleComponent::Level level)
 {
-    console->setCaretPosition(console->getText().length());
-    console->insertTextAtCaret(text);
+    console->addText(text, level);
 }
 
 //============FILE FUNCTIONS=====================================================================
@@ -496,9 +534,19 @@ void MainComponent::openFile()
             
             // make sure midi is stopped or possible badness
             if (midiThroughButton->getButtonText() == "Stop MIDI Thru")
-                midiInBox->removeMidiInputCallback(this);
+                midiInBox->removeMidiInputCallback(thru);
+            // the thru's thread may still have some queued up for the old strings
+            if (!thru->clearRoutesAndWait())
+            {
+                log("The MIDI thru is still busy, try again\n", console, LogQueue::error);
+                for (StringDataBundle* bundle : *data)
+                    delete bundle;
+                delete data;
+                return;
+            }
             swivelStrings.clear(true);
             bundles.clear(true);
+            tables.withdraw();
             
             for (int i = 0; i < data->size(); i++)
             {
@@ -535,15 +583,19 @@ void MainComponent::openFile()
                 swivelStrings.add(new SwivelString());
                 swivelStrings[i]->initialiseFromBundle((bundles)[i]);
             }
+            Result routed = thru->updateRouting();
+            if (!routed)
+                log(routed.getErrorMessage() + "\n", console, LogQueue::error);
+            thru->setBypassed(false);
             
         }
         catch (SwivelStringFileParser::ParseException const &e)
         {
-            log(String("Parse Error: ") + e.what()  + "\n", console);
+            log(String("Parse Error: ") + e.what()  + "\n", console, LogQueue::error);
         }
     }
     else
-        log("No file chosen", console);
+        log("No file chosen\n", console);
 }
 
 File MainComponent::showDialogue(const juce::String &pattern)
@@ -558,26 +610,3 @@ File MainComponent::showDialogue(const juce::String &pattern)
     }
     return File();
 }
-
-//===========REPORTER MEMBER FUNCTIONS===========================================================
-MainComponent::Reporter::Reporter(SwivelString* r, TextEditor* log) : swString(r), console(log)
-{
-    
-}
-
-void MainComponent::Reporter::setConsole(juce::TextEditor *log)
-{
-    console = log;
-}
-
-void MainComponent::Reporter::setString(SwivelString *str)
-{
-    swString = str;
-}
-
-void MainComponent::Reporter::timerCallback()
-{
-    int peak_index = 1;
-    const Array<double>* peaksPtr = swString->getCurrentPeaksAsFrequencies();
-    log("lowest: " + String((*peaksPtr)[peak_index]) + "\n", console);
-}
\ No newline at end of file
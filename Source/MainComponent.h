@@ -12,14 +12,20 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "String.h"
 #include "MidiDeviceSelector.h"
-class AnalysisThread;
+#include "LogQueue.h"
+#include "ConsoleComponent.h"
+#include "MidiThru.h"
+#include "ThruStatsComponent.h"
+#include "Windowing.h"
 #include "AnalysisThread.h"
+#include "TablePublisher.h"
 
 class MainComponent : public    Component,
                       private   ComboBox::Listener,
                                 Button::Listener,
-                                MidiInputCallback,
-                                ChangeListener
+                                ChangeListener,
+                                AnalysisThread::Listener,
+                                Timer
 {
     
 public:
@@ -33,19 +39,13 @@ public:
     void comboBoxChanged(ComboBox* box);
     void buttonClicked(Button* button);
     void changeListenerCallback(ChangeBroadcaster* source);
+    void timerCallback();
     
-    void handleIncomingMidiMessage(MidiInput* input, const MidiMessage& msg);
-    
-    enum WindowType {
-        placeholder,
-        HANN,
-        HAMMING,
-        BLACKMAN,
-        RECTANGULAR
-    };
+    typedef Windowing::WindowType WindowType;
     
     // notifies the main component of the results of the analysis
     void notifyResult(Result result);
+    void analysisFinished(Result result) override;
     
 private:
     // for ease of use
@@ -61,6 +61,10 @@ private:
     
     ScopedPointer<AudioDeviceManager> deviceManager;
     ScopedPointer<AudioDeviceSelectorComponent> audioSelector; // this exists
+    // the device is only open while calibrating, so remember what it had for the routing tab
+    StringArray inputChannelNames;
+    // how long the device stays open after its settings are changed, so the selector can show them
+    static const int closeDelay = 3000;
     
     ScopedPointer<Label> fftLabel;
     ScopedPointer<ComboBox> fftSizeBox;
@@ -103,9 +107,15 @@ private:
     ScopedPointer<Label> midiInLabel;
     
     ScopedPointer<TextButton> midiThroughButton;
+    // does the actual transforming, needs the strings so is set up after them
+    ScopedPointer<MidiThru> thru;
+    // and how long it's taking about it
+    ScopedPointer<ThruStatsComponent> statsTab;
     
     // bit of output
-    ScopedPointer<TextEditor> console;
+    ScopedPointer<ConsoleComponent> console;
+    // for logging from other threads
+    LogQueue logQueue;
     
     // Strings!
     OwnedArray<SwivelString, CriticalSection> swivelStrings;
@@ -131,25 +141,16 @@ private:
     fftw_plan plan;
     //==========================================================
     /** Appends text to end of console */
-    static void log(String text, TextEditor* console);
-    //==========================================================
-    /** Reports data at a given interval */
-    class Reporter : public Timer
-    {
-    public:
-        Reporter(SwivelString* producer, TextEditor* log);
-        void timerCallback();
-        void setString(SwivelString* str);
-        void setConsole(TextEditor* log);
-    private:
-        SwivelString* swString;
-        TextEditor* console;
-    };
-    ScopedPointer<Reporter> reporter;
-    
+    static void log(String text, ConsoleComponent* console, ConsoleComponent::Level level = LogQueue::info);
     //=========================================================
+    // sends the analysis thread's MIDI to the selected output
+    ScopedPointer<MidiOutputScheduler> midiScheduler;
     // the thread which does the calculation work
     ScopedPointer<AnalysisThread> analysisThread;
+    // how long each string takes to sound, kept between calibrations
+    LatencyProfile latencies;
+    // the tables after each calibration, for sequencers that do their own retargeting
+    TablePublisher tables;
     
     //============MEMBER FUNCTIONS=============================
     /** Opens a file and attempts to parse it, adding all the results to the
@@ -161,11 +162,15 @@ private:
     //==========================================================
     //////////////////////////////////////////////////////////////////////
     //////////////////////////////////////////////////////////////////////
-    void begin();/////////////////////////////////////////////////////////
+    bool begin();/////////////////////////////////////////////////////////
     void end(bool success);  /////////////////////////////////////////////
     void endPrematurely();   /////////////////////////////////////////////
     //////////////////////////////////////////////////////////////////////
     //==========================================================
+    /** Opens the audio device for a calibration, fails if there isn't one to open */
+    Result openAudio();
+    /** Closes it again, so nothing is running while it's only doing MIDI thru */
+    void closeAudio();
     // is analysis running?
     bool running;
     
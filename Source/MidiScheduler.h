@@ -0,0 +1,73 @@
+//
+//  MidiScheduler.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__MidiScheduler__
+#define __SwivelAutotune__MidiScheduler__
+
+#include "CoreJuceHeader.h"
+
+/** Where the analysis sends its MIDI, and the clock it is timed against.
+    Normally that's a MidiOutput and the real time, but the simulated rig
+    runs its own clock so it can go faster than realtime.
+ */
+class MidiScheduler
+{
+public:
+    virtual ~MidiScheduler() {}
+    
+    /** Same idea as Time::getMillisecondCounter(), but on this scheduler's clock */
+    virtual uint32 getMillisecondCounter() = 0;
+    
+    /** Blocks the calling thread for the given time on this scheduler's clock.
+        Returns early if the thread is told to exit. */
+    virtual void waitFor(Thread& thread, int milliseconds) = 0;
+    
+    /** How many ports there are to send to, they're numbered from 0 */
+    virtual int getNumPorts() = 0;
+    
+    /** Same as MidiOutput::sendBlockOfMessages() to the given port's output, the start time is on this
+        scheduler's clock. Messages for a port that isn't there go nowhere */
+    virtual void sendBlockOfMessages(int port, const MidiBuffer& buffer, double millisecondCounterToStartAt, double samplesPerSecondForBuffer) = 0;
+};
+
+//==============================================================================================
+/** The real thing, sends to MidiOutputs (which need their background threads started), one per port */
+class MidiOutputScheduler : public MidiScheduler
+{
+public:
+    MidiOutputScheduler(MidiOutput* out) { outputs.add(out); }
+    MidiOutputScheduler(const Array<MidiOutput*>& outs) : outputs(outs) {}
+    
+    uint32 getMillisecondCounter() override
+    {
+        return Time::getMillisecondCounter();
+    }
+    
+    void waitFor(Thread& thread, int milliseconds) override
+    {
+        thread.wait(milliseconds);
+    }
+    
+    int getNumPorts() override
+    {
+        return outputs.size();
+    }
+    
+    void sendBlockOfMessages(int port, const MidiBuffer& buffer, double millisecondCounterToStartAt, double samplesPerSecondForBuffer) override
+    {
+        if (MidiOutput* out = outputs[port])
+            out->sendBlockOfMessages(buffer, millisecondCounterToStartAt, samplesPerSecondForBuffer);
+    }
+    
+private:
+    Array<MidiOutput*> outputs;
+    
+    JUCE_DECLARE_NON_COPYABLE (MidiOutputScheduler)
+};
+
+#endif /* defined(__SwivelAutotune__MidiScheduler__) */
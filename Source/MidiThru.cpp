@@ -0,0 +1,287 @@
+//
+//  MidiThru.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "MidiThru.h"
+
+MidiThru::MidiThru(OwnedArray<SwivelString, CriticalSection>* strings)
+:   Thread("MIDI Thru"),
+    swivelStrings(strings),
+    logger(nullptr),
+    bypassed(false),
+    slots(capacity),
+    writePosition(0),
+    readPosition(0),
+    dropped(0),
+    sleeping(false),
+    schedulingPending(false),
+    schedulingResult(Result::ok()),
+    idlePending(false),
+    stats(maxPorts)
+{
+    zeromem(inputs, sizeof(inputs));
+    zeromem(outputs, sizeof(outputs));
+    zeromem(sinks, sizeof(sinks));
+    zeromem(routes, sizeof(routes));
+    
+    // == position means free to write, == position+1 means written and ready to read
+    for (int i = 0; i < capacity; i++)
+        new (&slots[i].sequence) std::atomic<uint32>(i);
+    
+    // just below realtime, it's only ever busy while MIDI is coming in
+    startThread(9);
+}
+
+MidiThru::~MidiThru()
+{
+    stopThread(1000);
+}
+
+void MidiThru::setPort(int port, MidiInput* in, MidiOutput* out)
+{
+    jassert(isPositiveAndBelow(port, maxPorts));
+    if (isPositiveAndBelow(port, maxPorts))
+    {
+        inputs[port] = in;
+        outputs[port] = out;
+    }
+}
+
+void MidiThru::setSink(int port, Sink* sink)
+{
+    jassert(isPositiveAndBelow(port, maxPorts));
+    if (isPositiveAndBelow(port, maxPorts))
+        sinks[port] = sink;
+}
+
+Result MidiThru::updateRouting()
+{
+    zeromem(routes, sizeof(routes));
+    
+    const ScopedLock sl(swivelStrings->getLock());
+    for (SwivelString* string : *swivelStrings)
+    {
+        const int port = string->getMidiPort();
+        const int channel = string->getMidiChannel();
+        if (!isPositiveAndBelow(port, maxPorts))
+            return Result::fail("String on channel " + String(channel) + " is on MIDI port " + String(port)
+                                + ", there can only be " + String(maxPorts));
+        if (!isPositiveAndBelow(channel - 1, 16))
+            continue; // not initialised
+        if (routes[port][channel-1] != nullptr)
+            return Result::fail("More than one string on MIDI port " + String(port) + " channel " + String(channel));
+        routes[port][channel-1] = string;
+    }
+    return Result::ok();
+}
+
+bool MidiThru::clearRoutesAndWait(int timeoutMs)
+{
+    bypassed = true;
+    zeromem(routes, sizeof(routes));
+    
+    // anything the thread picks up after this sees the bypass, so once it's back between batches
+    // nothing it had can still be using a string
+    idleReached.reset();
+    idlePending = true;
+    notify();
+    return idleReached.wait(timeoutMs);
+}
+
+void MidiThru::setLog(LogQueue* where)
+{
+    logger = where;
+}
+
+void MidiThru::setBypassed(bool shouldBeBypassed)
+{
+    bypassed = shouldBeBypassed;
+}
+
+int MidiThru::getNumDropped()
+{
+    return dropped.exchange(0);
+}
+
+Result MidiThru::setScheduling(const ThreadScheduling& newScheduling)
+{
+    // the thread only reads it once it sees pending
+    scheduling = newScheduling;
+    schedulingApplied.reset();
+    schedulingPending = true;
+    notify();
+    
+    if (!schedulingApplied.wait(2000))
+        return Result::fail("the MIDI thru thread didn't get round to it");
+    return schedulingResult;
+}
+
+ThruStats& MidiThru::getStats()
+{
+    return stats;
+}
+
+int MidiThru::findPort(MidiInput* source) const
+{
+    if (source != nullptr)
+        for (int i = 0; i < maxPorts; i++)
+            if (inputs[i] == source)
+                return i;
+    return 0;
+}
+
+//===============================================================================================
+void MidiThru::handleIncomingMidiMessage(juce::MidiInput *source, const juce::MidiMessage &message)
+{
+    // the driver's timestamp is only to the millisecond on some platforms
+    const double received = Time::getMillisecondCounterHiRes() * 0.001;
+    
+    // system messages have no channel and no string wants them
+    if (bypassed || message.getChannel() == 0 || message.getRawDataSize() > 3)
+        return;
+    
+    uint32 position = writePosition.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;)
+    {
+        slot = &slots[position & (capacity-1)];
+        int32 diff = (int32) slot->sequence.load(std::memory_order_acquire) - (int32) position;
+        
+        if (diff == 0)
+        {
+            if (writePosition.compare_exchange_weak(position, position+1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) // the thread hasn't got this far yet, we're full
+        {
+            dropped++;
+            return;
+        }
+        else // another input got it first
+        {
+            position = writePosition.load(std::memory_order_relaxed);
+        }
+    }
+    
+    slot->message.timeStamp = message.getTimeStamp();
+    slot->message.received = received;
+    slot->message.port = findPort(source);
+    slot->message.size = message.getRawDataSize();
+    slot->message.data[1] = slot->message.data[2] = 0;
+    memcpy(slot->message.data, message.getRawData(), (size_t) slot->message.size);
+    slot->sequence.store(position+1, std::memory_order_release);
+    
+    // only the first message after the thread has run dry has to wake it. The fence pairs with the
+    // one in run(): without both, each side can miss the other's store and the message sits there
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.exchange(false))
+        notify();
+}
+
+void MidiThru::sendNow(int port, const MidiMessage& message)
+{
+    if (bypassed || message.getChannel() == 0 || message.getRawDataSize() > 3 || !isPositiveAndBelow(port, maxPorts))
+        return;
+    
+    Message now;
+    now.timeStamp = message.getTimeStamp();
+    now.received = Time::getMillisecondCounterHiRes() * 0.001;
+    now.port = port;
+    now.size = message.getRawDataSize();
+    now.data[1] = now.data[2] = 0;
+    memcpy(now.data, message.getRawData(), (size_t) now.size);
+    send(now);
+}
+
+//===============================================================================================
+void MidiThru::run()
+{
+    while (!threadShouldExit())
+    {
+        if (schedulingPending.exchange(false))
+        {
+            schedulingResult = scheduling.applyToCurrentThread();
+            schedulingApplied.signal();
+        }
+        if (idlePending.exchange(false))
+            idleReached.signal();
+        
+        const int count = takeBatch();
+        if (count == 0)
+        {
+            sleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // something may have arrived between looking and saying so. Otherwise sleep until the
+            // next push, stopThread() or setScheduling() wakes us, so there's no CPU used while it's quiet
+            if (slots[readPosition & (capacity-1)].sequence.load(std::memory_order_acquire) != readPosition+1)
+                wait(-1);
+            sleeping = false;
+            continue;
+        }
+        
+        // each input's messages are already in order, so this is only ever shuffling a few into place
+        for (int i = 1; i < count; i++)
+        {
+            const Message message = batch[i];
+            int j = i;
+            for (; j > 0 && batch[j-1].timeStamp > message.timeStamp; j--)
+                batch[j] = batch[j-1];
+            batch[j] = message;
+        }
+        
+        for (int i = 0; i < count; i++)
+            send(batch[i]);
+    }
+}
+
+int MidiThru::takeBatch()
+{
+    int count = 0;
+    while (count < batchSize)
+    {
+        Slot* slot = &slots[readPosition & (capacity-1)];
+        if (slot->sequence.load(std::memory_order_acquire) != readPosition+1)
+            break; // nothing more written yet
+        
+        batch[count++] = slot->message;
+        slot->sequence.store(readPosition + capacity, std::memory_order_release); // free for the next lap
+        readPosition++;
+    }
+    return count;
+}
+
+void MidiThru::send(const Message& queued)
+{
+    const MidiMessage message(queued.data, queued.size, queued.timeStamp);
+    
+    // printing goes through the log queue so this thread never waits for the message thread
+#ifdef DEBUG
+    if (logger != nullptr)
+        logger->pushFormatted(LogQueue::debug, "Received MIDI: %d %d %d\n", queued.data[0], queued.data[1], queued.data[2]);
+    try {
+#endif
+    // straight to the string from the table, however many strings there are
+    const int channel = message.getChannel();
+    if (!bypassed && (outputs[queued.port] != nullptr || sinks[queued.port] != nullptr))
+    {
+        if (SwivelString* string = routes[queued.port][channel-1])
+        {
+            if (sinks[queued.port] != nullptr)
+                sinks[queued.port]->handleOutgoingMessage(queued.port, string->transform(message));
+            else
+                outputs[queued.port]->sendMessageNow(string->transform(message));
+            stats.record(queued.port, channel, queued.received, Time::getMillisecondCounterHiRes() * 0.001);
+        }
+    }
+        
+#ifdef DEBUG
+    } catch (std::logic_error const &e) {
+        if (logger != nullptr)
+            logger->pushFormatted(LogQueue::error, "%s\n", e.what());
+    }
+#endif
+}
@@ -0,0 +1,139 @@
+//
+//  MidiThru.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__MidiThru__
+#define __SwivelAutotune__MidiThru__
+
+#include <atomic>
+#include "CoreJuceHeader.h"
+#include "String.h"
+#include "LogQueue.h"
+#include "ThruStats.h"
+#include "ThreadScheduling.h"
+
+/** Receives MIDI, passes it through the string on the message's port and channel and sends the
+    result to that port's output. Used by both the app and the headless build.
+ 
+    A port is an input and an output, so an instrument can spread its strings over several
+    MIDI links, 16 strings to each. MIDI from an input that isn't any port's counts as port 0,
+    so with only the one port it doesn't matter which input it comes from.
+ 
+    The drivers' callbacks only copy each message into a bounded lock-free queue (one producer per
+    input, the thru's own thread is the only consumer). The thread takes whatever has arrived in one
+    go, puts it in the order the drivers timestamped it, transforms it and sends it, so a burst on
+    one input never holds up the drivers or the other inputs. If the queue is full messages are
+    dropped and counted rather than anyone waiting.
+ */
+class MidiThru : public MidiInputCallback,
+                 private Thread
+{
+public:
+    /** Somewhere other than a MidiOutput for a port's messages to go, eg. swivel-flood's counter */
+    class Sink
+    {
+    public:
+        virtual ~Sink() {}
+        /** Called on the thru's thread in place of sendMessageNow(), so don't hang about */
+        virtual void handleOutgoingMessage(int port, const MidiMessage& message) = 0;
+    };
+    
+    MidiThru(OwnedArray<SwivelString, CriticalSection>* strings);
+    ~MidiThru();
+    
+    /** Sets a port's input and output, either can be nullptr. Set them while bypassed */
+    void setPort(int port, MidiInput* in, MidiOutput* out);
+    /** Sends a port's messages to the sink instead of its output, nullptr to go back. Set it while bypassed */
+    void setSink(int port, Sink* sink);
+    /** Works out which string gets each port and channel. Call it while bypassed whenever the strings
+        change, it fails if two strings share a port and channel or a string's port is out of range */
+    Result updateRouting();
+    /** Bypasses the thru, forgets the strings and waits for its thread to finish whatever it was
+        sending through them, so they can be deleted. updateRouting() and setBypassed(false) once
+        there are new ones. False if the thread didn't get back in time */
+    bool clearRoutesAndWait(int timeoutMs = 2000);
+    /** Sets the queue to log to (debug builds only). If nullptr nothing is output */
+    void setLog(LogQueue* where);
+    /** While bypassed incoming messages are ignored, eg. while the strings are being analysed */
+    void setBypassed(bool shouldBeBypassed);
+    /** How many messages didn't fit in the queue since last time this was called */
+    int getNumDropped();
+    /** Puts the thru's thread on a scheduling, waits for the thread to do it and says how it went */
+    Result setScheduling(const ThreadScheduling& scheduling);
+    /** How long messages are taking to get through */
+    ThruStats& getStats();
+    
+    void handleIncomingMidiMessage(MidiInput* source, const MidiMessage& message) override;
+    /** Transforms and sends a message on the calling thread, skipping the queue, for a caller that is
+        already where the MIDI gets handled, eg. a JACK process callback. Only use it from the one
+        thread, and with no inputs set so the thru's own thread never has anything to send */
+    void sendNow(int port, const MidiMessage& message);
+    
+    // plenty, at 16 strings a port
+    static const int maxPorts = 16;
+    // number of messages the queue holds, must be a power of 2
+    static const int capacity = 4096;
+    // most messages taken off the queue and sorted at once
+    static const int batchSize = 256;
+    
+private:
+    /** A channel message as it came in, anything longer isn't for a string anyway */
+    struct Message
+    {
+        double timeStamp; // the driver's, for putting them in order
+        double received;  // when the callback got it, hi-res
+        int port;
+        int size;
+        uint8 data[3];
+    };
+    
+    struct Slot
+    {
+        std::atomic<uint32> sequence;
+        Message message;
+    };
+    
+    OwnedArray<SwivelString, CriticalSection>* swivelStrings;
+    MidiInput* inputs[maxPorts];
+    MidiOutput* outputs[maxPorts];
+    Sink* sinks[maxPorts];
+    // the string on each port and channel, nullptr if there isn't one
+    SwivelString* routes[maxPorts][16];
+    LogQueue* logger;
+    volatile bool bypassed;
+    
+    // the queue, same scheme as LogQueue's
+    HeapBlock<Slot> slots;
+    std::atomic<uint32> writePosition;
+    uint32 readPosition; // only touched by the thread
+    std::atomic<int> dropped;
+    std::atomic<bool> sleeping; // the thread is about to wait or waiting, so the next push wakes it
+    
+    // handed to the thread to apply to itself
+    ThreadScheduling scheduling;
+    std::atomic<bool> schedulingPending;
+    Result schedulingResult;
+    WaitableEvent schedulingApplied;
+    
+    // asked for by clearRoutesAndWait(), signalled by the thread between batches
+    std::atomic<bool> idlePending;
+    WaitableEvent idleReached;
+    
+    // what the thread is working on
+    Message batch[batchSize];
+    ThruStats stats;
+    
+    int findPort(MidiInput* source) const;
+    void run() override;
+    /** Moves up to batchSize messages off the queue into batch, returns how many */
+    int takeBatch();
+    void send(const Message& message);
+    
+    JUCE_DECLARE_NON_COPYABLE (MidiThru)
+};
+
+#endif /* defined(__SwivelAutotune__MidiThru__) */
@@ -0,0 +1,167 @@
+//
+//  PerfCounters.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "PerfCounters.h"
+
+#if JUCE_LINUX
+ #include <linux/perf_event.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+ #include <cerrno>
+ #include <cstring>
+#endif
+
+namespace
+{
+#if JUCE_LINUX
+    struct CounterType
+    {
+        uint32 type;
+        uint64 config;
+    };
+
+    const CounterType counterTypes[PerfCounters::numCounters] =
+    {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }, // last level
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+    };
+
+    int openCounter(const CounterType& counter, int groupFd)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter.type;
+        attr.config = counter.config;
+        attr.disabled = groupFd == -1 ? 1 : 0; // the leader starts and stops the lot
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // this thread, any cpu
+        return (int) syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+#endif
+}
+
+//==============================================================================================
+PerfCounters::PerfCounters()
+:   numOpen(0)
+{
+    for (int i = 0; i < numCounters; i++)
+    {
+        fds[i] = -1;
+        groupIndex[i] = -1;
+    }
+
+#if JUCE_LINUX
+    // as one group, so they all count exactly the same stretch
+    for (int i = 0; i < numCounters; i++)
+    {
+        fds[i] = openCounter(counterTypes[i], i == cycles ? -1 : fds[cycles]);
+        if (fds[i] >= 0)
+            groupIndex[i] = numOpen++;
+        else if (i == cycles)
+        {
+            error = String("perf_event_open failed: ") + String(strerror(errno))
+                    + (errno == EACCES || errno == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)"
+                       : errno == ENOENT || errno == EOPNOTSUPP ? " (no hardware counters, a VM?)" : "");
+            break;
+        }
+    }
+#else
+    error = "Hardware counters are only read on Linux";
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#if JUCE_LINUX
+    for (int i = numCounters; --i >= 0;)
+        if (fds[i] >= 0)
+            close(fds[i]);
+#endif
+}
+
+bool PerfCounters::isAvailable() const
+{
+    return fds[cycles] >= 0;
+}
+
+bool PerfCounters::isAvailable(Counter counter) const
+{
+    return fds[counter] >= 0;
+}
+
+const String& PerfCounters::getError() const
+{
+    return error;
+}
+
+const char* PerfCounters::getName(Counter counter)
+{
+    static const char* const names[numCounters] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+    return names[counter];
+}
+
+//==============================================================================================
+void PerfCounters::reset()
+{
+#if JUCE_LINUX
+    if (isAvailable())
+    {
+        ioctl(fds[cycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+void PerfCounters::resume()
+{
+#if JUCE_LINUX
+    if (isAvailable())
+        ioctl(fds[cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+void PerfCounters::pause()
+{
+#if JUCE_LINUX
+    if (isAvailable())
+        ioctl(fds[cycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+void PerfCounters::read(int64 (&values)[numCounters])
+{
+    for (int i = 0; i < numCounters; i++)
+        values[i] = -1;
+
+#if JUCE_LINUX
+    if (!isAvailable())
+        return;
+
+    // number of counters, time enabled, time running, then the values in the order they were opened
+    uint64 data[3 + numCounters];
+    if (::read(fds[cycles], data, sizeof(data)) < (ssize_t) (3 * sizeof(uint64)))
+        return;
+
+    const uint64 enabled = data[1], running = data[2];
+    if (running == 0)
+        return; // never got onto the hardware, nothing to go on
+
+    const double scale = (double) enabled / running;
+    for (int i = 0; i < numCounters; i++)
+        if (groupIndex[i] >= 0 && groupIndex[i] < (int) data[0])
+            values[i] = (int64) (data[3 + groupIndex[i]] * scale + 0.5);
+#endif
+}
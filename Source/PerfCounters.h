@@ -0,0 +1,62 @@
+//
+//  PerfCounters.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__PerfCounters__
+#define __SwivelAutotune__PerfCounters__
+
+#include "CoreJuceHeader.h"
+
+/** The CPU's own counters for this thread through perf_event_open, for telling whether a loop is
+    waiting on memory or on arithmetic. Only user space is counted, so it works with the default
+    perf_event_paranoid. Linux only, elsewhere (or in a VM without a PMU, or when perf is locked
+    down) nothing is available and the readings are all -1.
+
+    Counting accumulates between resume() and pause(), so only the measured bits get counted.
+ */
+class PerfCounters
+{
+public:
+    enum Counter
+    {
+        cycles = 0,
+        instructions,
+        l1dMisses,
+        llcMisses,
+        branchMisses,
+        numCounters
+    };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    /** True if at least cycles could be opened */
+    bool isAvailable() const;
+    bool isAvailable(Counter counter) const;
+    /** Why nothing's available, empty if something is */
+    const String& getError() const;
+    static const char* getName(Counter counter);
+
+    /** Zeroes everything, leaves it paused */
+    void reset();
+    void resume();
+    void pause();
+
+    /** The totals since reset(), scaled up if the kernel had to share the hardware with something
+        else, -1 for the ones that aren't available */
+    void read(int64 (&values)[numCounters]);
+
+private:
+    int fds[numCounters]; // -1 where it couldn't be opened, fds[cycles] leads the group
+    int groupIndex[numCounters]; // where each one is in a group read
+    int numOpen;
+    String error;
+
+    JUCE_DECLARE_NON_COPYABLE (PerfCounters)
+};
+
+#endif /* defined(__SwivelAutotune__PerfCounters__) */
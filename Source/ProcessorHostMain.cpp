@@ -0,0 +1,298 @@
+//
+//  ProcessorHostMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  Hosts the plugin's processor without a DAW: loads the strings, then hands it block after block
+//  of generated MIDI the way a host would and times every processBlock() call, to see what the
+//  transform costs in the host's audio callback.
+//
+//      swivel-host datafile [--frequencies 98.2,145.6] [--blocks 100000] [--block-size 512]
+//                           [--events 16] [--samplerate 44100] [--notes 0.05] [--seed n] [--json file]
+//
+//  --frequencies are the strings' open frequencies in the order the file has them, as a calibration
+//  logs them. Without them each string is put halfway between its lowest and highest measurements.
+//  --events is how many messages each block gets, at random positions, mostly pitch bends over
+//  every string with --notes of them note ons and offs.
+//
+
+#include <chrono>
+#include <iostream>
+#include "CoreJuceHeader.h"
+#include "SwivelProcessor.h"
+#include "SwivelStringFileParser.h"
+#include "ThruStats.h"
+#include "RealtimeChecker.h"
+
+namespace
+{
+    struct Options
+    {
+        File dataFile;
+        Array<double> frequencies; // empty for halfway
+        int blocks = 100000;
+        int blockSize = 512;
+        int events = 16;
+        double sampleRate = 44100.0;
+        double notes = 0.05;
+        int64 seed = 1;
+        File json;
+    };
+
+    // juce's high resolution ticks are only microseconds on linux, most blocks take about that
+    typedef std::chrono::steady_clock Clock;
+
+    int64 now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    Result parseOptions(const StringArray& args, Options& options)
+    {
+        if (args.size() == 0 || args[0].startsWith("--"))
+            return Result::fail("Usage: swivel-host datafile [options], see ProcessorHostMain.cpp");
+        options.dataFile = File::getCurrentWorkingDirectory().getChildFile(args[0]);
+
+        for (int i = 1; i < args.size(); i++)
+        {
+            const String& arg = args[i];
+            if (i + 1 >= args.size())
+                return Result::fail("Missing value for " + arg);
+
+            const String value = args[++i];
+            if (arg == "--frequencies")
+            {
+                StringArray frequencies;
+                frequencies.addTokens(value, ",", String::empty);
+                for (const String& frequency : frequencies)
+                    options.frequencies.add(frequency.getDoubleValue());
+            }
+            else if (arg == "--blocks")
+                options.blocks = value.getIntValue();
+            else if (arg == "--block-size")
+                options.blockSize = value.getIntValue();
+            else if (arg == "--events")
+                options.events = value.getIntValue();
+            else if (arg == "--samplerate")
+                options.sampleRate = value.getDoubleValue();
+            else if (arg == "--notes")
+                options.notes = value.getDoubleValue();
+            else if (arg == "--seed")
+                options.seed = value.getLargeIntValue();
+            else if (arg == "--json")
+                options.json = File::getCurrentWorkingDirectory().getChildFile(value);
+            else
+                return Result::fail("Unknown option: " + arg);
+        }
+
+        if (options.blocks < 1 || options.blockSize < 1 || options.sampleRate <= 0)
+            return Result::fail("--blocks, --block-size and --samplerate should be more than 0");
+        if (options.events < 0 || options.events > SwivelProcessor::maxEventsPerBlock)
+            return Result::fail("--events should be 0-" + String(SwivelProcessor::maxEventsPerBlock));
+        return Result::ok();
+    }
+
+    /** A string to play, by channel */
+    struct Target
+    {
+        int channel;
+        int lowestNote;
+    };
+
+    //==========================================================================================
+    /** Fills blocks with the same kind of traffic swivel-flood plays: pitch bend sweeps on every
+        string in turn, with the odd note on or off */
+    class BlockGenerator
+    {
+    public:
+        BlockGenerator(const Array<Target>& targets, const Options& options)
+        :   strings(targets),
+            options(options),
+            random(options.seed),
+            next(0)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                bends[i] = 8192;
+                notesOn[i] = -1;
+            }
+        }
+
+        void fill(MidiBuffer& block)
+        {
+            block.clear();
+            // a note on each string first, the bends don't mean anything without one
+            if (next == 0)
+                for (const Target& target : strings)
+                    block.addEvent(MidiMessage::noteOn(target.channel, target.lowestNote + 12, (uint8) 100), 0);
+
+            for (int i = 0; i < options.events; i++)
+                block.addEvent(makeMessage(), random.nextInt(options.blockSize));
+        }
+
+    private:
+        const Array<Target>& strings;
+        const Options& options;
+        Random random;
+        int next;
+        int bends[16];
+        int notesOn[16];
+
+        MidiMessage makeMessage()
+        {
+            const Target& target = strings.getReference(next++ % strings.size());
+            const int c = target.channel - 1;
+
+            if (random.nextDouble() < options.notes)
+            {
+                if (notesOn[c] >= 0)
+                {
+                    const int note = notesOn[c];
+                    notesOn[c] = -1;
+                    return MidiMessage::noteOff(target.channel, note);
+                }
+                // anywhere on the string, so some of them are notes it can't play
+                notesOn[c] = target.lowestNote + random.nextInt(25);
+                return MidiMessage::noteOn(target.channel, notesOn[c], (uint8) 100);
+            }
+
+            bends[c] = (bends[c] + 67) & 0x3fff;
+            return MidiMessage::pitchWheel(target.channel, bends[c]);
+        }
+
+        JUCE_DECLARE_NON_COPYABLE (BlockGenerator)
+    };
+}
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add(argv[i]);
+
+    Options options;
+    Result parsed = parseOptions(args, options);
+    if (!parsed)
+    {
+        std::cerr << parsed.getErrorMessage() << std::endl;
+        return 1;
+    }
+    RealtimeChecker::initialise();
+
+    // the notes each string starts on, and halfway frequencies if there weren't any given
+    Array<int> lowestNotes;
+    try
+    {
+        OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+        ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(options.dataFile);
+        if (data == nullptr)
+        {
+            std::cerr << "Couldn't open " << options.dataFile.getFullPathName() << std::endl;
+            return 1;
+        }
+        bundles.addArray(*data);
+
+        const bool halfway = options.frequencies.size() == 0;
+        for (SwivelStringFileParser::StringDataBundle* bundle : bundles)
+        {
+            if (bundle->port != 0)
+                continue;
+            lowestNotes.add(bundle->num);
+            if (halfway)
+            {
+                double lowest = bundle->fundamentals->getFirst(), highest = lowest;
+                for (double fundamental : *bundle->fundamentals)
+                {
+                    lowest = jmin(lowest, fundamental);
+                    highest = jmax(highest, fundamental);
+                }
+                options.frequencies.add((lowest + highest) / 2.0);
+            }
+        }
+    }
+    catch (SwivelStringFileParser::ParseException const &e)
+    {
+        std::cerr << "Parse Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    SwivelProcessor processor;
+    Result loaded = processor.loadStrings(options.dataFile, options.frequencies);
+    if (!loaded)
+    {
+        std::cerr << loaded.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    Array<Target> targets;
+    for (int i = 0; i < processor.getNumStrings(); i++)
+    {
+        Target target = { processor.getString(i)->getMidiChannel(), lowestNotes[i] };
+        targets.add(target);
+    }
+
+    // stereo through, like an instrument track
+    processor.setPlayConfigDetails(2, 2, options.sampleRate, options.blockSize);
+    processor.prepareToPlay(options.sampleRate, options.blockSize);
+    AudioSampleBuffer audio(2, options.blockSize);
+    audio.clear();
+    MidiBuffer block;
+    block.ensureSize((size_t) SwivelProcessor::maxEventsPerBlock * 16);
+    BlockGenerator generator(targets, options);
+
+    // in nanoseconds, the histogram doesn't mind what the unit is
+    LatencyHistogram costs;
+    int64 eventsIn = 0, eventsOut = 0;
+    int64 total = 0;
+    for (int i = 0; i < options.blocks; i++)
+    {
+        generator.fill(block);
+        eventsIn += block.getNumEvents();
+
+        const int64 start = now();
+        processor.processBlock(audio, block);
+        const int64 nanoseconds = now() - start;
+
+        costs.record(nanoseconds);
+        total += nanoseconds;
+        eventsOut += block.getNumEvents();
+    }
+    processor.releaseResources();
+
+    const double budget = options.blockSize / options.sampleRate * 1.0e9;
+    const double mean = (double) total / options.blocks;
+    std::cout << options.blocks << " blocks of " << options.blockSize << " samples, " << targets.size() << " strings, "
+              << eventsIn << " messages in, " << eventsOut << " out\n"
+              << "processBlock (ns): mean " << roundToInt(mean)
+              << ", p50 " << costs.getValueAtPercentile(50.0)
+              << ", p99 " << costs.getValueAtPercentile(99.0)
+              << ", p99.9 " << costs.getValueAtPercentile(99.9)
+              << ", max " << costs.getMax() << "\n"
+              << "That's " << String(mean / budget * 100.0, 4) << "% of a block's time, "
+              << roundToInt(eventsIn > 0 ? (double) total / eventsIn : 0.0) << "ns a message" << std::endl;
+#ifdef DEBUG
+    std::cout << RealtimeChecker::report();
+#endif
+
+    if (options.json != File::nonexistent)
+    {
+        DynamicObject* root = new DynamicObject();
+        root->setProperty("blocks", options.blocks);
+        root->setProperty("block_size", options.blockSize);
+        root->setProperty("sample_rate", options.sampleRate);
+        root->setProperty("strings", targets.size());
+        root->setProperty("messages_in", eventsIn);
+        root->setProperty("messages_out", eventsOut);
+        root->setProperty("mean_ns", mean);
+        root->setProperty("p50_ns", costs.getValueAtPercentile(50.0));
+        root->setProperty("p99_ns", costs.getValueAtPercentile(99.0));
+        root->setProperty("p999_ns", costs.getValueAtPercentile(99.9));
+        root->setProperty("max_ns", costs.getMax());
+        root->setProperty("block_budget_fraction", mean / budget);
+        if (!options.json.replaceWithText(JSON::toString(var(root))))
+            std::cerr << "Couldn't write " << options.json.getFullPathName() << std::endl;
+    }
+    return 0;
+}
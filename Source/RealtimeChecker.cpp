@@ -0,0 +1,327 @@
+//
+//  RealtimeChecker.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "RealtimeChecker.h"
+
+#ifdef DEBUG
+
+#include <atomic>
+#include <new>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <time.h>
+
+// glibc marks some of these as not throwing, the definitions have to agree
+#if JUCE_LINUX
+ #define RT_NOTHROW __THROW
+#else
+ #define RT_NOTHROW
+#endif
+
+//==============================================================================================
+namespace
+{
+    const int maxFrames = 32;
+    const int maxEvents = 512;
+
+    struct Event
+    {
+        RealtimeChecker::Violation type;
+        int numFrames;
+        void* frames[maxFrames];
+    };
+
+    // everything in here has to be usable from inside malloc, so nothing that allocates
+    Event events[maxEvents];
+    std::atomic<int> numEvents(0);
+    std::atomic<int> counts[RealtimeChecker::numViolationTypes];
+
+    thread_local int realtimeDepth = 0;
+    thread_local bool recording = false;
+
+    const char* violationNames[RealtimeChecker::numViolationTypes] = {
+        "allocation",
+        "lock",
+        "blocking call",
+        "exception"
+    };
+
+    /** Finds the next definition of a function we are wrapping. Racy, but every thread gets the same answer */
+    template <typename FunctionType>
+    FunctionType next(FunctionType& slot, const char* name)
+    {
+        if (slot == nullptr)
+            slot = (FunctionType) dlsym(RTLD_NEXT, name);
+        return slot;
+    }
+
+    typedef int     (*MutexFunction)(pthread_mutex_t*);
+    typedef int     (*CondWaitFunction)(pthread_cond_t*, pthread_mutex_t*);
+    typedef int     (*CondTimedWaitFunction)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*);
+    typedef ssize_t (*ReadFunction)(int, void*, size_t);
+    typedef ssize_t (*WriteFunction)(int, const void*, size_t);
+    typedef int     (*NanosleepFunction)(const struct timespec*, struct timespec*);
+    typedef int     (*UsleepFunction)(useconds_t);
+    typedef int     (*PollFunction)(struct pollfd*, nfds_t, int);
+    typedef int     (*SelectFunction)(int, fd_set*, fd_set*, fd_set*, struct timeval*);
+    typedef void    (*ThrowFunction)(void*, void*, void (*)(void*));
+
+    MutexFunction         realMutexLock     = nullptr;
+    MutexFunction         realMutexTryLock  = nullptr;
+    CondWaitFunction      realCondWait      = nullptr;
+    CondTimedWaitFunction realCondTimedWait = nullptr;
+    ReadFunction          realRead          = nullptr;
+    WriteFunction         realWrite         = nullptr;
+    NanosleepFunction     realNanosleep     = nullptr;
+    UsleepFunction        realUsleep        = nullptr;
+    PollFunction          realPoll          = nullptr;
+    SelectFunction        realSelect        = nullptr;
+    ThrowFunction         realThrow         = nullptr;
+}
+
+//==============================================================================================
+RealtimeChecker::ScopedRealtimeSection::ScopedRealtimeSection()
+{
+    ++realtimeDepth;
+}
+
+RealtimeChecker::ScopedRealtimeSection::~ScopedRealtimeSection()
+{
+    --realtimeDepth;
+}
+
+void RealtimeChecker::initialise()
+{
+    next(realMutexLock,     "pthread_mutex_lock");
+    next(realMutexTryLock,  "pthread_mutex_trylock");
+    next(realCondWait,      "pthread_cond_wait");
+    next(realCondTimedWait, "pthread_cond_timedwait");
+    next(realRead,          "read");
+    next(realWrite,         "write");
+    next(realNanosleep,     "nanosleep");
+    next(realUsleep,        "usleep");
+    next(realPoll,          "poll");
+    next(realSelect,        "select");
+    next(realThrow,         "__cxa_throw");
+
+    // the first backtrace loads the unwinder, which allocates, so get that out of the way
+    void* frames[maxFrames];
+    backtrace(frames, maxFrames);
+}
+
+bool RealtimeChecker::isInRealtimeSection()
+{
+    return realtimeDepth > 0;
+}
+
+void RealtimeChecker::record(Violation type)
+{
+    if (realtimeDepth == 0 || recording)
+        return;
+
+    recording = true;
+    counts[type]++;
+    int index = numEvents++;
+    if (index < maxEvents)
+    {
+        events[index].type = type;
+        events[index].numFrames = backtrace(events[index].frames, maxFrames);
+    }
+    recording = false;
+}
+
+String RealtimeChecker::report()
+{
+    String result = "Realtime violations:\n";
+    for (int i = 0; i < numViolationTypes; i++)
+        result += String("    ") + violationNames[i] + ": " + String(counts[i].load()) + "\n";
+
+    // group identical stacks so a violation every block shows up once
+    int recorded = jmin(numEvents.load(), maxEvents);
+    Array<int> seen;
+    for (int i = 0; i < recorded; i++)
+    {
+        bool duplicate = false;
+        for (int j = 0; j < seen.size() && !duplicate; j++)
+        {
+            const Event& a = events[i];
+            const Event& b = events[seen[j]];
+            duplicate = a.type == b.type && a.numFrames == b.numFrames
+                        && memcmp(a.frames, b.frames, sizeof(void*)*a.numFrames) == 0;
+        }
+        if (duplicate)
+            continue;
+        seen.add(i);
+
+        int occurrences = 0;
+        for (int j = i; j < recorded; j++)
+            if (events[j].type == events[i].type && events[j].numFrames == events[i].numFrames
+                && memcmp(events[j].frames, events[i].frames, sizeof(void*)*events[i].numFrames) == 0)
+                occurrences++;
+
+        result += String(violationNames[events[i].type]) + " (x" + String(occurrences) + "):\n";
+        char** symbols = backtrace_symbols(events[i].frames, events[i].numFrames);
+        for (int f = 1; f < events[i].numFrames; f++) // skip record() itself
+            result += String("    ") + (symbols != nullptr ? symbols[f] : "?") + "\n";
+        free(symbols);
+    }
+
+    if (numEvents.load() > maxEvents)
+        result += String(numEvents.load() - maxEvents) + " more not kept\n";
+
+    return result;
+}
+
+void RealtimeChecker::clear()
+{
+    numEvents = 0;
+    for (int i = 0; i < numViolationTypes; i++)
+        counts[i] = 0;
+}
+
+//==============================================================================================
+// The wrappers. These replace the libc/pthread/C++ runtime versions for everything linked into
+// the app, record if necessary and then hand over to the real thing.
+extern "C"
+{
+#if JUCE_LINUX
+    // glibc lets us get at the real allocator directly, which avoids dlsym needing malloc
+    void* __libc_malloc(size_t);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+    void  __libc_free(void*);
+
+    void* malloc(size_t size) RT_NOTHROW
+    {
+        RealtimeChecker::record(RealtimeChecker::allocation);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t num, size_t size) RT_NOTHROW
+    {
+        RealtimeChecker::record(RealtimeChecker::allocation);
+        return __libc_calloc(num, size);
+    }
+
+    void* realloc(void* ptr, size_t size) RT_NOTHROW
+    {
+        RealtimeChecker::record(RealtimeChecker::allocation);
+        return __libc_realloc(ptr, size);
+    }
+
+    void free(void* ptr) RT_NOTHROW
+    {
+        if (ptr != nullptr)
+            RealtimeChecker::record(RealtimeChecker::allocation);
+        __libc_free(ptr);
+    }
+#endif
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex) RT_NOTHROW
+    {
+        RealtimeChecker::record(RealtimeChecker::lock);
+        return next(realMutexLock, "pthread_mutex_lock")(mutex);
+    }
+
+    int pthread_mutex_trylock(pthread_mutex_t* mutex) RT_NOTHROW
+    {
+        RealtimeChecker::record(RealtimeChecker::lock);
+        return next(realMutexTryLock, "pthread_mutex_trylock")(mutex);
+    }
+
+    int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+    {
+        RealtimeChecker::record(RealtimeChecker::blockingCall);
+        return next(realCondWait, "pthread_cond_wait")(cond, mutex);
+    }
+
+    int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* time)
+    {
+        RealtimeChecker::record(RealtimeChecker::blockingCall);
+        return next(realCondTimedWait, "pthread_cond_timedwait")(cond, mutex, time);
+    }
+
+    ssize_t read(int fd, void* buffer, size_t size)
+    {
+        RealtimeChecker::record(RealtimeChecker::blockingCall);
+        return next(realRead, "read")(fd, buffer, size);
+    }
+
+    ssize_t write(int fd, const void* buffer, size_t size)
+    {
+        RealtimeChecker::record(RealtimeChecker::blockingCall);
+        return next(realWrite, "write")(fd, buffer, size);
+    }
+
+    int nanosleep(const struct timespec* time, struct timespec* remaining)
+    {
+        RealtimeChecker::record(RealtimeChecker::blockingCall);
+        return next(realNanosleep, "nanosleep")(time, remaining);
+    }
+
+    int usleep(useconds_t time)
+    {
+        RealtimeChecker::record(RealtimeChecker::blockingCall);
+        return next(realUsleep, "usleep")(time);
+    }
+
+    int poll(struct pollfd* fds, nfds_t num, int timeout)
+    {
+        RealtimeChecker::record(RealtimeChecker::blockingCall);
+        return next(realPoll, "poll")(fds, num, timeout);
+    }
+
+    int select(int num, fd_set* read, fd_set* write, fd_set* error, struct timeval* timeout)
+    {
+        RealtimeChecker::record(RealtimeChecker::blockingCall);
+        return next(realSelect, "select")(num, read, write, error, timeout);
+    }
+
+    // the type is really a std::type_info*, but the compiler's own declaration says void*
+    void __cxa_throw(void* thrown, void* type, void (*destructor)(void*)) __attribute__((noreturn));
+    void __cxa_throw(void* thrown, void* type, void (*destructor)(void*))
+    {
+        RealtimeChecker::record(RealtimeChecker::exception);
+        next(realThrow, "__cxa_throw")(thrown, type, destructor);
+        __builtin_unreachable();
+    }
+}
+
+#if ! JUCE_LINUX
+// without a way to wrap malloc, at least catch everything that goes through new
+void* operator new(std::size_t size)
+{
+    RealtimeChecker::record(RealtimeChecker::allocation);
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    if (p != nullptr)
+        RealtimeChecker::record(RealtimeChecker::allocation);
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    operator delete(p);
+}
+#endif
+
+#endif // DEBUG
@@ -0,0 +1,63 @@
+//
+//  RealtimeChecker.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__RealtimeChecker__
+#define __SwivelAutotune__RealtimeChecker__
+
+#include "CoreJuceHeader.h"
+
+/** Debug-only watchdog for the audio callbacks.
+    Anything that allocates, takes a lock, makes a blocking system call or throws while a
+    ScopedRealtimeSection is alive on the current thread gets recorded along with a stack trace.
+    Allocations are caught through operator new everywhere and malloc on Linux; locks, blocking
+    calls and exceptions by wrapping the pthread/libc/C++ runtime symbols for code linked into the app.
+    In release builds all of this compiles away to nothing.
+ */
+class RealtimeChecker
+{
+public:
+    enum Violation
+    {
+        allocation,
+        lock,
+        blockingCall,
+        exception,
+        numViolationTypes
+    };
+    
+    /** Marks the current thread as being in a realtime callback while this is in scope */
+    class ScopedRealtimeSection
+    {
+    public:
+#ifdef DEBUG
+        ScopedRealtimeSection();
+        ~ScopedRealtimeSection();
+#else
+        ScopedRealtimeSection() {}
+#endif
+    };
+    
+#ifdef DEBUG
+    /** Looks up the real versions of the wrapped functions, call before any audio starts */
+    static void initialise();
+    /** Called by the wrappers, records the violation if the thread is in a realtime section */
+    static void record(Violation type);
+    /** Returns true if the calling thread is currently in a realtime section */
+    static bool isInRealtimeSection();
+    /** Counts of everything recorded since the last clear, followed by each distinct stack trace */
+    static String report();
+    /** Forgets everything recorded so far */
+    static void clear();
+#else
+    static void initialise() {}
+    static String report() { return String::empty; }
+    static void clear() {}
+#endif
+};
+
+#endif /* defined(__SwivelAutotune__RealtimeChecker__) */
@@ -0,0 +1,435 @@
+//
+//  SimMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  Runs a full calibration against the simulated rig and reports how long it took and how close
+//  each string came to the pitch it was really plucked at. Runs faster than realtime unless told
+//  otherwise, so it's handy for profiling the whole AnalysisThread pipeline.
+//
+//      swivel-sim datafile [--fft 8192] [--overlap 2] [--window hann] [--up 0.001] [--down 0.001]
+//                          [--inputs n] [--detune cents] [--noise level] [--latency ms] [--seed n]
+//                          [--realtime] [--verbose] [--json file] [--trace file]
+//                          [--coordinator host:port] [--name name]
+//
+//  --trace saves a timeline of the run for chrome://tracing or ui.perfetto.dev
+//  --coordinator makes it one of swivel-coordinator's instances: it only calibrates the strings it's
+//  given and takes what the others found for the rest. Several of them with the same data file and
+//  seed share the same pretend strings, so they can be tried out on one machine.
+//
+
+#include <iostream>
+#include "CoreJuceHeader.h"
+#include "AnalysisThread.h"
+#include "SimulatedRig.h"
+#include "LogQueue.h"
+#include "Trace.h"
+#include "Coordination.h"
+
+namespace
+{
+    struct Options
+    {
+        File dataFile;
+        int fftSize = 8192;
+        int overlap = 2;
+        Windowing::WindowType window = Windowing::HANN;
+        double thresholdUp = 0.001;
+        double thresholdDown = 0.001;
+        int inputs = 0; // one per string
+        double detune = 5.0;
+        double noise = 0.001;
+        double latency = 0.0;
+        int64 seed = 1;
+        bool realtime = false;
+        bool verbose = false;
+        File json;
+        File trace;
+        String coordinator; // empty for none
+        String name = SystemStats::getComputerName();
+    };
+
+    Result parseOptions(const StringArray& args, Options& options)
+    {
+        if (args.size() == 0 || args[0].startsWith("--"))
+            return Result::fail("Usage: swivel-sim datafile [options], see SimMain.cpp");
+        options.dataFile = File::getCurrentWorkingDirectory().getChildFile(args[0]);
+
+        for (int i = 1; i < args.size(); i++)
+        {
+            const String& arg = args[i];
+            if (arg == "--realtime")
+                options.realtime = true;
+            else if (arg == "--verbose")
+                options.verbose = true;
+            else if (i + 1 >= args.size())
+                return Result::fail("Missing value for " + arg);
+            else
+            {
+                const String value = args[++i];
+                if (arg == "--fft")
+                    options.fftSize = value.getIntValue();
+                else if (arg == "--overlap")
+                    options.overlap = value.getIntValue();
+                else if (arg == "--window")
+                {
+                    if (value == "hann")             options.window = Windowing::HANN;
+                    else if (value == "hamming")     options.window = Windowing::HAMMING;
+                    else if (value == "blackman")    options.window = Windowing::BLACKMAN;
+                    else if (value == "rectangular") options.window = Windowing::RECTANGULAR;
+                    else return Result::fail("Unknown window: " + value);
+                }
+                else if (arg == "--up")
+                    options.thresholdUp = value.getDoubleValue();
+                else if (arg == "--down")
+                    options.thresholdDown = value.getDoubleValue();
+                else if (arg == "--inputs")
+                    options.inputs = value.getIntValue();
+                else if (arg == "--detune")
+                    options.detune = value.getDoubleValue();
+                else if (arg == "--noise")
+                    options.noise = value.getDoubleValue();
+                else if (arg == "--latency")
+                    options.latency = value.getDoubleValue();
+                else if (arg == "--seed")
+                    options.seed = value.getLargeIntValue();
+                else if (arg == "--json")
+                    options.json = File::getCurrentWorkingDirectory().getChildFile(value);
+                else if (arg == "--trace")
+                    options.trace = File::getCurrentWorkingDirectory().getChildFile(value);
+                else if (arg == "--coordinator")
+                    options.coordinator = value;
+                else if (arg == "--name")
+                    options.name = value;
+                else
+                    return Result::fail("Unknown option: " + arg);
+            }
+        }
+
+        if (options.fftSize <= 0 || !isPowerOfTwo(options.fftSize))
+            return Result::fail("--fft should be a power of two");
+        if (options.overlap < 1 || options.overlap > 4)
+            return Result::fail("--overlap should be 1-4");
+        return Result::ok();
+    }
+
+    /** The controller of the last message, which is the one that plucks */
+    int findExcitationController(const MidiBuffer& buffer)
+    {
+        MidiBuffer::Iterator it(buffer);
+        MidiMessage message;
+        int position;
+        int controller = 7;
+        while (it.getNextEvent(message, position))
+            if (message.isController())
+                controller = message.getControllerNumber();
+        return controller;
+    }
+}
+
+//==============================================================================================
+class SimulationRunner : public  AnalysisThread::Listener,
+                         public  CoordinatorClient::Listener,
+                         public  LogQueue::Target
+{
+public:
+    SimulationRunner(const Options& o)
+    :   options(o),
+        exitCode(0),
+        startedAt(0)
+    {
+        logQueue.setTarget(this);
+    }
+
+    ~SimulationRunner()
+    {
+        if (analysisThread != nullptr)
+            analysisThread->stopThread(15000);
+        deviceManager.closeAudioDevice();
+        logQueue.drain();
+    }
+
+    Result start()
+    {
+        Result result = loadStrings();
+        if (result)
+            result = openAudio();
+        if (!result)
+            return result;
+
+        analysisThread = new AnalysisThread(&deviceManager, rig, &swivelStrings, this);
+        analysisThread->setLog(&logQueue);
+        analysisThread->setLatencyProfile(&latencies);
+        analysisThread->setProcessingParams(options.fftSize, options.overlap, options.thresholdUp, options.thresholdDown, options.window);
+
+        // the coordinator says when, and which
+        if (options.coordinator.isNotEmpty())
+        {
+            coordinator = new CoordinatorClient(options.name, &swivelStrings, this);
+            coordinator->setLog(&logQueue);
+            return coordinator->connect(options.coordinator);
+        }
+
+        startAnalysis();
+        return Result::ok();
+    }
+
+    int getExitCode() const { return exitCode; }
+
+    //==========================================================================================
+    void analysisFinished(Result result) override
+    {
+        analysisThread->stopThread(100);
+        const double elapsed = (Time::getMillisecondCounterHiRes() - startedAt) / 1000.0;
+        logQueue.drain();
+
+        if (Trace::isRecording())
+        {
+            Trace::stop();
+            const Result written = Trace::writeJson(options.trace);
+            if (!written)
+                std::cerr << written.getErrorMessage() << std::endl;
+        }
+
+        if (!result)
+        {
+            std::cerr << result.getErrorMessage() << std::endl;
+            exitCode = 1;
+        }
+        else
+            report(elapsed);
+
+        if (coordinator != nullptr)
+            coordinator->calibrationFinished(result, elapsed);
+        else
+            MessageManager::getInstance()->stopDispatchLoop();
+    }
+
+    void calibrationRequested(const Array<SwivelString*>& strings) override
+    {
+        if (strings.size() == 0)
+            coordinator->calibrationFinished(Result::ok(), 0.0);
+        else
+        {
+            assigned = strings;
+            analysisThread->setStringsToCalibrate(strings);
+            startAnalysis();
+        }
+    }
+
+    void coordinationFinished(Result result) override
+    {
+        logQueue.drain();
+        if (!result)
+        {
+            std::cerr << result.getErrorMessage() << std::endl;
+            exitCode = 1;
+        }
+        else
+        {
+            // the ones the others did as well now, so it's every string's error against this rig
+            for (SwivelString* string : swivelStrings)
+                std::cout << "String on channel: " << string->getMidiChannel() << " is at " << string->getBestFreq() << "Hz"
+                          << (string->isReadyToTransform() ? "" : " (not ready)") << std::endl;
+        }
+        MessageManager::getInstance()->stopDispatchLoop();
+    }
+
+    void addText(const String& text, LogQueue::Level level) override
+    {
+        if (level >= LogQueue::warning)
+            std::cerr << text << std::flush;
+        else if (options.verbose)
+            std::cout << text << std::flush;
+    }
+
+private:
+    const Options& options;
+
+    ScopedPointer<SimulatedRig> rig;
+    AudioDeviceManager deviceManager;
+    OwnedArray<SwivelString, CriticalSection> swivelStrings;
+    OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+    LogQueue logQueue;
+    LatencyProfile latencies;
+    ScopedPointer<AnalysisThread> analysisThread;
+    ScopedPointer<CoordinatorClient> coordinator;
+    Array<SwivelString*> assigned;
+    int exitCode;
+    double startedAt;
+
+    void startAnalysis()
+    {
+        if (options.trace != File::nonexistent)
+            Trace::start();
+        startedAt = Time::getMillisecondCounterHiRes();
+        analysisThread->startThread(0);
+    }
+
+    //==========================================================================================
+    Result loadStrings()
+    {
+        try
+        {
+            ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(options.dataFile);
+            if (data == nullptr)
+                return Result::fail("Couldn't open " + options.dataFile.getFullPathName());
+            bundles.addArray(*data);
+        }
+        catch (SwivelStringFileParser::ParseException const &e)
+        {
+            return Result::fail(String("Parse Error: ") + e.what());
+        }
+
+        if (bundles.size() == 0)
+            return Result::fail("No strings in " + options.dataFile.getFullPathName());
+
+        const int inputs = options.inputs > 0 ? options.inputs : bundles.size();
+        rig = new SimulatedRig(inputs, 44100.0, options.seed);
+        rig->setNoiseLevel(options.noise);
+        rig->setFasterThanRealtime(!options.realtime);
+        Random random(options.seed);
+
+        for (int i = 0; i < bundles.size(); i++)
+        {
+            SwivelStringFileParser::StringDataBundle* bundle = bundles[i];
+
+            // somewhere inside the measurements, or there's nothing to interpolate between
+            double lowest = bundle->fundamentals->getFirst(), highest = lowest;
+            for (int f = 0; f < bundle->fundamentals->size(); f++)
+            {
+                lowest = jmin(lowest, (*bundle->fundamentals)[f]);
+                highest = jmax(highest, (*bundle->fundamentals)[f]);
+            }
+
+            SimulatedRig::StringModel model;
+            model.audioChannel = i % inputs;
+            model.openFrequency = lowest + (highest - lowest) * (0.1 + 0.8 * random.nextDouble());
+            model.detune = options.detune;
+            model.latency = options.latency;
+            model.excitationController = findExcitationController(*bundle->midiBuffer);
+
+            SwivelString* string = new SwivelString();
+            swivelStrings.add(string);
+            string->initialiseFromBundle(bundle); // takes the data out of the bundle
+            string->setAudioChannel(model.audioChannel);
+
+            model.midiChannel = string->getMidiChannel();
+            model.midiPort = string->getMidiPort();
+            rig->addString(model);
+        }
+        return Result::ok();
+    }
+
+    Result openAudio()
+    {
+        // added before the manager makes its own types, so it's the only one
+        deviceManager.addAudioDeviceType(new SimulatedAudioIODeviceType(*rig));
+        deviceManager.setCurrentAudioDeviceType("Simulated", true);
+
+        AudioDeviceManager::AudioDeviceSetup setup;
+        setup.inputDeviceName = SimulatedAudioIODeviceType::deviceName;
+        setup.sampleRate = rig->getSampleRate();
+        setup.bufferSize = 512;
+        setup.useDefaultInputChannels = false;
+        setup.inputChannels.setRange(0, rig->getNumInputs(), true);
+
+        String error = deviceManager.initialise(rig->getNumInputs(), 0, nullptr, false, String::empty, &setup);
+        if (error.isNotEmpty() || deviceManager.getCurrentAudioDevice() == nullptr)
+            return Result::fail("Couldn't open the simulated rig: " + error);
+        return Result::ok();
+    }
+
+    void report(double elapsed)
+    {
+        const double simulated = rig->getSecondsRendered();
+        Array<var> results;
+        double worst = 0;
+
+        // only the ones calibrated here, with a coordinator the others aren't plucked
+        for (SwivelString* string : swivelStrings)
+        {
+            if (coordinator != nullptr && !assigned.contains(string))
+                continue;
+            const double actual = rig->getPluckedFrequency(string->getMidiPort(), string->getMidiChannel());
+            const double found = string->getBestFreq();
+            const bool ready = string->isReadyToTransform();
+            const double latency = latencies.getExpectedLatency(string->getMidiPort(), string->getMidiChannel());
+            const double error = ready && actual > 0 ? 1200.0 * std::log2(found / actual) : 0.0;
+            if (ready)
+                worst = jmax(worst, std::fabs(error));
+
+            std::cout << "String on channel: " << string->getMidiChannel()
+                      << " plucked at " << actual << "Hz, found " << found << "Hz"
+                      << (ready ? " (" + String(error, 2) + " cents)" : String(" (not ready)"))
+                      << ", latency " << String(latency, 1) << "ms" << std::endl;
+
+            DynamicObject* entry = new DynamicObject();
+            entry->setProperty("midi_channel", string->getMidiChannel());
+            entry->setProperty("midi_port", string->getMidiPort());
+            entry->setProperty("plucked", actual);
+            entry->setProperty("found", found);
+            entry->setProperty("ready", ready);
+            entry->setProperty("error_cents", error);
+            entry->setProperty("latency_ms", latency);
+            results.add(var(entry));
+        }
+
+        std::cout << "Calibrated " << results.size() << " strings: " << simulated << "s of audio in "
+                  << elapsed << "s (" << (elapsed > 0 ? simulated / elapsed : 0.0) << "x realtime), worst error "
+                  << worst << " cents" << std::endl;
+
+        if (options.json != File::nonexistent)
+        {
+            DynamicObject* root = new DynamicObject();
+            root->setProperty("fft_size", options.fftSize);
+            root->setProperty("overlap", options.overlap);
+            root->setProperty("seconds_elapsed", elapsed);
+            root->setProperty("seconds_simulated", simulated);
+            root->setProperty("worst_error_cents", worst);
+            root->setProperty("strings", results);
+            options.json.replaceWithText(JSON::toString(var(root)));
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (SimulationRunner)
+};
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add(argv[i]);
+
+    Options options;
+    Result parsed = parseOptions(args, options);
+    if (!parsed)
+    {
+        std::cerr << parsed.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    MessageManager::getInstance()->setCurrentThreadAsMessageThread();
+
+    int exitCode = 0;
+    {
+        SimulationRunner runner(options);
+        Result started = runner.start();
+        if (started)
+        {
+            MessageManager::getInstance()->runDispatchLoop();
+            exitCode = runner.getExitCode();
+        }
+        else
+        {
+            std::cerr << started.getErrorMessage() << std::endl;
+            exitCode = 1;
+        }
+    }
+
+    DeletedAtShutdown::deleteAll();
+    MessageManager::deleteInstance();
+    return exitCode;
+}
@@ -0,0 +1,469 @@
+//
+//  SimulatedRig.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "SimulatedRig.h"
+
+SimulatedRig::StringModel::StringModel()
+:   midiChannel(1),
+    midiPort(0),
+    audioChannel(0),
+    openFrequency(110.0),
+    bendRange(24.0),
+    detune(0.0),
+    decay(1.0),
+    excitationController(7),
+    latency(0.0)
+{
+
+}
+
+//==============================================================================================
+SimulatedRig::SimulatedRig(int inputs, double sr, int64 seed)
+:   numInputs(inputs),
+    sampleRate(sr),
+    noiseLevel(0.0),
+    random(seed),
+    position(0),
+    numPorts(1),
+    fasterThanRealtime(true),
+    deviceRunning(false),
+    wakeAt(-1)
+{
+
+}
+
+SimulatedRig::~SimulatedRig()
+{
+
+}
+
+void SimulatedRig::addString(const StringModel& model)
+{
+    SimulatedString* string = new SimulatedString();
+    string->model = model;
+    numPorts = jmax(numPorts, model.midiPort + 1);
+    string->bend = 16383; // open
+    string->detuneRatio = 1.0;
+    string->pluckedFrequency = 0.0;
+    string->pluckAt = -1;
+    string->pluckVelocity = 0.0f;
+    for (int p = 0; p < SimulatedString::numPartials; p++)
+    {
+        string->phases[p] = 0.0;
+        string->envelopes[p] = 0.0;
+    }
+    strings.add(string);
+}
+
+void SimulatedRig::setNoiseLevel(double level)
+{
+    noiseLevel = level;
+}
+
+void SimulatedRig::setFasterThanRealtime(bool shouldBeFaster)
+{
+    fasterThanRealtime = shouldBeFaster;
+}
+
+bool SimulatedRig::isFasterThanRealtime() const
+{
+    return fasterThanRealtime;
+}
+
+int SimulatedRig::getNumInputs() const
+{
+    return numInputs;
+}
+
+double SimulatedRig::getSampleRate() const
+{
+    return sampleRate;
+}
+
+double SimulatedRig::getPluckedFrequency(int midiPort, int midiChannel) const
+{
+    for (SimulatedString* string : strings)
+        if (string->model.midiPort == midiPort && string->model.midiChannel == midiChannel)
+            return string->pluckedFrequency;
+    return 0.0;
+}
+
+double SimulatedRig::getSecondsRendered() const
+{
+    return position / sampleRate;
+}
+
+//==============================================================================================
+uint32 SimulatedRig::getMillisecondCounter()
+{
+    return (uint32) (position * 1000 / (int64) sampleRate);
+}
+
+void SimulatedRig::waitFor(Thread& thread, int milliseconds)
+{
+    const int64 until = position + (int64) (milliseconds * sampleRate / 1000.0);
+
+    if (!fasterThanRealtime)
+    {
+        thread.wait(milliseconds);
+        return;
+    }
+
+    // nothing to render the time away, so it just passes
+    if (!deviceRunning)
+    {
+        position = jmax(position.load(), until);
+        return;
+    }
+
+    wakeAt = until;
+    demand.signal();
+    while (!woken.wait(50))
+    {
+        if (thread.threadShouldExit() || !deviceRunning)
+            break;
+    }
+    wakeAt = -1;
+}
+
+int SimulatedRig::getNumPorts()
+{
+    return numPorts;
+}
+
+void SimulatedRig::sendBlockOfMessages(int port, const MidiBuffer& buffer, double millisecondCounterToStartAt, double samplesPerSecondForBuffer)
+{
+    const ScopedLock sl(midiLock);
+
+    MidiBuffer::Iterator it(buffer);
+    MidiMessage message;
+    int samplePosition;
+    while (it.getNextEvent(message, samplePosition))
+    {
+        double ms = millisecondCounterToStartAt + 1000.0 * samplePosition / samplesPerSecondForBuffer;
+        pending.insert(std::make_pair((int64) (ms * sampleRate / 1000.0), std::make_pair(port, message)));
+    }
+}
+
+//==============================================================================================
+bool SimulatedRig::waitUntilNeeded(Thread& deviceThread)
+{
+    if (!fasterThanRealtime)
+        return !deviceThread.threadShouldExit();
+
+    // only render when somebody is waiting for time to pass
+    while (wakeAt < 0 || position >= wakeAt)
+    {
+        if (deviceThread.threadShouldExit())
+            return false;
+        demand.wait(10);
+    }
+    return true;
+}
+
+void SimulatedRig::render(float** channels, int numChannels, int numSamples)
+{
+    const int64 start = position;
+    const int64 end = start + numSamples;
+
+    for (int c = 0; c < numChannels; c++)
+        if (channels[c] != nullptr)
+            FloatVectorOperations::clear(channels[c], numSamples);
+
+    // MIDI lands at the start of the block it's due in, close enough
+    {
+        const ScopedLock sl(midiLock);
+        while (!pending.empty() && pending.begin()->first < end)
+        {
+            handleMessage(pending.begin()->second.first, pending.begin()->second.second, pending.begin()->first);
+            pending.erase(pending.begin());
+        }
+    }
+
+    for (SimulatedString* string : strings)
+    {
+        if (string->pluckAt >= 0 && string->pluckAt < end)
+        {
+            pluck(*string, string->pluckVelocity);
+            string->pluckAt = -1;
+        }
+    }
+
+    for (SimulatedString* string : strings)
+    {
+        const int c = string->model.audioChannel;
+        if (c >= numChannels || channels[c] == nullptr || string->envelopes[0] < 1.0e-6)
+            continue;
+
+        const double frequency = frequencyOf(*string);
+        float* out = channels[c];
+        for (int p = 0; p < SimulatedString::numPartials; p++)
+        {
+            const double increment = 2.0 * M_PI * frequency * (p+1) / sampleRate;
+            if (increment >= M_PI) // above nyquist
+                break;
+            const double falloff = std::exp(-string->model.decay * (p+1) / sampleRate);
+            double phase = string->phases[p];
+            double envelope = string->envelopes[p];
+            for (int i = 0; i < numSamples; i++)
+            {
+                out[i] += (float) (envelope * std::sin(phase));
+                phase += increment;
+                envelope *= falloff;
+            }
+            string->phases[p] = std::fmod(phase, 2.0 * M_PI);
+            string->envelopes[p] = envelope;
+        }
+    }
+
+    if (noiseLevel > 0)
+        for (int c = 0; c < numChannels; c++)
+            if (channels[c] != nullptr)
+                for (int i = 0; i < numSamples; i++)
+                    channels[c][i] += (float) (noiseLevel * (2.0 * random.nextDouble() - 1.0));
+
+    position = end;
+
+    if (wakeAt >= 0 && position >= wakeAt)
+    {
+        wakeAt = -1;
+        woken.signal();
+    }
+}
+
+void SimulatedRig::setDeviceRunning(bool isRunning)
+{
+    deviceRunning = isRunning;
+    if (!isRunning)
+        woken.signal(); // don't leave anybody waiting on a clock that has stopped
+}
+
+//==============================================================================================
+void SimulatedRig::handleMessage(int port, const MidiMessage& message, int64 samplePosition)
+{
+    for (SimulatedString* string : strings)
+    {
+        if (string->model.midiPort != port || string->model.midiChannel != message.getChannel())
+            continue;
+
+        if (message.isPitchWheel())
+            string->bend = message.getPitchWheelValue();
+        else if (message.isController()
+                 && message.getControllerNumber() == string->model.excitationController
+                 && message.getControllerValue() > 0)
+        {
+            // sounds when the rest of the block does, once the latency is up
+            string->pluckAt = samplePosition + (int64) (string->model.latency * sampleRate / 1000.0);
+            string->pluckVelocity = message.getControllerValue() / 127.0f;
+        }
+    }
+}
+
+void SimulatedRig::pluck(SimulatedString& string, float velocity)
+{
+    const double cents = (2.0 * random.nextDouble() - 1.0) * string.model.detune;
+    string.detuneRatio = std::pow(2.0, cents / 1200.0);
+    string.pluckedFrequency = frequencyOf(string);
+
+    for (int p = 0; p < SimulatedString::numPartials; p++)
+    {
+        string.phases[p] = 0.0;
+        string.envelopes[p] = 0.3 * velocity / (p+1);
+    }
+}
+
+double SimulatedRig::frequencyOf(const SimulatedString& string) const
+{
+    const double semitones = string.model.bendRange * (16383 - string.bend) / 16383.0;
+    return string.model.openFrequency * string.detuneRatio * std::pow(2.0, semitones / 12.0);
+}
+
+//==============================================================================================
+/** Renders the rig on its own thread, either in lockstep or paced to the wall clock */
+class SimulatedAudioIODevice : public AudioIODevice,
+                               private Thread
+{
+public:
+    SimulatedAudioIODevice(SimulatedRig& r)
+    :   AudioIODevice(SimulatedAudioIODeviceType::deviceName, "Simulated"),
+        Thread("Simulated Rig"),
+        rig(r),
+        bufferSize(512),
+        deviceOpen(false),
+        callback(nullptr)
+    {
+
+    }
+
+    ~SimulatedAudioIODevice()
+    {
+        close();
+    }
+
+    StringArray getOutputChannelNames() override { return StringArray(); }
+
+    StringArray getInputChannelNames() override
+    {
+        StringArray names;
+        for (int i = 0; i < rig.getNumInputs(); i++)
+            names.add("String " + String(i+1));
+        return names;
+    }
+
+    int getNumSampleRates() override                { return 1; }
+    double getSampleRate(int) override              { return rig.getSampleRate(); }
+    int getNumBufferSizesAvailable() override       { return numElementsInArray(bufferSizes); }
+    int getBufferSizeSamples(int index) override    { return bufferSizes[index]; }
+    int getDefaultBufferSize() override             { return 512; }
+
+    String open(const BigInteger& inputChannels, const BigInteger&, double, int bufferSizeSamples) override
+    {
+        close();
+        activeInputs = inputChannels;
+        activeInputs.setRange(rig.getNumInputs(), activeInputs.getHighestBit() + 1, false);
+        bufferSize = bufferSizeSamples > 0 ? bufferSizeSamples : getDefaultBufferSize();
+
+        buffer.setSize(rig.getNumInputs(), bufferSize);
+        deviceOpen = true;
+        rig.setDeviceRunning(true);
+        startThread(9);
+        return String::empty;
+    }
+
+    void close() override
+    {
+        stop();
+        signalThreadShouldExit();
+        rig.setDeviceRunning(false);
+        stopThread(2000);
+        deviceOpen = false;
+    }
+
+    bool isOpen() override                          { return deviceOpen; }
+
+    void start(AudioIODeviceCallback* newCallback) override
+    {
+        if (newCallback != nullptr)
+            newCallback->audioDeviceAboutToStart(this);
+        const ScopedLock sl(callbackLock);
+        callback = newCallback;
+    }
+
+    void stop() override
+    {
+        AudioIODeviceCallback* old;
+        {
+            const ScopedLock sl(callbackLock);
+            old = callback;
+            callback = nullptr;
+        }
+        if (old != nullptr)
+            old->audioDeviceStopped();
+    }
+
+    bool isPlaying() override                       { return callback != nullptr; }
+    String getLastError() override                  { return String::empty; }
+    int getCurrentBufferSizeSamples() override      { return bufferSize; }
+    double getCurrentSampleRate() override          { return rig.getSampleRate(); }
+    int getCurrentBitDepth() override               { return 32; }
+    BigInteger getActiveOutputChannels() const override { return BigInteger(); }
+    BigInteger getActiveInputChannels() const override  { return activeInputs; }
+    int getOutputLatencyInSamples() override        { return 0; }
+    int getInputLatencyInSamples() override         { return 0; }
+
+    //==========================================================================================
+    void run() override
+    {
+        const double blockMs = 1000.0 * bufferSize / rig.getSampleRate();
+        double due = Time::getMillisecondCounterHiRes();
+
+        // the callback only gets the active inputs, packed together like a real device does
+        HeapBlock<const float*> inputs(rig.getNumInputs());
+
+        while (rig.waitUntilNeeded(*this))
+        {
+            rig.render(buffer.getArrayOfChannels(), buffer.getNumChannels(), bufferSize);
+
+            int numActive = 0;
+            for (int i = 0; i < rig.getNumInputs(); i++)
+                if (activeInputs[i])
+                    inputs[numActive++] = buffer.getSampleData(i);
+
+            {
+                const ScopedLock sl(callbackLock);
+                if (callback != nullptr)
+                    callback->audioDeviceIOCallback(inputs, numActive, nullptr, 0, bufferSize);
+            }
+
+            if (!rig.isFasterThanRealtime())
+            {
+                due += blockMs;
+                const double now = Time::getMillisecondCounterHiRes();
+                if (due > now)
+                    wait((int) (due - now));
+                else
+                    due = now; // fell behind, don't try to catch up
+            }
+        }
+    }
+
+private:
+    SimulatedRig& rig;
+    int bufferSize;
+    bool deviceOpen;
+    BigInteger activeInputs;
+    AudioSampleBuffer buffer {1, 1};
+    CriticalSection callbackLock;
+    AudioIODeviceCallback* callback;
+
+    static constexpr int bufferSizes[] = { 64, 128, 256, 512, 1024, 2048 };
+
+    JUCE_DECLARE_NON_COPYABLE (SimulatedAudioIODevice)
+};
+
+constexpr int SimulatedAudioIODevice::bufferSizes[];
+
+//==============================================================================================
+const char* const SimulatedAudioIODeviceType::deviceName = "Swivel Rig";
+
+SimulatedAudioIODeviceType::SimulatedAudioIODeviceType(SimulatedRig& r)
+:   AudioIODeviceType("Simulated"),
+    rig(r)
+{
+
+}
+
+void SimulatedAudioIODeviceType::scanForDevices()
+{
+
+}
+
+StringArray SimulatedAudioIODeviceType::getDeviceNames(bool wantInputNames) const
+{
+    return StringArray(deviceName);
+}
+
+int SimulatedAudioIODeviceType::getDefaultDeviceIndex(bool forInput) const
+{
+    return 0;
+}
+
+int SimulatedAudioIODeviceType::getIndexOfDevice(AudioIODevice* device, bool asInput) const
+{
+    return device != nullptr && device->getName() == deviceName ? 0 : -1;
+}
+
+bool SimulatedAudioIODeviceType::hasSeparateInputsAndOutputs() const
+{
+    return false;
+}
+
+AudioIODevice* SimulatedAudioIODeviceType::createDevice(const String& outputDeviceName, const String& inputDeviceName)
+{
+    return new SimulatedAudioIODevice(rig);
+}
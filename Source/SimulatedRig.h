@@ -0,0 +1,151 @@
+//
+//  SimulatedRig.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__SimulatedRig__
+#define __SwivelAutotune__SimulatedRig__
+
+#include <atomic>
+#include <map>
+#include "CoreJuceHeader.h"
+#include "MidiScheduler.h"
+
+/** A pretend instrument, so calibration can be run (and profiled) without tying up the real one.
+
+    MIDI sent to it through the MidiScheduler interface plucks and positions the simulated strings,
+    and SimulatedAudioIODeviceType provides an audio device whose inputs are the strings' output.
+
+    The rig keeps its own clock, counted in samples rendered. When it is running faster than realtime
+    it works in lockstep with whoever calls waitFor(): the device renders exactly up to the time they
+    asked to be woken at and then waits for them to ask again, so the analysis behaves the same as it
+    would in realtime, just without the waiting.
+ */
+class SimulatedRig : public MidiScheduler
+{
+public:
+    /** How one string behaves */
+    struct StringModel
+    {
+        StringModel();
+
+        int midiChannel;
+        int midiPort;
+        int audioChannel;
+        /** Pitch with the bend at its top (16383), which is taken as the open string */
+        double openFrequency;
+        /** How many semitones the string goes up as the bend goes from the top to 0 */
+        double bendRange;
+        /** Each pluck is detuned by a random amount up to this many cents either way */
+        double detune;
+        /** How quickly the fundamental dies away (per second), higher partials go proportionally quicker */
+        double decay;
+        /** A control change on this controller with a non-zero value plucks the string */
+        int excitationController;
+        /** How long after the pluck message the string actually sounds, in ms */
+        double latency;
+    };
+
+    SimulatedRig(int numInputs = 2, double sampleRate = 44100.0, int64 seed = 1);
+    ~SimulatedRig();
+
+    void addString(const StringModel& model);
+    /** Level of the white noise added to every input */
+    void setNoiseLevel(double level);
+    /** Lockstep with the analysis as fast as possible, or paced to the wall clock */
+    void setFasterThanRealtime(bool shouldBeFaster);
+    bool isFasterThanRealtime() const;
+
+    int getNumInputs() const;
+    double getSampleRate() const;
+    /** Gets the frequency the string on the given port and channel was last plucked at, 0 if it hasn't been */
+    double getPluckedFrequency(int midiPort, int midiChannel) const;
+    /** How much audio has been rendered, in seconds */
+    double getSecondsRendered() const;
+
+    //==========================================================================================
+    uint32 getMillisecondCounter() override;
+    void waitFor(Thread& thread, int milliseconds) override;
+    /** As many ports as the strings added so far use, MIDI on any other port is ignored */
+    int getNumPorts() override;
+    void sendBlockOfMessages(int port, const MidiBuffer& buffer, double millisecondCounterToStartAt, double samplesPerSecondForBuffer) override;
+
+    //==========================================================================================
+    // for the simulated device
+    /** Called by the device's thread before each block. Returns false if the thread should stop */
+    bool waitUntilNeeded(Thread& deviceThread);
+    /** Applies any MIDI that is due, makes the next block of audio and moves the clock on */
+    void render(float** channels, int numChannels, int numSamples);
+    void setDeviceRunning(bool isRunning);
+
+private:
+    struct SimulatedString
+    {
+        StringModel model;
+        int bend;
+        double detuneRatio;
+        double pluckedFrequency;
+        // a pluck on its way, -1 if there isn't one
+        int64 pluckAt;
+        float pluckVelocity;
+        // the first few partials, each with its own envelope
+        static const int numPartials = 6;
+        double phases[numPartials];
+        double envelopes[numPartials];
+    };
+
+    OwnedArray<SimulatedString> strings;
+    const int numInputs;
+    const double sampleRate;
+    double noiseLevel;
+    Random random;
+
+    // the clock, in samples
+    std::atomic<int64> position;
+
+    // MIDI waiting to happen, with the port it was sent to, by sample position
+    CriticalSection midiLock;
+    std::multimap<int64, std::pair<int, MidiMessage>> pending;
+    int numPorts;
+
+    // lockstep between the device and the thread waiting on the clock
+    std::atomic<bool> fasterThanRealtime;
+    std::atomic<bool> deviceRunning;
+    std::atomic<int64> wakeAt; // -1 when nobody is waiting
+    WaitableEvent demand;
+    WaitableEvent woken;
+
+    void handleMessage(int port, const MidiMessage& message, int64 samplePosition);
+    void pluck(SimulatedString& string, float velocity);
+    double frequencyOf(const SimulatedString& string) const;
+
+    JUCE_DECLARE_NON_COPYABLE (SimulatedRig)
+};
+
+//==============================================================================================
+/** An audio device type with one device, "Swivel Rig", whose inputs are the rig's strings */
+class SimulatedAudioIODeviceType : public AudioIODeviceType
+{
+public:
+    /** The rig has to outlive anything made by this */
+    SimulatedAudioIODeviceType(SimulatedRig& rig);
+
+    void scanForDevices() override;
+    StringArray getDeviceNames(bool wantInputNames) const override;
+    int getDefaultDeviceIndex(bool forInput) const override;
+    int getIndexOfDevice(AudioIODevice* device, bool asInput) const override;
+    bool hasSeparateInputsAndOutputs() const override;
+    AudioIODevice* createDevice(const String& outputDeviceName, const String& inputDeviceName) override;
+
+    static const char* const deviceName;
+
+private:
+    SimulatedRig& rig;
+
+    JUCE_DECLARE_NON_COPYABLE (SimulatedAudioIODeviceType)
+};
+
+#endif /* defined(__SwivelAutotune__SimulatedRig__) */
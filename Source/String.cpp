@@ -7,10 +7,10 @@
 //
 
 #include "String.h"
-#include "Windowing.h"
-#include <Accelerate/Accelerate.h>
-#include "MainComponent.h"
 #include "ElementComparator.h"
+#include "RealtimeChecker.h"
+#include "Trace.h"
+#include "Levels.h"
 
 //===========================================================
 // Constructs a new string.
@@ -20,13 +20,18 @@
 // or awkwardness might ensue.
 // This shouldn't be a problem given if more than one string is grabbing the audio,
 // there are probably some other serious issues
-SwivelString::SwivelString() : channel(0)
+SwivelString::SwivelString() : channel(0), port(0), audioChannel(0)
 {
     bundleInit = false;
     audioInit = false;
     processing = false;
     gate = false;
+    finished = false;
+    input_index = 0;
     lastphase = 0;
+    delay = 0;
+    prepTime = 0;
+    windowType = Windowing::HANN;
     determined_pitch = std::numeric_limits<double>::signaling_NaN();
 }
 
@@ -47,6 +52,7 @@ void SwivelString::initialiseFromBundle(SwivelStringFileParser::StringDataBundle
     measurements = bundle->measured_data;
     midiData = bundle->midiBuffer; // for now we hope the sample rates match up
     this->num = bundle->num;
+    port = bundle->port;
     
     // figure out channel from the first MIDI message
     MidiBuffer::Iterator it(*midiData);
@@ -61,7 +67,7 @@ void SwivelString::initialiseFromBundle(SwivelStringFileParser::StringDataBundle
         finalInit();
 }
 // initialises audio requirements
-void SwivelString::initialiseAudioParameters(fftw_plan p, double *in, fftw_complex *out, int fft_size, double sr, int ol, double upT, double downT)
+void SwivelString::initialiseAudioParameters(fftw_plan p, double *in, fftw_complex *out, int fft_size, double sr, int ol, double upT, double downT, Windowing::WindowType w)
 {
     fft_plan = p;
     input = in;
@@ -81,6 +87,11 @@ void SwivelString::initialiseAudioParameters(fftw_plan p, double *in, fftw_compl
     
     rmsUp = upT;
     rmsDown = downT;
+    windowType = w;
+    
+    // the callback adds to these, make sure it never has to grow them
+    freqs.ensureStorageAllocated(maxEstimates);
+    peaks.ensureStorageAllocated(fft_size/2);
     
     audioInit = true;
     
@@ -113,14 +124,30 @@ void SwivelString::finalInit()
     int time=0;
     int num=0;
     int cap = midiData->getNumEvents();
+    preparation.clear();
+    excitation.clear();
     while (i.getNextEvent(msg, samplePos))
     {
         num++;
         if (num != cap)
+        {
             time = samplePos; // count up all the messages except the last
+            preparation.addEvent(msg, samplePos);
+        }
+        else
+        {
+            // the last one is what makes the noise, keep it separately so the analysis thread
+            // can send everything else early
+            excitation.addEvent(msg, 0);
+            prepTime = samplePos / 44.1;
+        }
     }
     // now we are here, convert to ms
     delay = time / 44.1;
+    
+    // the windows are cached the first time they are used, get that allocation done now
+    // rather than in the audio callback (input_buffer is only scratch at this point)
+    window(input_buffer, fft_size);
 }
 
 //============================================================
@@ -130,73 +157,59 @@ void SwivelString::audioDeviceIOCallback(const float **inputChannelData,
                                          int numOutputChannels,
                                          int numSamples)
 {
-    if (audioChannel >= numInputChannels)
-        throw std::out_of_range("asked to process on non-existent channel");
+    // nothing in here may allocate, lock, block or throw
+    RealtimeChecker::ScopedRealtimeSection realtime;
+    
+    if (finished) // done, just waiting to be removed
+        return;
+    if (audioChannel >= numInputChannels) // the analysis thread checks this before adding us
+        return;
     // we are only interested if there is a bit of sound
-    float RMS =0;
-    vDSP_rmsqv(inputChannelData[audioChannel], 1, &RMS, numSamples);
-    //std::cout << RMS <<std::endl;
+    float RMS = Levels::rms(inputChannelData[audioChannel], numSamples);
     if (RMS >= rmsUp && gate == false)
     {
         processing = true;
         gate = true;
-        std::cout << "bang" <<std::endl;
     }
-    if (freqs.size() >= 20 || (RMS <= rmsDown && gate == true))
+    if (RMS <= rmsDown && gate == true)
     {
-        processing = false;
-        gate = false;
-        std::cout << "off" <<std::endl;
-        
-        // make table -- this could be in a background thread, meaning we could start the next one a bit sooner
-        // although while this is a lot of code, it isn't really that much heavy lifting
-        processFrequencies();
-        
-        analysisThreadRef->notify(); // let's get out of here
+        stopListening();
+        return;
     }
     
     if (processing)
+        processSamples(inputChannelData[audioChannel], numSamples);
+}
+
+void SwivelString::processSamples(const float* samples, int numSamples)
+{
+    RealtimeChecker::ScopedRealtimeSection realtime;
+    
+    if (finished)
+        return;
+    
+    // buffer audio up to the size of the fft, do the fft and analyse, then roll across one hop
+    // and carry on. Blocks don't have to line up with the hops, and can hold more than one
+    for (int done = 0; done < numSamples;)
     {
-        
-        // will need to:
-        //          buffer audio to size of fft
-        //
-        //          perform fft
-        //          analyse
-        static int input_index = 0;
-        static int remaining = 0;
-        // a number of cases here
-        // 1) the buffer has remaining space >= numSamples
-        //          just copy it in
-        // 2) the buffer has some remaining space < numSamples
-        //          copy part of it in, process, copy the rest in to the front
-        if ((fft_size) - input_index >= numSamples)
-        {
-            /* for (int i =0; i < numSamples; i++)
-             {
-             input_buffer[input_index+i] = inputChannelData[0][i];
-             }*/
-            // convert to double
-            vDSP_vspdp(inputChannelData[audioChannel], 1,       // input, stride
-                       input_buffer+input_index, 1,  // output, stride
-                       numSamples);                  // size
-            input_index += numSamples;
-            remaining = 0;
-        }
-        else if (input_index < fft_size-1)
+        if (freqs.size() >= maxEstimates)
         {
-            int i;
-            for (i = 0; i+input_index < fft_size; i++)
-            {
-                input_buffer[input_index+i] = inputChannelData[0][i];
-            }
-            remaining = i;
-            input_index += remaining;
+            stopListening();
+            return;
         }
+        
+        const int length = std::min(numSamples - done, fft_size - input_index);
+        // convert to double
+        for (int i = 0; i < length; i++)
+            input_buffer[input_index+i] = samples[done+i];
+        input_index += length;
+        done += length;
+        
         // do fft & process
         // copy into actual fft buffer and window
         if (input_index == fft_size)
         {
+            Trace::ScopedEvent event("fft frame");
             // could possibly do with a filter
             memcpy(input, input_buffer, fft_size*sizeof(double));
             window(input, fft_size);
@@ -219,24 +232,21 @@ void SwivelString::audioDeviceIOCallback(const float **inputChannelData,
                     peaks.add(i+1);
                 }
             }
-            
+        
             int best_peak = 0;
             for (int i = 0; i < peaks.size(); i++)
                 if (magnitudes[peaks[i]] > magnitudes[peaks[best_peak]])
                     best_peak = i;
-            
+        
             fftw_complex best = {output[peaks[best_peak]][0], output[peaks[best_peak]][1]};
             phase = atan2(best[1], best[0]);
             if (lastphase != 0)
             {
                 freqs.add(preciseBinToFreq(peaks[best_peak], lastphase-phase));
-#ifdef DEBUG
-                std::cout << freqs.getLast() << std::endl;
-#endif
             }
-            
-            
-            
+        
+        
+        
             lastphase = phase;
             // shift buffer across by the hop size
             // set index to the new end of the buffer
@@ -244,21 +254,19 @@ void SwivelString::audioDeviceIOCallback(const float **inputChannelData,
             // memmove is like memcpy but is safe with overlapping regions
             memmove(input_buffer, input_buffer+hop_size, sizeof(double)*(fft_size-hop_size)); // roll across one hop
             input_index = fft_size-hop_size;
-            
-        }
-        
-        if (remaining != 0)
-        {
-            input_index=0;
-            for (int i = remaining; i < numSamples; i++)
-            {
-                input_buffer[input_index++] = inputChannelData[0][i];
-            }
-            remaining = 0;
         }
     }
 }
 
+void SwivelString::stopListening()
+{
+    processing = false;
+    gate = false;
+    // the table gets made by the analysis thread's worker, which polls for this,
+    // so the next string can start straight away
+    finished = true;
+}
+
 void SwivelString::audioDeviceAboutToStart(juce::AudioIODevice *device)
 {
     // nothing I can think of immediately
@@ -273,7 +281,12 @@ void SwivelString::audioDeviceStopped()
 // populate final lookup table
 void SwivelString::processFrequencies()
 {
-    determined_pitch = calculateBestFrequency();
+    setOpenFrequency(calculateBestFrequency());
+}
+
+void SwivelString::setOpenFrequency(double frequency)
+{
+    determined_pitch = frequency;
     // now that we have the pitch of the string we can start doing some interpolation
     // first step is to figure out where our newly determined fundamental fits within our measured data
     int above = -1;
@@ -301,12 +314,12 @@ void SwivelString::processFrequencies()
         }
     }
     
+    bend_curve.clear();
     if (above == -1 || below == -1)
     {
         // issue, throw exception or return?
         // probably return
         std::cerr << "String frequency outside range of data" << std::endl;
-        analysisThreadRef->notify();
         return;
     }
     
@@ -344,6 +357,7 @@ void SwivelString::processFrequencies()
     // TODO how to extrapolate?
     // TODO something better than linear interpolation for steps along the string
     fillLookupTable(derived_data);
+    bend_curve.swapWithArray(derived_data);
     
     /*for (int i = num; i < num+24; i++)
      {
@@ -359,6 +373,9 @@ void SwivelString::processFrequencies()
 
 double SwivelString::calculateBestFrequency()
 {
+    if (freqs.size() == 0)
+        return 0.0;
+    
     
     //probably an unnecessarily intimidating way to do this, but lambdas are fun
     auto compare =
@@ -525,24 +542,7 @@ int SwivelString::freqToBin(double freq)
 
 void SwivelString::window(double *input, int size)
 {
-    switch (windowType)
-    {
-        case MainComponent::WindowType::HANN:
-            Windowing::hann(input, size);
-            break;
-            
-        case MainComponent::WindowType::HAMMING:
-            Windowing::hamming(input, size);
-            break;
-            
-        case MainComponent::WindowType::BLACKMAN:
-            Windowing::blkman(input, size);
-            break;
-            
-        case MainComponent::WindowType::RECTANGULAR: // rectangular is no windowing
-        default: // default is no windowing
-            break;
-    }
+    Windowing::apply(windowType, input, size);
 }
 
 // returns the difference between the two in cents
@@ -557,6 +557,21 @@ const MidiBuffer* SwivelString::getMidiBuffer() const
     return midiData.get(); // return it without messing with the scope and whatnot
 }
 
+const MidiBuffer* SwivelString::getPreparationBuffer() const
+{
+    return &preparation;
+}
+
+const MidiBuffer* SwivelString::getExcitationBuffer() const
+{
+    return &excitation;
+}
+
+double SwivelString::getPreparationTime() const
+{
+    return prepTime;
+}
+
 void SwivelString::setAnalysisThread(juce::Thread *thread)
 {
     analysisThreadRef = thread;
@@ -567,6 +582,16 @@ bool SwivelString::isFullyInitialised() const
     return bundleInit && audioInit;
 }
 
+int SwivelString::getNumEstimates() const
+{
+    return freqs.size();
+}
+
+bool SwivelString::hasFinishedListening() const
+{
+    return finished;
+}
+
 double SwivelString::getWaitTime() const
 {
     return delay;
@@ -577,6 +602,41 @@ int SwivelString::getMidiChannel() const
     return channel;
 }
 
+int SwivelString::getMidiPort() const
+{
+    return port;
+}
+
+int SwivelString::getFirstNote() const
+{
+    return num;
+}
+
+int SwivelString::getNumNotes() const
+{
+    return targets != nullptr ? targets->size() : 0;
+}
+
+uint16 SwivelString::getTableEntry(int note) const
+{
+    return note_key_table[(uint8) note];
+}
+
+int SwivelString::getNumCurvePoints() const
+{
+    return bend_curve.size();
+}
+
+uint16 SwivelString::getCurveBend(int index) const
+{
+    return (*midiPitchBend)[index];
+}
+
+double SwivelString::getCurveFrequency(int index) const
+{
+    return bend_curve[index];
+}
+
 int SwivelString::getAudioChannel() const
 {
     return audioChannel;
@@ -589,7 +649,8 @@ void SwivelString::setAudioChannel(int newChan)
 
 bool SwivelString::isReadyToTransform() const
 {
-    return bundleInit && audioInit && (std::isnormal(determined_pitch));
+    // the audio is only needed to find the pitch, the plugin is given it instead
+    return bundleInit && (std::isnormal(determined_pitch));
 }
 
 void SwivelString::reset()
@@ -598,10 +659,13 @@ void SwivelString::reset()
     determined_pitch = std::numeric_limits<double>::signaling_NaN();
     processing = false;
     gate = false;
+    finished = false;
+    input_index = 0;
     peaks.clear();
     freqs.clear();
     analysisThreadRef = nullptr;
     note_key_table.clear();
+    bend_curve.clear();
     lastphase = 0;
     // undo audio init
     free(input_buffer);
@@ -702,7 +766,9 @@ MidiMessage SwivelString::transform(const juce::MidiMessage &msg) const
         if (pbv == INVALID_NOTE) return MidiMessage();
         if (pbv == OFFSTRING_NOTE)
         {
+#ifdef DEBUG
             std::cout << "note becomes open string\n";
+#endif
             return MidiMessage();
         }
         uint8 d1 = pbv & 0x7f; // LSB
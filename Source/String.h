@@ -7,8 +7,9 @@
 //
 /**
     Represents a single string. Implements juce::AudioIODeviceCallback, so in order to do its calculations it must be
-    added as a callback to the current audio device.
-    Each string has a separate midi channel, and once it has done its 
+    added as a callback to the current audio device, or be fed audio through the callback some other way (the
+    analysis thread feeds it from its capture of the inputs).
+    Each string has a separate midi channel (on its port), and once it has done its 
     analysis can be passed midi messages to transform them according to the results.
 */
 
@@ -17,9 +18,11 @@
 
 #include <iostream>
 #include <tuple>
-#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+#include "CoreJuceHeader.h"
 #include <fftw3.h>
 #include "SwivelStringFileParser.h"
+#include "Windowing.h"
 
 
 class SwivelString : public AudioIODeviceCallback
@@ -36,7 +39,14 @@ public:
     void audioDeviceAboutToStart(AudioIODevice* device);
     void audioDeviceStopped();
     void initialiseFromBundle(SwivelStringFileParser::StringDataBundle* bundle);
-    void initialiseAudioParameters(fftw_plan, double* input, fftw_complex* output, int fft_size, double sr, int ol, double upThresh, double downThresh);
+    void initialiseAudioParameters(fftw_plan, double* input, fftw_complex* output, int fft_size, double sr, int ol, double upThresh, double downThresh, Windowing::WindowType window);
+    
+    /** Takes audio that is already known to be inside the onset gate, doing the FFTs as it fills up.
+        The callback calls this after its own gating, the analysis thread calls it with audio the
+        capture has already gated. Same rules as the callback, nothing in here may block. */
+    void processSamples(const float* samples, int numSamples);
+    /** The onset gate has closed, no more audio is wanted */
+    void stopListening();
     
     //===========================================
     /** Returns current list of peaks in Hz */
@@ -45,6 +55,16 @@ public:
     /** Returns the midi data required to make things go */
     const MidiBuffer* getMidiBuffer() const;
     
+    /** Returns every message of the midi data except the last one, which is assumed to be the one that actually
+        excites the string. These can be sent while another string is still ringing. */
+    const MidiBuffer* getPreparationBuffer() const;
+    
+    /** Returns the final message of the midi data, moved to sample position 0 */
+    const MidiBuffer* getExcitationBuffer() const;
+    
+    /** Gets the time (ms) from the start of the midi data to the excitation message */
+    double getPreparationTime() const;
+    
     /** Set the thread to notify when processing is complete */
     void setAnalysisThread(Thread* thread);
     
@@ -57,6 +77,25 @@ public:
     /** Returns true iff both initialisation routines have completed and the final initialisation succeeded */
     bool isFullyInitialised() const;
     
+    /** Returns true once the onset gate has closed and no more audio is wanted. The string can then be removed
+        as an audio callback and processFrequencies() called from any thread. */
+    bool hasFinishedListening() const;
+    
+    /** Works out the best frequency from the estimates so far, 0 if there aren't any.
+        Don't call this while the string is still listening. */
+    double calculateBestFrequency();
+    
+    /** How many frequency estimates the callback has made since the last reset */
+    int getNumEstimates() const;
+    
+    /** Takes the frequencies and populates the note lookup table.
+        Don't call this while the string is still listening. */
+    void processFrequencies();
+    
+    /** Populates the note lookup table from an open frequency found before, eg. by an earlier calibration,
+        instead of listening for it. Only needs initialiseFromBundle(). */
+    void setOpenFrequency(double frequency);
+    
     /** Gets the current channel (default 0) */
     int getAudioChannel() const;
     
@@ -72,6 +111,31 @@ public:
     /** Gets the MIDI channel this string is working on, this is derived from the given MIDI data in the data file used to construct 
         the string */
     int getMidiChannel() const;
+    /** Gets the MIDI port this string is on (default 0), from the data file. With several ports open
+        the channel only tells strings apart within a port */
+    int getMidiPort() const;
+    
+    /** The first MIDI note in the lookup table, the note the string plays open */
+    int getFirstNote() const;
+    /** How many notes the lookup table goes up to from the first, one per target */
+    int getNumNotes() const;
+    /** What the lookup table has for a note: a pitch bend (0-16383), or OPEN_NOTE, OFFSTRING_NOTE or
+        INVALID_NOTE. Only once isReadyToTransform(), and not while the table is being rebuilt */
+    uint16 getTableEntry(int note) const;
+    /** How many points the bend curve has, one for each pitch bend the string was measured at.
+        0 until the lookup table has been made */
+    int getNumCurvePoints() const;
+    /** The pitch bend at a point on the bend curve */
+    uint16 getCurveBend(int index) const;
+    /** The frequency the string plays at that point's pitch bend, at the tuning it was calibrated at */
+    double getCurveFrequency(int index) const;
+    
+    // An invalid note for some reason, most likely too high pitched for this string
+    static constexpr uint16  INVALID_NOTE   = 0xffff; // could be anything > 16384
+    // A note too low for the string (or too low for the servo to reach)
+    static constexpr uint16  OFFSTRING_NOTE = 0xfffe;
+    // A note that is near enough to the open string that it is worth playing
+    static constexpr uint16  OPEN_NOTE      = 0xfffd;
     
     //===========================================
     /** Resets all calculated data in preparation for recalculation.
@@ -79,12 +143,18 @@ public:
     void reset();
     
 private:
+    // times the private parts directly
+    friend class SwivelStringBenchmarks;
+    
     //===========================================
     typedef std::tuple<double, double, int, int> Range;
     
     //===========================================
     // how to make it go
     ScopedPointer<MidiBuffer> midiData;
+    // the same, split into the setting up and the actual pluck
+    MidiBuffer preparation;
+    MidiBuffer excitation;
     
     //=====INFO OF THE STRING====================
     /** the measured characteristics (2 or more) */
@@ -102,6 +172,7 @@ private:
     //=====FFT STUFF=============================
     bool processing;
     bool gate;
+    std::atomic<bool> finished;
     
     fftw_plan fft_plan;
     double* input;
@@ -112,11 +183,12 @@ private:
     int minBin, maxBin;
     double rmsUp, rmsDown;
     double* input_buffer;
+    int input_index;
     double* magnitudes;
-    Array<int, CriticalSection> peaks;
+    Array<int> peaks;
     Array<double> freqs;
     double sample_rate;
-    int windowType;
+    Windowing::WindowType windowType;
     //=============================================
     double magnitude(fftw_complex);
     void window(double* input, int size);
@@ -124,10 +196,6 @@ private:
     int freqToBin(double freq);
     double preciseBinToFreq(int bin, double phasedelta);
     //=============================================
-    // takes the frequencies and populates the note lookup table
-    void processFrequencies();
-    // gets the best frequency from the calculated ones
-    double calculateBestFrequency();
     // actually fill in note_key_table, takes an array of frequency estimates for the determined fundamental
     void fillLookupTable(Array<double>& derived_data);
     //=============================================
@@ -139,6 +207,7 @@ private:
     void finalInit();
     
     double delay;
+    double prepTime;
     
     Thread* analysisThreadRef;
     
@@ -151,19 +220,19 @@ private:
     static constexpr double ONEDIVPI       = 1.0/M_PI;
     // PI/2
     static constexpr double HALFPI         = 0.5*M_PI;
-    // An invalid note for some reason, most likely too high pitched for this string
-    static constexpr uint16  INVALID_NOTE   = 0xffff; // could be anything > 16384
-    // A note too low for the string (or too low for the servo to reach)
-    static constexpr uint16  OFFSTRING_NOTE = 0xfffe;
-    // A note that is near enough to the open string that it is worth playing
-    static constexpr uint16  OPEN_NOTE      = 0xfffd;
+    // how many frequency estimates to gather before giving up listening
+    static const int maxEstimates = 20;
     // returns distance in cents (100th of an equal-tempered semitone)
     static double cents(double a, double b);
     //===============================================
     // some MIDI info
     int channel;
+    // and which port, the pair of input and output it's on
+    int port;
     // the lookup table of notes to pitchbend values
     HashMap<uint8, uint16> note_key_table;
+    // the measurements interpolated to the determined pitch, a frequency per midiPitchBend value
+    Array<double> bend_curve;
     // beginning MIDI note number
     int num;
     // Audio channel index
@@ -0,0 +1,567 @@
+//
+//  SweepMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  Runs every combination of analysis settings (FFT size, overlap, window, onset thresholds) over a
+//  corpus of string captures with known pitches, on all the cores, and reports for each string
+//  the settings that are Pareto-optimal for accuracy, audio needed and CPU time.
+//
+//      swivel-sweep datafile corpus.txt [--json file] [--tolerance cents] [--threads n]
+//                                       [--up 0.0005,0.001,0.005] [--down 0.0005,0.001]
+//
+//  corpus.txt has one capture per line, paths relative to corpus.txt:
+//
+//      # wav file, string number in the data file, known pitch in Hz
+//      string45-0.wav 45 106.21
+//
+//  Without any recordings, a corpus can be made from the simulated rig:
+//
+//      swivel-sweep datafile --synthesise directory [--count n] [--seed n] [--noise level] [--detune cents]
+//
+
+#include <iostream>
+#include <map>
+#include <time.h>
+#include "CoreJuceHeader.h"
+#include "String.h"
+#include "SwivelStringFileParser.h"
+#include "SimulatedRig.h"
+
+namespace
+{
+    const int FFTSizes[] = { 512, 1024, 2048, 4096, 8192, 16384, 32768 };
+    const int overlapOptions[] = { 1, 2, 3, 4 };
+    const Windowing::WindowType windows[] = { Windowing::HANN, Windowing::HAMMING, Windowing::BLACKMAN, Windowing::RECTANGULAR };
+    const char* windowNames[] = { "hann", "hamming", "blackman", "rectangular" };
+    const int blockSize = 512;
+
+    struct Settings
+    {
+        int fftSize;
+        int overlap;
+        int window; // index into windows
+        double up;
+        double down;
+
+        var toVar() const
+        {
+            DynamicObject* object = new DynamicObject();
+            object->setProperty("fft_size", fftSize);
+            object->setProperty("overlap", overlap);
+            object->setProperty("window", windowNames[window]);
+            object->setProperty("threshold_up", up);
+            object->setProperty("threshold_down", down);
+            return var(object);
+        }
+    };
+
+    struct Capture
+    {
+        File file;
+        int stringNumber;
+        double pitch;
+        AudioSampleBuffer audio {1, 1};
+        double sampleRate;
+    };
+
+    /** How one setting did on one capture */
+    struct Outcome
+    {
+        bool converged;
+        double cents;
+        double audioSeconds;
+        double cpuPerFrame; // ns
+    };
+
+    double threadCpuNanoseconds()
+    {
+        timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return now.tv_sec * 1.0e9 + now.tv_nsec;
+    }
+
+    Array<double> parseList(const String& text)
+    {
+        StringArray items;
+        items.addTokens(text, ",", String::empty);
+        Array<double> values;
+        for (int i = 0; i < items.size(); i++)
+            values.add(items[i].getDoubleValue());
+        return values;
+    }
+
+    Result parseData(const File& dataFile, OwnedArray<SwivelStringFileParser::StringDataBundle>& bundles)
+    {
+        try
+        {
+            ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(dataFile);
+            if (data == nullptr)
+                return Result::fail("Couldn't open " + dataFile.getFullPathName());
+            bundles.addArray(*data);
+        }
+        catch (SwivelStringFileParser::ParseException const &e)
+        {
+            return Result::fail(String("Parse Error: ") + e.what());
+        }
+        return bundles.size() > 0 ? Result::ok() : Result::fail("No strings in " + dataFile.getFullPathName());
+    }
+
+    Range<double> fundamentalRange(const SwivelStringFileParser::StringDataBundle& bundle)
+    {
+        double lowest = bundle.fundamentals->getFirst(), highest = lowest;
+        for (int f = 0; f < bundle.fundamentals->size(); f++)
+        {
+            lowest = jmin(lowest, (*bundle.fundamentals)[f]);
+            highest = jmax(highest, (*bundle.fundamentals)[f]);
+        }
+        return Range<double>(lowest, highest);
+    }
+
+    //==========================================================================================
+    /** fftw's planner isn't thread safe, so each worker makes its own plans, one at a time, and keeps them */
+    class PlanCache
+    {
+    public:
+        ~PlanCache()
+        {
+            // the workers all exit together, and destroying a plan is the planner too
+            const ScopedLock sl(getPlannerLock());
+            for (auto& entry : plans)
+            {
+                fftw_destroy_plan(entry.second.plan);
+                fftw_free(entry.second.in);
+                fftw_free(entry.second.out);
+            }
+        }
+
+        struct Plan
+        {
+            fftw_plan plan;
+            double* in;
+            fftw_complex* out;
+        };
+
+        const Plan& get(int size)
+        {
+            auto found = plans.find(size);
+            if (found != plans.end())
+                return found->second;
+
+            const ScopedLock sl(getPlannerLock());
+            Plan plan;
+            plan.in = (double*) fftw_malloc(sizeof(double)*size);
+            plan.out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex)*size);
+            plan.plan = fftw_plan_dft_r2c_1d(size, plan.in, plan.out, FFTW_MEASURE);
+            return plans[size] = plan;
+        }
+
+    private:
+        std::map<int, Plan> plans;
+
+        static CriticalSection& getPlannerLock()
+        {
+            static CriticalSection plannerLock;
+            return plannerLock;
+        }
+    };
+
+    thread_local PlanCache planCache;
+}
+
+//==============================================================================================
+/** One capture at one FFT size, through every other setting */
+class SweepJob : public ThreadPoolJob
+{
+public:
+    SweepJob(const File& d, const Capture& c, const Array<Settings>& s, const Array<int>& indices, Outcome* out)
+    :   ThreadPoolJob("Sweep"),
+        dataFile(d),
+        capture(c),
+        settings(s),
+        settingIndices(indices),
+        outcomes(out)
+    {
+
+    }
+
+    JobStatus runJob() override
+    {
+        OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+        if (!parseData(dataFile, bundles))
+            return jobHasFinished;
+
+        ScopedPointer<SwivelString> string = new SwivelString();
+        for (SwivelStringFileParser::StringDataBundle* bundle : bundles)
+            if (bundle->num == capture.stringNumber)
+                string->initialiseFromBundle(bundle);
+
+        const float* audio = capture.audio.getSampleData(0);
+        const int length = capture.audio.getNumSamples();
+
+        for (int index : settingIndices)
+        {
+            if (shouldExit())
+                break;
+
+            const Settings& setting = settings.getReference(index);
+            const PlanCache::Plan& plan = planCache.get(setting.fftSize);
+
+            // the same as the analysis thread does between runs
+            string->reset();
+            string->initialiseAudioParameters(plan.plan, plan.in, plan.out, setting.fftSize, capture.sampleRate,
+                                              setting.overlap, setting.up, setting.down, windows[setting.window]);
+
+            const double cpuStart = threadCpuNanoseconds();
+            int fed = 0;
+            while (fed + blockSize <= length && !string->hasFinishedListening())
+            {
+                const float* channels[1] = { audio + fed };
+                string->audioDeviceIOCallback(channels, 1, nullptr, 0, blockSize);
+                fed += blockSize;
+            }
+            const double cpu = threadCpuNanoseconds() - cpuStart;
+
+            // the first frame only gives a phase, every one after that gives an estimate
+            const int frames = string->getNumEstimates() + 1;
+            const double found = string->calculateBestFrequency();
+
+            Outcome& outcome = outcomes[index];
+            outcome.converged = string->hasFinishedListening() && found > 0;
+            outcome.cents = found > 0 ? 1200.0 * std::log2(found / capture.pitch) : 0.0;
+            outcome.audioSeconds = fed / capture.sampleRate;
+            outcome.cpuPerFrame = cpu / frames;
+        }
+        return jobHasFinished;
+    }
+
+private:
+    const File dataFile;
+    const Capture& capture;
+    const Array<Settings>& settings;
+    const Array<int> settingIndices;
+    Outcome* outcomes; // indexed by setting
+
+    JUCE_DECLARE_NON_COPYABLE (SweepJob)
+};
+
+//==============================================================================================
+/** How one setting did over all the captures of one string */
+struct Summary
+{
+    int setting;
+    int converged;
+    double maxCents;
+    double meanCents;
+    double audioSeconds;
+    double cpuPerFrame;
+
+    bool dominates(const Summary& other) const
+    {
+        bool noWorse = maxCents <= other.maxCents && audioSeconds <= other.audioSeconds && cpuPerFrame <= other.cpuPerFrame;
+        bool better = maxCents < other.maxCents || audioSeconds < other.audioSeconds || cpuPerFrame < other.cpuPerFrame;
+        return noWorse && better;
+    }
+
+    var toVar(const Array<Settings>& settings) const
+    {
+        DynamicObject* object = new DynamicObject();
+        object->setProperty("settings", settings[setting].toVar());
+        object->setProperty("max_error_cents", maxCents);
+        object->setProperty("mean_error_cents", meanCents);
+        object->setProperty("audio_seconds", audioSeconds);
+        object->setProperty("cpu_ns_per_frame", cpuPerFrame);
+        return var(object);
+    }
+};
+
+//==============================================================================================
+Result loadCorpus(const File& manifest, OwnedArray<Capture>& captures)
+{
+    if (!manifest.existsAsFile())
+        return Result::fail("Corpus " + manifest.getFullPathName() + " doesn't exist");
+
+    AudioFormatManager formats;
+    formats.registerBasicFormats();
+
+    StringArray lines;
+    manifest.readLines(lines);
+    for (int i = 0; i < lines.size(); i++)
+    {
+        String line = lines[i].upToFirstOccurrenceOf("#", false, false).trim();
+        if (line.isEmpty())
+            continue;
+
+        StringArray fields;
+        fields.addTokens(line, " \t", "\"");
+        fields.removeEmptyStrings();
+        if (fields.size() != 3)
+            return Result::fail("Line " + String(i+1) + " of corpus should be: file string pitch");
+
+        Capture* capture = new Capture();
+        captures.add(capture);
+        capture->file = manifest.getSiblingFile(fields[0].unquoted());
+        capture->stringNumber = fields[1].getIntValue();
+        capture->pitch = fields[2].getDoubleValue();
+
+        ScopedPointer<AudioFormatReader> reader = formats.createReaderFor(capture->file);
+        if (reader == nullptr)
+            return Result::fail("Couldn't read " + capture->file.getFullPathName());
+        capture->sampleRate = reader->sampleRate;
+        capture->audio.setSize(1, (int) reader->lengthInSamples);
+        reader->read(&capture->audio, 0, (int) reader->lengthInSamples, 0, true, false);
+    }
+
+    return captures.size() > 0 ? Result::ok() : Result::fail("Corpus is empty");
+}
+
+/** Makes a corpus from the simulated rig, a few plucks per string */
+Result synthesiseCorpus(const File& dataFile, const File& directory, int count, int64 seed, double noise, double detune)
+{
+    OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+    Result parsed = parseData(dataFile, bundles);
+    if (!parsed)
+        return parsed;
+
+    directory.createDirectory();
+    String manifest = "# made by swivel-sweep --synthesise from " + dataFile.getFileName() + "\n";
+    Random random(seed);
+    const double sampleRate = 44100.0;
+
+    for (SwivelStringFileParser::StringDataBundle* bundle : bundles)
+    {
+        const Range<double> range = fundamentalRange(*bundle);
+        for (int i = 0; i < count; i++)
+        {
+            SimulatedRig rig(1, sampleRate, random.nextInt64());
+            rig.setNoiseLevel(noise);
+            SimulatedRig::StringModel model;
+            model.openFrequency = range.getStart() + range.getLength() * (0.1 + 0.8 * random.nextDouble());
+            model.detune = detune;
+            rig.addString(model);
+
+            // a quarter of a second of nothing, then the pluck
+            MidiBuffer pluck;
+            pluck.addEvent(MidiMessage::controllerEvent(model.midiChannel, model.excitationController, 127), 0);
+            rig.sendBlockOfMessages(model.midiPort, pluck, 250, sampleRate);
+
+            AudioSampleBuffer audio(1, (int) sampleRate * 4);
+            for (int position = 0; position + blockSize <= audio.getNumSamples(); position += blockSize)
+            {
+                float* channel = audio.getSampleData(0, position);
+                rig.render(&channel, 1, blockSize);
+            }
+
+            File file = directory.getChildFile("string" + String(bundle->num) + "-" + String(i) + ".wav");
+            file.deleteFile();
+            WavAudioFormat wav;
+            ScopedPointer<AudioFormatWriter> writer = wav.createWriterFor(file.createOutputStream(), sampleRate, 1, 24, StringPairArray(), 0);
+            if (writer == nullptr)
+                return Result::fail("Couldn't write " + file.getFullPathName());
+            writer->writeFromAudioSampleBuffer(audio, 0, audio.getNumSamples());
+
+            manifest << file.getFileName() << " " << bundle->num << " " << String(rig.getPluckedFrequency(model.midiPort, model.midiChannel), 4) << "\n";
+        }
+    }
+
+    directory.getChildFile("corpus.txt").replaceWithText(manifest);
+    std::cout << "Wrote " << bundles.size() * count << " captures to " << directory.getFullPathName() << std::endl;
+    return Result::ok();
+}
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add(argv[i]);
+
+    if (args.size() < 2 || (args[1] == "--synthesise" && args.size() < 3))
+    {
+        std::cerr << "Usage: swivel-sweep datafile corpus.txt [options], see SweepMain.cpp" << std::endl;
+        return 1;
+    }
+
+    const File dataFile = File::getCurrentWorkingDirectory().getChildFile(args[0]);
+    File json = File::getCurrentWorkingDirectory().getChildFile("sweep.json");
+    double tolerance = 5.0;
+    int threads = SystemStats::getNumCpus();
+    Array<double> ups = parseList("0.0005,0.001,0.005");
+    Array<double> downs = parseList("0.0005,0.001");
+    File synthesiseTo;
+    int count = 4;
+    int64 seed = 1;
+    double noise = 0.001, detune = 5.0;
+
+    const bool synthesising = args[1] == "--synthesise";
+    for (int i = synthesising ? 3 : 2; i < args.size(); i += 2)
+    {
+        if (i + 1 >= args.size())
+        {
+            std::cerr << "Missing value for " << args[i] << std::endl;
+            return 1;
+        }
+
+        const String& arg = args[i];
+        const String& value = args[i+1];
+        if (arg == "--json")             json = File::getCurrentWorkingDirectory().getChildFile(value);
+        else if (arg == "--tolerance")   tolerance = value.getDoubleValue();
+        else if (arg == "--threads")     threads = jmax(1, value.getIntValue());
+        else if (arg == "--up")          ups = parseList(value);
+        else if (arg == "--down")        downs = parseList(value);
+        else if (arg == "--count")       count = value.getIntValue();
+        else if (arg == "--seed")        seed = value.getLargeIntValue();
+        else if (arg == "--noise")       noise = value.getDoubleValue();
+        else if (arg == "--detune")      detune = value.getDoubleValue();
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (synthesising)
+    {
+        Result made = synthesiseCorpus(dataFile, File::getCurrentWorkingDirectory().getChildFile(args[2]), count, seed, noise, detune);
+        if (!made)
+            std::cerr << made.getErrorMessage() << std::endl;
+        return made ? 0 : 1;
+    }
+
+    OwnedArray<Capture> captures;
+    Result loaded = loadCorpus(File::getCurrentWorkingDirectory().getChildFile(args[1]), captures);
+    if (!loaded)
+    {
+        std::cerr << loaded.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    // everything the GUI could be set to, times the thresholds asked for
+    Array<Settings> settings;
+    std::map<int, Array<int>> bySize;
+    for (int fftSize : FFTSizes)
+        for (int overlap : overlapOptions)
+            for (int w = 0; w < numElementsInArray(windows); w++)
+                for (double up : ups)
+                    for (double down : downs)
+                    {
+                        bySize[fftSize].add(settings.size());
+                        Settings setting = { fftSize, overlap, w, up, down };
+                        settings.add(setting);
+                    }
+
+    // run them, biggest FFTs first so the slow jobs don't end up last
+    HeapBlock<Outcome> outcomes((size_t) (captures.size() * settings.size()), true);
+    const double started = Time::getMillisecondCounterHiRes();
+    {
+        ThreadPool pool(threads);
+        for (int c = 0; c < captures.size(); c++)
+            for (auto size = bySize.rbegin(); size != bySize.rend(); ++size)
+                pool.addJob(new SweepJob(dataFile, *captures[c], settings, size->second, outcomes + c * settings.size()), true);
+
+        while (pool.getNumJobs() > 0)
+            Thread::sleep(100);
+    }
+    std::cout << captures.size() << " captures x " << settings.size() << " settings on " << threads << " threads took "
+              << (Time::getMillisecondCounterHiRes() - started) / 1000.0 << "s" << std::endl;
+
+    // summarise per string, and find the front
+    OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+    parseData(dataFile, bundles);
+
+    Array<var> ranges;
+    for (SwivelStringFileParser::StringDataBundle* bundle : bundles)
+    {
+        Array<int> mine;
+        for (int c = 0; c < captures.size(); c++)
+            if (captures[c]->stringNumber == bundle->num)
+                mine.add(c);
+        if (mine.size() == 0)
+            continue;
+
+        Array<Summary> summaries;
+        for (int s = 0; s < settings.size(); s++)
+        {
+            Summary summary = { s, 0, 0.0, 0.0, 0.0, 0.0 };
+            for (int c : mine)
+            {
+                const Outcome& outcome = outcomes[c * settings.size() + s];
+                if (!outcome.converged)
+                    continue;
+                summary.converged++;
+                summary.maxCents = jmax(summary.maxCents, std::fabs(outcome.cents));
+                summary.meanCents += std::fabs(outcome.cents) / mine.size();
+                summary.audioSeconds += outcome.audioSeconds / mine.size();
+                summary.cpuPerFrame += outcome.cpuPerFrame / mine.size();
+            }
+            if (summary.converged == mine.size()) // only settings that work every time
+                summaries.add(summary);
+        }
+
+        Array<var> front;
+        const Summary* cheapest = nullptr;
+        for (const Summary& candidate : summaries)
+        {
+            bool dominated = false;
+            for (const Summary& other : summaries)
+                dominated = dominated || other.dominates(candidate);
+            if (!dominated)
+                front.add(candidate.toVar(settings));
+
+            if (candidate.maxCents <= tolerance && (cheapest == nullptr || candidate.cpuPerFrame < cheapest->cpuPerFrame))
+                cheapest = &candidate;
+        }
+
+        const Range<double> range = fundamentalRange(*bundle);
+        std::cout << "String " << bundle->num << " (" << range.getStart() << "-" << range.getEnd() << "Hz): "
+                  << summaries.size() << " settings always converged, " << front.size() << " on the front" << std::endl;
+        if (cheapest != nullptr)
+        {
+            const Settings& s = settings.getReference(cheapest->setting);
+            std::cout << "    cheapest within " << tolerance << " cents: fft " << s.fftSize << ", overlap " << s.overlap
+                      << ", " << windowNames[s.window] << ", up " << s.up << ", down " << s.down
+                      << " (" << cheapest->maxCents << " cents, " << cheapest->audioSeconds << "s, "
+                      << cheapest->cpuPerFrame << "ns/frame)" << std::endl;
+        }
+        else
+            std::cout << "    nothing within " << tolerance << " cents" << std::endl;
+
+        DynamicObject* entry = new DynamicObject();
+        entry->setProperty("string", bundle->num);
+        entry->setProperty("lowest_fundamental", range.getStart());
+        entry->setProperty("highest_fundamental", range.getEnd());
+        entry->setProperty("captures", mine.size());
+        entry->setProperty("pareto", front);
+        entry->setProperty("cheapest_within_tolerance", cheapest != nullptr ? cheapest->toVar(settings) : var());
+        ranges.add(var(entry));
+    }
+
+    // and everything, for anyone who wants to plot it
+    Array<var> all;
+    for (int c = 0; c < captures.size(); c++)
+        for (int s = 0; s < settings.size(); s++)
+        {
+            const Outcome& outcome = outcomes[c * settings.size() + s];
+            DynamicObject* entry = new DynamicObject();
+            entry->setProperty("capture", captures[c]->file.getFileName());
+            entry->setProperty("settings", settings[s].toVar());
+            entry->setProperty("converged", outcome.converged);
+            entry->setProperty("error_cents", outcome.cents);
+            entry->setProperty("audio_seconds", outcome.audioSeconds);
+            entry->setProperty("cpu_ns_per_frame", outcome.cpuPerFrame);
+            all.add(var(entry));
+        }
+
+    DynamicObject* root = new DynamicObject();
+    root->setProperty("tolerance_cents", tolerance);
+    root->setProperty("ranges", ranges);
+    root->setProperty("results", all);
+    if (!json.replaceWithText(JSON::toString(var(root))))
+    {
+        std::cerr << "Couldn't write " << json.getFullPathName() << std::endl;
+        return 1;
+    }
+    std::cout << "Written to " << json.getFullPathName() << std::endl;
+    return 0;
+}
@@ -0,0 +1,324 @@
+//
+//  SwivelProcessor.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "SwivelProcessor.h"
+#include "RealtimeChecker.h"
+
+SwivelProcessor::SwivelProcessor()
+{
+    zeromem(routes, sizeof(routes));
+}
+
+SwivelProcessor::~SwivelProcessor()
+{
+}
+
+Result SwivelProcessor::loadStrings(const File& file, const Array<double>& frequencies)
+{
+    OwnedArray<SwivelStringFileParser::StringDataBundle> bundles;
+    try
+    {
+        ScopedPointer<Array<SwivelStringFileParser::StringDataBundle*>> data = SwivelStringFileParser::parseFile(file);
+        if (data == nullptr)
+            return Result::fail("Couldn't open " + file.getFullPathName());
+        bundles.addArray(*data);
+    }
+    catch (SwivelStringFileParser::ParseException const &e)
+    {
+        return Result::fail("Parse Error: " + String(e.what()));
+    }
+
+    // built to one side, the audio thread keeps using the old ones until they're swapped
+    OwnedArray<SwivelString> loaded;
+    SwivelString* newRoutes[16];
+    zeromem(newRoutes, sizeof(newRoutes));
+    for (SwivelStringFileParser::StringDataBundle* bundle : bundles)
+    {
+        if (bundle->port != 0)
+            continue;
+        if (loaded.size() >= frequencies.size())
+            return Result::fail("No open frequency for string " + String(bundle->num) + " in " + file.getFileName());
+
+        // the table is only filled in between two measurements, same as after listening
+        const double frequency = frequencies[loaded.size()];
+        double lowest = bundle->fundamentals->getFirst(), highest = lowest;
+        for (double fundamental : *bundle->fundamentals)
+        {
+            lowest = jmin(lowest, fundamental);
+            highest = jmax(highest, fundamental);
+        }
+        if (frequency < lowest || frequency >= highest)
+            return Result::fail("String " + String(bundle->num) + " was only measured from " + String(lowest)
+                                + "Hz to " + String(highest) + "Hz, not " + String(frequency) + "Hz");
+
+        SwivelString* string = new SwivelString();
+        loaded.add(string);
+        string->initialiseFromBundle(bundle);
+        string->setOpenFrequency(frequency);
+
+        const int channel = string->getMidiChannel();
+        if (!isPositiveAndBelow(channel - 1, 16))
+            return Result::fail("String " + String(bundle->num) + " hasn't got a MIDI channel");
+        if (newRoutes[channel-1] != nullptr)
+            return Result::fail("More than one string on MIDI channel " + String(channel));
+        newRoutes[channel-1] = string;
+    }
+    if (loaded.size() == 0)
+        return Result::fail("No strings on MIDI port 0 in " + file.getFileName());
+    if (frequencies.size() > loaded.size())
+        return Result::fail(String(frequencies.size()) + " open frequencies for " + String(loaded.size()) + " strings");
+
+    {
+        const SpinLock::ScopedLockType sl(stringsLock);
+        strings.swapWithArray(loaded);
+        memcpy(routes, newRoutes, sizeof(routes));
+    }
+    // the old ones go with loaded, outside the lock
+    dataFile = file;
+    openFrequencies = frequencies;
+    return Result::ok();
+}
+
+int SwivelProcessor::getNumStrings() const
+{
+    return strings.size();
+}
+
+const SwivelString* SwivelProcessor::getString(int index) const
+{
+    return strings[index];
+}
+
+//==============================================================================================
+const String SwivelProcessor::getName() const
+{
+    return "Swivel Autotune";
+}
+
+void SwivelProcessor::prepareToPlay(double sampleRate, int estimatedSamplesPerBlock)
+{
+    // a position, a size and up to 3 bytes each, plus the headroom addEvent() asks for
+    rebuilt.ensureSize((size_t) maxEventsPerBlock * 16);
+}
+
+void SwivelProcessor::releaseResources()
+{
+}
+
+void SwivelProcessor::processBlock(AudioSampleBuffer& buffer, MidiBuffer& midiMessages)
+{
+    RealtimeChecker::ScopedRealtimeSection realtime;
+
+    // the audio's left as it is, any outputs without an input get silence
+    for (int i = getNumInputChannels(); i < getNumOutputChannels(); i++)
+        buffer.clear(i, 0, buffer.getNumSamples());
+
+    // loadStrings() is swapping them over, this block goes through untouched
+    const GenericScopedTryLock<SpinLock> lock(stringsLock);
+    if (!lock.isLocked())
+        return;
+
+    bool rebuilding = false;
+    int done = 0;
+    MidiBuffer::Iterator it(midiMessages);
+    const uint8* data;
+    int size, position;
+    while (it.getNextEvent(data, size, position))
+    {
+        // straight to the string from the table, channel messages only
+        const uint8 status = data[0] & 0xf0;
+        SwivelString* const string = (size <= 3 && status >= 0x80 && status < 0xf0) ? routes[data[0] & 0x0f] : nullptr;
+        if (string != nullptr)
+        {
+            const MidiMessage transformed(transform(*string, data, size));
+            // the strings give back an empty sysex for a note they can't play
+            const bool dropped = transformed.isSysEx() && transformed.getSysExDataSize() == 0;
+
+            if (!dropped && transformed.getRawDataSize() == size)
+            {
+                // the same size, so it can go back where it was
+                memcpy(const_cast<uint8*>(data), transformed.getRawData(), (size_t) size);
+            }
+            else
+            {
+                // from here on it has to be built up again, starting with everything already done
+                if (!rebuilding)
+                {
+                    rebuilding = true;
+                    rebuilt.clear();
+                    MidiBuffer::Iterator earlier(midiMessages);
+                    const uint8* earlierData;
+                    int earlierSize, earlierPosition;
+                    for (int i = 0; i < done && earlier.getNextEvent(earlierData, earlierSize, earlierPosition); i++)
+                        rebuilt.addEvent(earlierData, earlierSize, earlierPosition);
+                }
+                if (!dropped)
+                    rebuilt.addEvent(transformed, position);
+                continue;
+            }
+        }
+
+        if (rebuilding)
+            rebuilt.addEvent(data, size, position);
+        done++;
+    }
+
+    if (rebuilding)
+    {
+        midiMessages.clear();
+        midiMessages.addEvents(rebuilt, 0, -1, 0);
+    }
+}
+
+MidiMessage SwivelProcessor::transform(const SwivelString& string, const uint8* data, int size)
+{
+    const MidiMessage message(data, size, 0);
+#ifdef DEBUG
+    // debug builds throw for notes off the end of the string, they go through as they are
+    try {
+        return string.transform(message);
+    } catch (std::logic_error const &) {
+        return message;
+    }
+#else
+    return string.transform(message);
+#endif
+}
+
+//==============================================================================================
+const String SwivelProcessor::getInputChannelName(int channelIndex) const
+{
+    return String(channelIndex + 1);
+}
+
+const String SwivelProcessor::getOutputChannelName(int channelIndex) const
+{
+    return String(channelIndex + 1);
+}
+
+bool SwivelProcessor::isInputChannelStereoPair(int index) const
+{
+    return true;
+}
+
+bool SwivelProcessor::isOutputChannelStereoPair(int index) const
+{
+    return true;
+}
+
+bool SwivelProcessor::silenceInProducesSilenceOut() const
+{
+    return true;
+}
+
+double SwivelProcessor::getTailLengthSeconds() const
+{
+    return 0.0;
+}
+
+bool SwivelProcessor::acceptsMidi() const
+{
+    return true;
+}
+
+bool SwivelProcessor::producesMidi() const
+{
+    return true;
+}
+
+// no editor yet, the strings come from the session
+AudioProcessorEditor* SwivelProcessor::createEditor()
+{
+    return nullptr;
+}
+
+bool SwivelProcessor::hasEditor() const
+{
+    return false;
+}
+
+int SwivelProcessor::getNumParameters()
+{
+    return 0;
+}
+
+const String SwivelProcessor::getParameterName(int parameterIndex)
+{
+    return String::empty;
+}
+
+float SwivelProcessor::getParameter(int parameterIndex)
+{
+    return 0.0f;
+}
+
+const String SwivelProcessor::getParameterText(int parameterIndex)
+{
+    return String::empty;
+}
+
+void SwivelProcessor::setParameter(int parameterIndex, float newValue)
+{
+}
+
+int SwivelProcessor::getNumPrograms()
+{
+    return 1;
+}
+
+int SwivelProcessor::getCurrentProgram()
+{
+    return 0;
+}
+
+void SwivelProcessor::setCurrentProgram(int index)
+{
+}
+
+const String SwivelProcessor::getProgramName(int index)
+{
+    return String::empty;
+}
+
+void SwivelProcessor::changeProgramName(int index, const String& newName)
+{
+}
+
+//==============================================================================================
+void SwivelProcessor::getStateInformation(MemoryBlock& destData)
+{
+    XmlElement state("SWIVELSTRINGS");
+    state.setAttribute("datafile", dataFile.getFullPathName());
+    StringArray frequencies;
+    for (double frequency : openFrequencies)
+        frequencies.add(String(frequency));
+    state.setAttribute("frequencies", frequencies.joinIntoString(","));
+    copyXmlToBinary(state, destData);
+}
+
+void SwivelProcessor::setStateInformation(const void* data, int sizeInBytes)
+{
+    ScopedPointer<XmlElement> state(getXmlFromBinary(data, sizeInBytes));
+    if (state == nullptr || !state->hasTagName("SWIVELSTRINGS") || state->getStringAttribute("datafile").isEmpty())
+        return;
+
+    StringArray frequencies;
+    frequencies.addTokens(state->getStringAttribute("frequencies"), ",", String::empty);
+    Array<double> parsed;
+    for (const String& frequency : frequencies)
+        parsed.add(frequency.getDoubleValue());
+    // if the file's gone it carries on with what it had, which passes everything through if that's nothing
+    loadStrings(File(state->getStringAttribute("datafile")), parsed);
+}
+
+//==============================================================================================
+// what the plugin wrappers call to make one
+AudioProcessor* JUCE_CALLTYPE createPluginFilter()
+{
+    return new SwivelProcessor();
+}
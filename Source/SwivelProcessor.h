@@ -0,0 +1,100 @@
+//
+//  SwivelProcessor.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__SwivelProcessor__
+#define __SwivelAutotune__SwivelProcessor__
+
+#include "CoreJuceHeader.h"
+// not in CoreJuceHeader.h, it pulls in the GUI modules for the editors
+#include "../JuceLibraryCode/modules/juce_audio_processors/juce_audio_processors.h"
+#include "String.h"
+
+/** The MIDI transform as a plugin, so it sits in the host's own MIDI path rather than behind
+    a trip out through one MIDI driver and back in through another.
+
+    Each block's MIDI is rewritten where it is: every message on a string's channel goes through
+    that string's table and keeps its sample position, anything else is left alone. Nothing is
+    allocated: if a string drops a note it can't play the block is rebuilt in a buffer set aside
+    in prepareToPlay() and copied back, where it fits as it's only got shorter. Audio goes
+    straight through.
+
+    The strings come from a data file in the usual format plus the open frequency each one was
+    calibrated at (the ones the app and swivel-headless log at the end), and that's what gets
+    saved with the host's session. A plugin only gets the one stream of MIDI, so strings on
+    other MIDI ports are left out.
+ */
+class SwivelProcessor : public AudioProcessor
+{
+public:
+    SwivelProcessor();
+    ~SwivelProcessor();
+
+    /** Builds the strings from a data file and an open frequency for each of its port 0 strings,
+        in the order they're in the file, and swaps them in. Anything but the audio thread */
+    Result loadStrings(const File& dataFile, const Array<double>& openFrequencies);
+    int getNumStrings() const;
+    /** The string in use at the index, in the same order. Not while loadStrings() is running */
+    const SwivelString* getString(int index) const;
+
+    //==========================================================================================
+    const String getName() const override;
+    void prepareToPlay(double sampleRate, int estimatedSamplesPerBlock) override;
+    void releaseResources() override;
+    void processBlock(AudioSampleBuffer& buffer, MidiBuffer& midiMessages) override;
+
+    const String getInputChannelName(int channelIndex) const override;
+    const String getOutputChannelName(int channelIndex) const override;
+    bool isInputChannelStereoPair(int index) const override;
+    bool isOutputChannelStereoPair(int index) const override;
+    bool silenceInProducesSilenceOut() const override;
+    double getTailLengthSeconds() const override;
+    bool acceptsMidi() const override;
+    bool producesMidi() const override;
+
+    AudioProcessorEditor* createEditor() override;
+    bool hasEditor() const override;
+
+    int getNumParameters() override;
+    const String getParameterName(int parameterIndex) override;
+    float getParameter(int parameterIndex) override;
+    const String getParameterText(int parameterIndex) override;
+    void setParameter(int parameterIndex, float newValue) override;
+
+    int getNumPrograms() override;
+    int getCurrentProgram() override;
+    void setCurrentProgram(int index) override;
+    const String getProgramName(int index) override;
+    void changeProgramName(int index, const String& newName) override;
+
+    void getStateInformation(MemoryBlock& destData) override;
+    void setStateInformation(const void* data, int sizeInBytes) override;
+
+    // room for this many messages a block before dropping a note has to allocate
+    static const int maxEventsPerBlock = 2048;
+
+private:
+    OwnedArray<SwivelString> strings;
+    // the string on each channel, nullptr if there isn't one
+    SwivelString* routes[16];
+    // the audio thread holds it for a block, loadStrings() only while it swaps the strings over
+    SpinLock stringsLock;
+
+    // what the session saves
+    File dataFile;
+    Array<double> openFrequencies;
+
+    // the block's messages go in here instead once one of them has to be dropped
+    MidiBuffer rebuilt;
+
+    /** The string's version of a message */
+    static MidiMessage transform(const SwivelString& string, const uint8* data, int size);
+
+    JUCE_DECLARE_NON_COPYABLE (SwivelProcessor)
+};
+
+#endif /* defined(__SwivelAutotune__SwivelProcessor__) */
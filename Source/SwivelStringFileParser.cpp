@@ -50,11 +50,22 @@ void SwivelStringFileParser::parseSwivelStringElement(juce::BufferedInputStream
         fail("missing number attribute");
     }
     
-    String number = tag.substring(nindex+7); // should be the number and the end of the tag
+    String number = tag.substring(nindex+7).upToFirstOccurrenceOf(" ", false, false); // should be the number, and the end of the tag if it's last
     number = trimToNumber(number);
     int num = number.getIntValue();
     data->num = num; // NOTE - ERRORS HERE IN THE FILE WILL NOT CRASH THE PARSER, THE STRING WILL JUST HAVE VALUE ONE
     
+    // the port is optional, most instruments only need the one
+    int pindex = tag.indexOfWholeWord("port=");
+    if (pindex > 0)
+    {
+        String port = tag.substring(pindex+5).upToFirstOccurrenceOf(" ", false, false);
+        port = trimToNumber(port);
+        if (port.isEmpty())
+            fail("port attribute isn't a number");
+        data->port = port.getIntValue();
+    }
+    
     tag = file.readNextLine();
     
     while (!tag.endsWithIgnoreCase("</swivelstring>"))
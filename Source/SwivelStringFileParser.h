@@ -9,7 +9,7 @@
 #ifndef __SwivelAutotune__SwivelStringFileParser__
 #define __SwivelAutotune__SwivelStringFileParser__
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#include "CoreJuceHeader.h"
 #include <regex>
 
 /*************************************************************
@@ -19,8 +19,9 @@
  see examples.
  
  FILE           ::= SWIVELSTRING
- SWIVELSTRING   ::= '<swivelstring ' S NUMATT S '>' S MEASUREMENTS+ S TARGETS S MSBS S MIDIMSGS S '</swivelstring>'
+ SWIVELSTRING   ::= '<swivelstring ' S NUMATT [S PORTATT] S '>' S MEASUREMENTS+ S TARGETS S MSBS S MIDIMSGS S '</swivelstring>'
  NUMATT         ::= 'number=' NUMBER
+ PORTATT        ::= 'port=' NUMBER                                    // which MIDI port pair the string is on, 0 if missing
  MEASUREMENTS   ::= '<measurements' S FUND S '>' FLOATLIST '</measurement>'
  TARGETS        ::= '<targets>' S FLOATLIST S '</targets>'
  MSBS           ::= '<midimsbs>' BYTELIST '</midimsbs>'
@@ -41,6 +42,8 @@ public:
     {
         /** The number of the string, used to tell them apart */
         int num;
+        /** The MIDI port the string is on, strings are told apart by port and channel */
+        int port;
         /** The measurements of the string at various frequencies */
         ScopedPointer<OwnedArray<Array<double>>> measured_data;
         /** The fundamental of the string, indices corresponding to measured_data */
@@ -52,7 +55,7 @@ public:
         /** The sequence of MIDI messages needed to make the sounds required */
         ScopedPointer<MidiBuffer> midiBuffer;
         
-        StringDataBundle()
+        StringDataBundle() : num(0), port(0)
         {
             measured_data = new OwnedArray<Array<double>>();
             fundamentals = new Array<double>();
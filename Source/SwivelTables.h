@@ -0,0 +1,249 @@
+//
+//  SwivelTables.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__SwivelTables__
+#define __SwivelAutotune__SwivelTables__
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** The calibrated note tables and bend curves, published in POSIX shared memory for software that
+    would rather do the retargeting itself than send its MIDI through the thru. TablePublisher writes
+    it, this header is all a reader needs: no JUCE and nothing to link but what shm_open() wants
+    (-lrt on older Linux).
+
+    It's one fixed-size segment, guarded by a seqlock: the sequence is odd while the tables are being
+    written, so a read that saw the same even sequence before and after got a consistent copy. Readers
+    never block the publisher or each other, and the tables are read where they are, nothing is
+    copied unless the reader wants it to be. A recalibration is visible as soon as it's written, with
+    a new generation. When the publisher stops the strings are withdrawn but the segment stays, so
+    readers left open pick up the next run without opening it again.
+
+        SwivelTables::Reader reader;
+        if (reader.open())
+        {
+            uint16_t bend;
+            if (reader.lookup(0, 1, 45, bend) && bend <= SwivelTables::maxBend)
+                ... send 45 with that pitch bend on channel 1
+        }
+
+    The layout only changes with the version, and readers refuse any version they weren't built with.
+ */
+namespace SwivelTables
+{
+    static const uint32_t magic   = 0x53575442; // "SWTB"
+    static const uint32_t version = 1;
+    static const char* const defaultName = "/swivel-tables";
+
+    static const int maxStrings     = 64;  // 16 channels on each of 4 ports
+    static const int maxNotes       = 128;
+    static const int maxCurvePoints = 64;
+
+    // what's in a note table instead of a pitch bend, same as SwivelString's
+    static const uint16_t maxBend        = 16383;
+    static const uint16_t invalidNote    = 0xffff; // most likely too high for the string
+    static const uint16_t offStringNote  = 0xfffe; // too low for the string
+    static const uint16_t openNote       = 0xfffd; // near enough the open string to play it open
+
+    /** One string's tables, for the tuning it was calibrated at */
+    struct StringTable
+    {
+        double   openFrequency;                     // Hz
+        double   curveFrequencies[maxCurvePoints];  // what the string plays at each of curveBends
+        int32_t  port;                              // MIDI port, from 0
+        int32_t  channel;                           // MIDI channel, 1-16
+        int32_t  firstNote;                         // the note the string plays open, notes[0] is for it
+        int32_t  numNotes;
+        int32_t  numCurvePoints;
+        uint16_t notes[maxNotes];                   // a pitch bend (0-maxBend) or one of the markers
+        uint16_t curveBends[maxCurvePoints];        // the pitch bends the string was measured at
+    };
+
+    /** Everything that's published, plain data so it can be copied out whole */
+    struct Tables
+    {
+        double      publishedAt;    // ms since 1970
+        uint32_t    generation;     // goes up each time it's published, 0 until it has been
+        int32_t     numStrings;     // 0 when there's nothing calibrated, or the publisher has stopped
+        StringTable strings[maxStrings];
+    };
+
+    struct Segment
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t size;                  // sizeof (Segment), in case the layout changed without the version
+        std::atomic<uint32_t> sequence; // odd while it's being written
+        Tables tables;
+    };
+
+    static_assert(ATOMIC_INT_LOCK_FREE == 2, "the sequence has to be lock-free to be shared between processes");
+
+    //==========================================================================================
+    /** The string on a port and channel, or nullptr. Only trust it inside Reader::read() */
+    inline const StringTable* findString(const Tables& tables, int port, int channel)
+    {
+        const int numStrings = tables.numStrings < maxStrings ? tables.numStrings : maxStrings;
+        for (int i = 0; i < numStrings; i++)
+            if (tables.strings[i].port == port && tables.strings[i].channel == channel)
+                return &tables.strings[i];
+        return nullptr;
+    }
+
+    /** What a string's table has for a note, invalidNote if it's outside the table */
+    inline uint16_t getEntry(const StringTable& string, int note)
+    {
+        const int index = note - string.firstNote;
+        const int numNotes = string.numNotes < maxNotes ? string.numNotes : maxNotes;
+        return index >= 0 && index < numNotes ? string.notes[index] : invalidNote;
+    }
+
+    /** The pitch bend for any frequency inside the string's curve, interpolated the same way the
+        note tables were. -1 if it's outside */
+    inline int getBendForFrequency(const StringTable& string, double frequency)
+    {
+        const int numPoints = string.numCurvePoints < maxCurvePoints ? string.numCurvePoints : maxCurvePoints;
+        for (int i = 1; i < numPoints; i++)
+        {
+            const double low = string.curveFrequencies[i-1], high = string.curveFrequencies[i];
+            if (frequency >= low && frequency < high)
+            {
+                const double c = (frequency - low) / (high - low);
+                return (int) (string.curveBends[i-1] + (string.curveBends[i] - string.curveBends[i-1]) * c);
+            }
+        }
+        return -1;
+    }
+
+    //==========================================================================================
+    /** Maps the segment read-only. Reading is lock-free and never waits on the publisher */
+    class Reader
+    {
+    public:
+        Reader() : segment(nullptr), error("Not open") {}
+        ~Reader() { close(); }
+
+        /** Fails if there's no publisher yet, or it's a different version */
+        bool open(const char* name = defaultName)
+        {
+            close();
+            const int fd = shm_open(name, O_RDONLY, 0);
+            if (fd < 0)
+                return fail(errno == ENOENT ? "Nothing published under that name" : std::strerror(errno));
+
+            struct stat info;
+            if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(Segment))
+            {
+                ::close(fd);
+                return fail("Not published yet");
+            }
+
+            void* mapped = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+            const int mapError = errno;
+            ::close(fd); // the mapping keeps it
+            if (mapped == MAP_FAILED)
+                return fail(std::strerror(mapError));
+
+            segment = static_cast<const Segment*>(mapped);
+            if (segment->magic != magic || segment->version != version || segment->size != sizeof(Segment))
+            {
+                close();
+                return fail("Published by a different version");
+            }
+            error = nullptr;
+            return true;
+        }
+
+        void close()
+        {
+            if (segment != nullptr)
+                munmap(const_cast<Segment*>(segment), sizeof(Segment));
+            segment = nullptr;
+        }
+
+        bool isOpen() const              { return segment != nullptr; }
+        /** Why open() failed */
+        const char* getError() const     { return error; }
+
+        /** Calls function(const Tables&) on the tables where they are, again if they were being
+            written at the time, until it gets a consistent look at them. The function can see a
+            half-written segment before it's thrown away, so it should only read, clamp what it
+            indexes with, and keep what it found somewhere it can be overwritten. False if they were
+            being written every time it tried, which takes a publisher that never stops (or died
+            mid-write) */
+        template <typename Function>
+        bool read(Function function, int maxAttempts = 1000) const
+        {
+            if (segment == nullptr)
+                return false;
+            for (int attempt = 0; attempt < maxAttempts; attempt++)
+            {
+                const uint32_t before = segment->sequence.load(std::memory_order_acquire);
+                if ((before & 1) == 0)
+                {
+                    function(segment->tables);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (segment->sequence.load(std::memory_order_relaxed) == before)
+                        return true;
+                }
+            }
+            return false;
+        }
+
+        /** Changes every time the tables do, cheap enough to poll from anywhere */
+        uint32_t getSequence() const
+        {
+            return segment != nullptr ? segment->sequence.load(std::memory_order_acquire) : 0;
+        }
+
+        /** A consistent copy, of the strings that are published and not the rest of the slots */
+        bool copy(Tables& destination) const
+        {
+            return read([&destination] (const Tables& tables)
+                        {
+                            const int numStrings = tables.numStrings < 0 ? 0 : tables.numStrings < maxStrings ? tables.numStrings : maxStrings;
+                            std::memcpy(&destination, &tables, offsetof(Tables, strings) + numStrings * sizeof(StringTable));
+                        });
+        }
+
+        /** What the table has for a note on a port and channel, false if it hasn't got that string */
+        bool lookup(int port, int channel, int note, uint16_t& entry) const
+        {
+            bool found = false;
+            return read([&] (const Tables& tables)
+                        {
+                            const StringTable* string = findString(tables, port, channel);
+                            found = string != nullptr;
+                            entry = found ? getEntry(*string, note) : invalidNote;
+                        })
+                   && found;
+        }
+
+    private:
+        const Segment* segment;
+        const char* error;
+
+        bool fail(const char* why)
+        {
+            error = why;
+            return false;
+        }
+
+        Reader(const Reader&);
+        Reader& operator= (const Reader&);
+    };
+}
+
+#endif /* defined(__SwivelAutotune__SwivelTables__) */
@@ -0,0 +1,145 @@
+//
+//  TablePublisher.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include <cerrno>
+#include <cstring>
+#include "TablePublisher.h"
+
+TablePublisher::TablePublisher()
+:   segment(nullptr)
+{
+
+}
+
+TablePublisher::~TablePublisher()
+{
+    close();
+}
+
+Result TablePublisher::open(const String& segmentName)
+{
+    close();
+    const int fd = shm_open(segmentName.toRawUTF8(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return Result::fail("Couldn't create the shared memory " + segmentName + ": " + String(strerror(errno)));
+
+    if (ftruncate(fd, sizeof(SwivelTables::Segment)) != 0)
+    {
+        const int error = errno;
+        ::close(fd);
+        return Result::fail("Couldn't size the shared memory " + segmentName + ": " + String(strerror(error)));
+    }
+
+    void* mapped = mmap(nullptr, sizeof(SwivelTables::Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        return Result::fail("Couldn't map the shared memory " + segmentName + ": " + String(strerror(error)));
+
+    segment = static_cast<SwivelTables::Segment*>(mapped);
+    name = segmentName;
+
+    // a previous run's is carried on from, so readers that kept it open see the new tables
+    if (segment->magic != SwivelTables::magic || segment->version != SwivelTables::version
+        || segment->size != sizeof(SwivelTables::Segment) || (segment->sequence.load() & 1) != 0)
+    {
+        // new (ftruncate zeroed it) or not ours, either way readers aren't looking at it yet
+        segment->sequence.store(0);
+        zerostruct(segment->tables);
+        segment->version = SwivelTables::version;
+        segment->size = sizeof(SwivelTables::Segment);
+        std::atomic_thread_fence(std::memory_order_release);
+        segment->magic = SwivelTables::magic;
+    }
+    withdraw();
+    return Result::ok();
+}
+
+void TablePublisher::close()
+{
+    if (segment == nullptr)
+        return;
+    withdraw();
+    munmap(segment, sizeof(SwivelTables::Segment));
+    segment = nullptr;
+}
+
+bool TablePublisher::isOpen() const
+{
+    return segment != nullptr;
+}
+
+String TablePublisher::getName() const
+{
+    return name;
+}
+
+uint32 TablePublisher::getGeneration() const
+{
+    return segment != nullptr ? segment->tables.generation : 0;
+}
+
+//==============================================================================================
+void TablePublisher::publish(const OwnedArray<SwivelString, CriticalSection>& strings)
+{
+    if (segment == nullptr)
+        return;
+
+    const ScopedLock sl(strings.getLock());
+    beginWrite();
+    SwivelTables::Tables& tables = segment->tables;
+    int published = 0;
+    for (SwivelString* string : strings)
+    {
+        // a string whose pitch was outside its measurements is "ready" without a table
+        if (!string->isReadyToTransform() || string->getNumCurvePoints() == 0 || published == SwivelTables::maxStrings)
+            continue;
+
+        SwivelTables::StringTable& entry = tables.strings[published++];
+        entry.port = string->getMidiPort();
+        entry.channel = string->getMidiChannel();
+        entry.openFrequency = string->getBestFreq();
+
+        entry.firstNote = string->getFirstNote();
+        entry.numNotes = jmin(string->getNumNotes(), SwivelTables::maxNotes);
+        for (int i = 0; i < entry.numNotes; i++)
+            entry.notes[i] = string->getTableEntry(entry.firstNote + i);
+
+        entry.numCurvePoints = jmin(string->getNumCurvePoints(), SwivelTables::maxCurvePoints);
+        for (int i = 0; i < entry.numCurvePoints; i++)
+        {
+            entry.curveBends[i] = string->getCurveBend(i);
+            entry.curveFrequencies[i] = string->getCurveFrequency(i);
+        }
+    }
+    tables.numStrings = published;
+    endWrite();
+}
+
+void TablePublisher::withdraw()
+{
+    if (segment == nullptr)
+        return;
+    beginWrite();
+    segment->tables.numStrings = 0;
+    endWrite();
+}
+
+void TablePublisher::beginWrite()
+{
+    // odd, so anyone reading now throws away what they read
+    segment->sequence.store(segment->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void TablePublisher::endWrite()
+{
+    segment->tables.generation++;
+    segment->tables.publishedAt = (double) Time::currentTimeMillis();
+    segment->sequence.store(segment->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
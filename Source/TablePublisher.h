@@ -0,0 +1,53 @@
+//
+//  TablePublisher.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__TablePublisher__
+#define __SwivelAutotune__TablePublisher__
+
+#include "CoreJuceHeader.h"
+#include "String.h"
+#include "SwivelTables.h"
+
+/** Writes the strings' note tables and bend curves into the shared memory segment SwivelTables.h
+    reads, for sequencers that do their own retargeting. Call publish() whenever the tables have
+    been remade, readers see them as soon as it returns. Only one thread should publish.
+ */
+class TablePublisher
+{
+public:
+    TablePublisher();
+    /** Withdraws the strings, the segment stays for the next run */
+    ~TablePublisher();
+
+    /** Creates the segment, or takes over the one a previous run left. The name is a POSIX shared
+        memory name, "/something" */
+    Result open(const String& name = SwivelTables::defaultName);
+    void close();
+    bool isOpen() const;
+    String getName() const;
+
+    /** Copies in every string that's got a lookup table. Not while any of them are being calibrated */
+    void publish(const OwnedArray<SwivelString, CriticalSection>& strings);
+    /** Publishes no strings, for when the tables aren't to be trusted any more */
+    void withdraw();
+
+    /** How many times it's been published, including by previous runs */
+    uint32 getGeneration() const;
+
+private:
+    String name;
+    SwivelTables::Segment* segment;
+
+    /** Everything inside these goes out as one update */
+    void beginWrite();
+    void endWrite();
+
+    JUCE_DECLARE_NON_COPYABLE (TablePublisher)
+};
+
+#endif /* defined(__SwivelAutotune__TablePublisher__) */
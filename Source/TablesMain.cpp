@@ -0,0 +1,129 @@
+//
+//  TablesMain.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//  Prints the note tables and bend curves published by swivel-headless (tables.shm) or the app,
+//  see SwivelTables.h. With --watch it prints them again every time they change, until SIGINT.
+//  Only uses SwivelTables.h and the standard library, the same as a sequencer would.
+//
+//      swivel-tables [--name /swivel-tables] [--watch]
+//
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include "SwivelTables.h"
+
+namespace
+{
+    volatile std::sig_atomic_t quitRequested = 0;
+
+    void requestQuit(int)
+    {
+        quitRequested = 1;
+    }
+
+    struct Options
+    {
+        std::string name = SwivelTables::defaultName;
+        bool watch = false;
+    };
+
+    bool parseOptions(int argc, char* argv[], Options& options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg(argv[i]);
+            if (arg == "--watch")
+                options.watch = true;
+            else if (arg == "--name" && i + 1 < argc)
+                options.name = argv[++i];
+            else
+            {
+                std::cerr << "Usage: swivel-tables [--name /swivel-tables] [--watch]" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string describeEntry(uint16_t entry)
+    {
+        switch (entry)
+        {
+            case SwivelTables::openNote:      return "open";
+            case SwivelTables::offStringNote: return "off";
+            case SwivelTables::invalidNote:   return "-";
+            default:                          return std::to_string(entry);
+        }
+    }
+
+    void print(const SwivelTables::Tables& tables)
+    {
+        std::cout << "Generation " << tables.generation << ", " << tables.numStrings << " strings" << std::endl;
+        for (int i = 0; i < tables.numStrings && i < SwivelTables::maxStrings; i++)
+        {
+            const SwivelTables::StringTable& string = tables.strings[i];
+            std::cout << "Port " << string.port << " channel " << string.channel << " at "
+                      << std::fixed << std::setprecision(2) << string.openFrequency << "Hz" << std::endl;
+
+            std::cout << "    notes from " << string.firstNote << ":";
+            for (int n = 0; n < string.numNotes && n < SwivelTables::maxNotes; n++)
+                std::cout << " " << describeEntry(string.notes[n]);
+            std::cout << std::endl;
+
+            std::cout << "    curve:";
+            for (int p = 0; p < string.numCurvePoints && p < SwivelTables::maxCurvePoints; p++)
+                std::cout << " " << string.curveBends[p] << "@" << string.curveFrequencies[p] << "Hz";
+            std::cout << std::endl;
+        }
+    }
+}
+
+//==============================================================================================
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+
+    std::signal(SIGINT, requestQuit);
+    std::signal(SIGTERM, requestQuit);
+
+    SwivelTables::Reader reader;
+    if (!reader.open(options.name.c_str()))
+    {
+        std::cerr << "Couldn't open " << options.name << ": " << reader.getError() << std::endl;
+        return 1;
+    }
+
+    // too big for the stack, and the reader wants somewhere it can overwrite
+    std::unique_ptr<SwivelTables::Tables> tables(new SwivelTables::Tables());
+    uint32_t printed = 1; // never a sequence that can be read
+    do
+    {
+        const uint32_t sequence = reader.getSequence();
+        if (sequence != printed && (sequence & 1) == 0)
+        {
+            if (!reader.copy(*tables))
+            {
+                std::cerr << "The tables are stuck half-written" << std::endl;
+                return 1;
+            }
+            print(*tables);
+            printed = sequence;
+        }
+        if (options.watch)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    while (options.watch && !quitRequested);
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+//
+//  ThreadScheduling.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "ThreadScheduling.h"
+
+#if JUCE_LINUX
+ #include <pthread.h>
+ #include <sched.h>
+ #include <sys/mman.h>
+ #include <sys/resource.h>
+ #include <cerrno>
+ #include <cstring>
+#endif
+
+ThreadScheduling::ThreadScheduling()
+:   policy(unchanged),
+    priority(0),
+    cpus(0)
+{
+
+}
+
+Result ThreadScheduling::parsePolicy(const String& text)
+{
+    const String name = text.upToFirstOccurrenceOf(":", false, false).trim().toLowerCase();
+    const String level = text.fromFirstOccurrenceOf(":", false, false).trim();
+
+    if (name == "other" || name == "normal")
+    {
+        policy = normal;
+        priority = 0;
+        return Result::ok();
+    }
+    if (name == "fifo")
+        policy = fifo;
+    else if (name == "rr")
+        policy = roundRobin;
+    else
+        return Result::fail("Scheduling should be other, fifo:<priority> or rr:<priority>, not " + text);
+
+    priority = level.getIntValue();
+    if (!level.containsOnly("0123456789") || priority < 1 || priority > 99)
+        return Result::fail("Realtime priority should be 1-99: " + text);
+    return Result::ok();
+}
+
+Result ThreadScheduling::parseCpus(const String& text)
+{
+    cpus = 0;
+    StringArray parts;
+    parts.addTokens(text, ",", String::empty);
+    parts.trim();
+    parts.removeEmptyStrings();
+
+    for (const String& part : parts)
+    {
+        const int first = part.upToFirstOccurrenceOf("-", false, false).getIntValue();
+        const int last = part.containsChar('-') ? part.fromFirstOccurrenceOf("-", false, false).getIntValue() : first;
+        if (!part.containsOnly("0123456789-") || first > last || !isPositiveAndBelow(last, 64))
+            return Result::fail("CPUs should be numbers 0-63 or ranges like 2-3: " + text);
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus |= (uint64) 1 << cpu;
+    }
+    return Result::ok();
+}
+
+String ThreadScheduling::toString() const
+{
+    String text;
+    switch (policy)
+    {
+        case unchanged:  text = "unchanged"; break;
+        case normal:     text = "other"; break;
+        case fifo:       text = "fifo:" + String(priority); break;
+        case roundRobin: text = "rr:" + String(priority); break;
+    }
+
+    if (cpus != 0)
+    {
+        text << " on cpus ";
+        String separator;
+        for (int cpu = 0; cpu < 64; cpu++)
+            if ((cpus >> cpu) & 1)
+            {
+                text << separator << cpu;
+                separator = ",";
+            }
+    }
+    return text;
+}
+
+bool ThreadScheduling::isDefault() const
+{
+    return policy == unchanged && cpus == 0;
+}
+
+//==============================================================================================
+int ThreadScheduling::apply(bool& failedOnCpus) const
+{
+    failedOnCpus = false;
+#if JUCE_LINUX
+    if (policy != unchanged)
+    {
+        sched_param param;
+        zerostruct(param);
+        param.sched_priority = policy == normal ? 0 : priority;
+        const int which = policy == fifo ? SCHED_FIFO : policy == roundRobin ? SCHED_RR : SCHED_OTHER;
+        if (const int error = pthread_setschedparam(pthread_self(), which, &param))
+            return error;
+    }
+
+    if (cpus != 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < 64; cpu++)
+            if ((cpus >> cpu) & 1)
+                CPU_SET(cpu, &set);
+        if (const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        {
+            failedOnCpus = true;
+            return error;
+        }
+    }
+    return 0;
+#else
+    return isDefault() ? 0 : -1;
+#endif
+}
+
+String ThreadScheduling::describeFailure(int error, bool failedOnCpus)
+{
+#if JUCE_LINUX
+    if (failedOnCpus)
+        return error == EINVAL ? String("none of those CPUs are available to this process")
+                               : String("couldn't set the CPUs: ") + String(strerror(error));
+    if (error == EPERM)
+    {
+        rlimit limit;
+        const bool haveLimit = getrlimit(RLIMIT_RTPRIO, &limit) == 0;
+        return "not allowed realtime scheduling (RLIMIT_RTPRIO is " + String(haveLimit ? (int64) limit.rlim_cur : 0)
+               + "). Run with CAP_SYS_NICE or raise the limit, eg. \"@audio - rtprio 95\" in /etc/security/limits.conf";
+    }
+    return String("couldn't set the scheduling: ") + String(strerror(error));
+#else
+    ignoreUnused(error, failedOnCpus);
+    return "thread scheduling can only be changed on Linux";
+#endif
+}
+
+Result ThreadScheduling::applyToCurrentThread() const
+{
+    bool failedOnCpus;
+    const int error = apply(failedOnCpus);
+    return error == 0 ? Result::ok() : Result::fail(describeFailure(error, failedOnCpus));
+}
+
+Result ThreadScheduling::lockMemory()
+{
+#if JUCE_LINUX
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        return Result::ok();
+
+    const int error = errno;
+    if (error == EPERM || error == ENOMEM)
+        return Result::fail(String("Couldn't lock memory: ") + String(strerror(error))
+                            + ". Run with CAP_IPC_LOCK or raise the limit, eg. \"@audio - memlock unlimited\" in /etc/security/limits.conf");
+    return Result::fail(String("Couldn't lock memory: ") + String(strerror(error)));
+#else
+    return Result::fail("Memory can only be locked on Linux");
+#endif
+}
+
+//==============================================================================================
+ThreadScheduling::AudioCallback::AudioCallback(const ThreadScheduling& s)
+:   scheduling(s),
+    applied(false),
+    status(-1),
+    failedOnCpus(false)
+{
+
+}
+
+Result ThreadScheduling::AudioCallback::getResult() const
+{
+    const int error = status.load(std::memory_order_acquire);
+    if (error < 0)
+        return Result::fail("the audio device hasn't called back yet");
+    return error == 0 ? Result::ok() : Result::fail(describeFailure(error, failedOnCpus));
+}
+
+bool ThreadScheduling::AudioCallback::hasTried() const
+{
+    return status.load(std::memory_order_acquire) >= 0;
+}
+
+void ThreadScheduling::AudioCallback::audioDeviceIOCallback(const float**, int, float** outputChannelData, int numOutputChannels, int numSamples)
+{
+    if (!applied)
+    {
+        // a couple of syscalls, once
+        applied = true;
+        bool cpusFailed;
+        const int error = scheduling.apply(cpusFailed);
+        failedOnCpus = cpusFailed;
+        status.store(error, std::memory_order_release);
+    }
+
+    for (int i = 0; i < numOutputChannels; i++)
+        if (outputChannelData[i] != nullptr)
+            zeromem(outputChannelData[i], sizeof(float) * (size_t) numSamples);
+}
+
+void ThreadScheduling::AudioCallback::audioDeviceAboutToStart(AudioIODevice*)
+{
+    // a restarted device may well have a new thread
+    applied = false;
+}
+
+void ThreadScheduling::AudioCallback::audioDeviceStopped()
+{
+
+}
@@ -0,0 +1,91 @@
+//
+//  ThreadScheduling.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__ThreadScheduling__
+#define __SwivelAutotune__ThreadScheduling__
+
+#include <atomic>
+#include "CoreJuceHeader.h"
+
+/** How one of our threads should be scheduled: the policy and realtime priority, and which CPUs
+    it's allowed on, so it doesn't get pushed aside by whatever else the machine is doing.
+    Linux only, elsewhere anything but the default fails saying so.
+ 
+    Realtime policies and locking memory need privileges most users don't have by default, so
+    failures say which one is missing rather than just passing errno on.
+ */
+class ThreadScheduling
+{
+public:
+    enum Policy
+    {
+        unchanged = 0, // whatever JUCE set up
+        normal,        // SCHED_OTHER
+        fifo,          // SCHED_FIFO
+        roundRobin     // SCHED_RR
+    };
+
+    ThreadScheduling();
+
+    /** "other", "fifo:80" or "rr:50" */
+    Result parsePolicy(const String& text);
+    /** A comma separated list of CPUs and ranges, eg. "0,2-3". Empty for any */
+    Result parseCpus(const String& text);
+    /** The same format back again */
+    String toString() const;
+    /** Nothing to do */
+    bool isDefault() const;
+
+    /** Applies it to the thread that calls this */
+    Result applyToCurrentThread() const;
+
+    /** Locks the process's memory, now and whatever it gets later, so nothing on the realtime
+        threads waits on a page fault */
+    static Result lockMemory();
+
+    /** Puts the audio device's thread on a scheduling, see below */
+    class AudioCallback;
+
+private:
+    Policy policy;
+    int priority; // 1-99 for the realtime ones
+    uint64 cpus; // a bit for each, 0 for any
+
+    /** The bit that doesn't allocate, returns 0 or the errno, and whether it was the affinity that failed */
+    int apply(bool& failedOnCpus) const;
+    static String describeFailure(int error, bool failedOnCpus);
+};
+
+//==============================================================================================
+/** Puts the audio device's own thread on the given scheduling, from its first callback after
+    starting, since that's the only time we're on it. Add it to the AudioDeviceManager like any
+    other callback. Nothing's allocated in the callback, the result is picked up with getResult() */
+class ThreadScheduling::AudioCallback : public AudioIODeviceCallback
+{
+public:
+    AudioCallback(const ThreadScheduling& scheduling);
+
+    /** ok once it's applied, a failure if it couldn't be, or if it hasn't been yet */
+    Result getResult() const;
+    bool hasTried() const;
+
+    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                               float** outputChannelData, int numOutputChannels, int numSamples) override;
+    void audioDeviceAboutToStart(AudioIODevice* device) override;
+    void audioDeviceStopped() override;
+
+private:
+    const ThreadScheduling scheduling;
+    bool applied; // only the audio thread touches this
+    std::atomic<int> status; // -1 not tried yet, 0 ok, otherwise errno
+    std::atomic<bool> failedOnCpus;
+
+    JUCE_DECLARE_NON_COPYABLE (AudioCallback)
+};
+
+#endif /* defined(__SwivelAutotune__ThreadScheduling__) */
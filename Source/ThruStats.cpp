@@ -0,0 +1,215 @@
+//
+//  ThruStats.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "ThruStats.h"
+
+LatencyHistogram::LatencyHistogram()
+:   total(0),
+    max(0)
+{
+    for (int i = 0; i < numBuckets; i++)
+        counts[i].store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::record(int64 microseconds)
+{
+    // only one writer, so no need for anything stronger than relaxed adds
+    counts[bucketFor(microseconds)].fetch_add(1, std::memory_order_relaxed);
+    if (microseconds > max.load(std::memory_order_relaxed))
+        max.store(microseconds, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_release);
+}
+
+int64 LatencyHistogram::getCount() const
+{
+    return total.load(std::memory_order_acquire);
+}
+
+int64 LatencyHistogram::getMax() const
+{
+    return max.load(std::memory_order_relaxed);
+}
+
+uint32 LatencyHistogram::getCountIn(int bucket) const
+{
+    return counts[bucket].load(std::memory_order_relaxed);
+}
+
+int64 LatencyHistogram::getValueAtPercentile(double percentile) const
+{
+    // the buckets may be a message or two ahead of the total, near enough
+    const int64 count = getCount();
+    if (count == 0)
+        return 0;
+
+    const int64 wanted = jmax((int64) 1, (int64) std::ceil(count * percentile / 100.0));
+    int64 seen = 0;
+    for (int i = 0; i < numBuckets; i++)
+    {
+        seen += getCountIn(i);
+        if (seen >= wanted)
+            return jmin(highestValueIn(i), getMax());
+    }
+    return getMax();
+}
+
+//==============================================================================================
+int LatencyHistogram::bucketFor(int64 microseconds)
+{
+    const int64 subBuckets = 1 << subBucketBits;
+    const int64 half = subBuckets / 2;
+
+    int64 value = jlimit((int64) 0, ((int64) 1 << maxBits) - 1, microseconds);
+    if (value < subBuckets)
+        return (int) value;
+
+    // halve it until it fits in the top half of the sub-buckets, the number of halvings picks the set
+    int shift = 0;
+    while ((value >> shift) >= subBuckets)
+        shift++;
+    return (int) (subBuckets + (shift-1) * half + ((value >> shift) - half));
+}
+
+int64 LatencyHistogram::lowestValueIn(int bucket)
+{
+    const int subBuckets = 1 << subBucketBits;
+    const int half = subBuckets / 2;
+    if (bucket < subBuckets)
+        return bucket;
+
+    const int shift = (bucket - subBuckets) / half + 1;
+    return (int64) ((bucket - subBuckets) % half + half) << shift;
+}
+
+int64 LatencyHistogram::highestValueIn(int bucket)
+{
+    return bucket + 1 < numBuckets ? lowestValueIn(bucket + 1) - 1 : ((int64) 1 << maxBits) - 1;
+}
+
+//==============================================================================================
+ThruStats::ThruStats(int ports)
+:   numPorts(ports),
+    lastCounts((size_t) ports * 16 + 1, true),
+    lastTime(Time::getMillisecondCounterHiRes())
+{
+    // all up front, the thru's thread can't allocate
+    for (int i = 0; i < numPorts * 16; i++)
+        strings.add(new LatencyHistogram());
+}
+
+void ThruStats::record(int port, int channel, double received, double sent)
+{
+    const int64 microseconds = (int64) ((sent - received) * 1.0e6 + 0.5);
+    overall.record(microseconds);
+    if (isPositiveAndBelow(port, numPorts) && isPositiveAndBelow(channel - 1, 16))
+        strings.getUnchecked(port * 16 + channel - 1)->record(microseconds);
+}
+
+const LatencyHistogram& ThruStats::getOverall() const
+{
+    return overall;
+}
+
+void ThruStats::takeRates(HeapBlock<double>& rates)
+{
+    const double now = Time::getMillisecondCounterHiRes();
+    const double seconds = jmax(0.001, (now - lastTime) / 1000.0);
+    lastTime = now;
+
+    const int n = strings.size();
+    rates.malloc((size_t) n + 1);
+    for (int i = 0; i <= n; i++)
+    {
+        const int64 count = i < n ? strings[i]->getCount() : overall.getCount();
+        rates[i] = (count - lastCounts[i]) / seconds;
+        lastCounts[i] = count;
+    }
+}
+
+String ThruStats::getSummary()
+{
+    const ScopedLock sl(readLock);
+    HeapBlock<double> rates;
+    takeRates(rates);
+
+    String summary;
+    summary << String("string").paddedRight(' ', 8) << String("messages").paddedLeft(' ', 10) << String("msg/s").paddedLeft(' ', 10)
+            << String("p50").paddedLeft(' ', 9) << String("p90").paddedLeft(' ', 9) << String("p99").paddedLeft(' ', 9)
+            << String("p99.9").paddedLeft(' ', 9) << String("max").paddedLeft(' ', 9) << " (us)\n";
+    for (int i = 0; i <= strings.size(); i++)
+    {
+        const LatencyHistogram& histogram = i < strings.size() ? *strings[i] : overall;
+        if (histogram.getCount() == 0 && i < strings.size())
+            continue;
+
+        const String name = i < strings.size() ? String(i / 16) + "/" + String(i % 16 + 1) : String("all");
+        summary << name.paddedRight(' ', 8)
+                << String(histogram.getCount()).paddedLeft(' ', 10)
+                << String(rates[i], 1).paddedLeft(' ', 10)
+                << String(histogram.getValueAtPercentile(50.0)).paddedLeft(' ', 9)
+                << String(histogram.getValueAtPercentile(90.0)).paddedLeft(' ', 9)
+                << String(histogram.getValueAtPercentile(99.0)).paddedLeft(' ', 9)
+                << String(histogram.getValueAtPercentile(99.9)).paddedLeft(' ', 9)
+                << String(histogram.getMax()).paddedLeft(' ', 9) << "\n";
+    }
+    return summary;
+}
+
+Result ThruStats::dump(const File& file)
+{
+    const ScopedLock sl(readLock);
+    HeapBlock<double> rates;
+    takeRates(rates);
+
+    Array<var> entries;
+    for (int i = 0; i <= strings.size(); i++)
+    {
+        const LatencyHistogram& histogram = i < strings.size() ? *strings[i] : overall;
+        if (histogram.getCount() == 0 && i < strings.size())
+            continue;
+
+        DynamicObject* entry = new DynamicObject();
+        if (i < strings.size())
+        {
+            entry->setProperty("midi_port", i / 16);
+            entry->setProperty("midi_channel", i % 16 + 1);
+        }
+        entry->setProperty("messages", histogram.getCount());
+        entry->setProperty("messages_per_second", rates[i]);
+        entry->setProperty("p50_us", histogram.getValueAtPercentile(50.0));
+        entry->setProperty("p90_us", histogram.getValueAtPercentile(90.0));
+        entry->setProperty("p99_us", histogram.getValueAtPercentile(99.0));
+        entry->setProperty("p999_us", histogram.getValueAtPercentile(99.9));
+        entry->setProperty("max_us", histogram.getMax());
+
+        // [lowest value in the bucket, count] for each bucket that has anything in it
+        Array<var> buckets;
+        for (int b = 0; b < LatencyHistogram::numBuckets; b++)
+        {
+            if (const uint32 count = histogram.getCountIn(b))
+            {
+                Array<var> bucket;
+                bucket.add(LatencyHistogram::lowestValueIn(b));
+                bucket.add((int64) count);
+                buckets.add(bucket);
+            }
+        }
+        entry->setProperty("histogram", buckets);
+        entries.add(var(entry));
+    }
+
+    DynamicObject* root = new DynamicObject();
+    root->setProperty("all", entries.getLast());
+    entries.removeLast();
+    root->setProperty("strings", entries);
+
+    // on one line, spread out the histograms would go on for pages
+    if (!file.replaceWithText(JSON::toString(var(root), true)))
+        return Result::fail("Couldn't write " + file.getFullPathName());
+    return Result::ok();
+}
@@ -0,0 +1,89 @@
+//
+//  ThruStats.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__ThruStats__
+#define __SwivelAutotune__ThruStats__
+
+#include <atomic>
+#include "CoreJuceHeader.h"
+
+/** Counts of latencies in microseconds, in buckets that get wider as the values get bigger
+    (like an HdrHistogram) so it's accurate to under 1% from a microsecond to a minute in a
+    fixed 10KB. One thread records, any others can read at the same time without locking.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    /** Only ever call this from the one thread */
+    void record(int64 microseconds);
+
+    int64 getCount() const;
+    int64 getMax() const;
+    /** The value that the given percentage of the recordings are at or under, to within a bucket */
+    int64 getValueAtPercentile(double percentile) const;
+    /** How many recordings are in the bucket */
+    uint32 getCountIn(int bucket) const;
+
+    static int bucketFor(int64 microseconds);
+    static int64 lowestValueIn(int bucket);
+    static int64 highestValueIn(int bucket);
+
+    // every microsecond has its own bucket up to 2^subBucketBits, then there are half that many per doubling
+    static const int subBucketBits = 8;
+    // 2^maxBits us is about a minute, anything longer goes in the last bucket
+    static const int maxBits = 26;
+    static const int numBuckets = (1 << subBucketBits) + (maxBits - subBucketBits) * (1 << (subBucketBits-1));
+
+private:
+    std::atomic<uint32> counts[numBuckets];
+    std::atomic<int64> total;
+    std::atomic<int64> max;
+
+    JUCE_DECLARE_NON_COPYABLE (LatencyHistogram)
+};
+
+//==============================================================================================
+/** How long each message took to get through the MIDI thru, per string (port and channel) and
+    altogether, from arriving in the input callback to sendMessageNow() returning.
+    The thru's thread records, the GUI or the headless runner read it whenever they like.
+ */
+class ThruStats
+{
+public:
+    ThruStats(int numPorts);
+
+    /** Called by the thru's thread for each message it sends, times in seconds off the hi-res millisecond counter */
+    void record(int port, int channel, double received, double sent);
+
+    /** A table of the strings that have had messages: count, messages per second since the last
+        summary or dump, and percentiles in microseconds. Any thread but the thru's */
+    String getSummary();
+    /** The same as JSON, with each histogram's non-empty buckets */
+    Result dump(const File& file);
+    /** Every string's messages together */
+    const LatencyHistogram& getOverall() const;
+
+private:
+    const int numPorts;
+    OwnedArray<LatencyHistogram> strings; // port * 16 + channel - 1
+    LatencyHistogram overall;
+
+    // for the rates, only the readers touch these
+    CriticalSection readLock;
+    HeapBlock<int64> lastCounts; // the last index is overall's
+    double lastTime;
+
+    /** Works out the rates since last time, in the same order as lastCounts */
+    void takeRates(HeapBlock<double>& rates);
+
+    JUCE_DECLARE_NON_COPYABLE (ThruStats)
+};
+
+#endif /* defined(__SwivelAutotune__ThruStats__) */
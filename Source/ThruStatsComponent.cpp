@@ -0,0 +1,78 @@
+//
+//  ThruStatsComponent.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "ThruStatsComponent.h"
+
+ThruStatsComponent::ThruStatsComponent(ThruStats& s)
+:   stats(s),
+    dumpButton("Save..."),
+    lastCount(-1),
+    showingQuiet(false)
+{
+    table.setMultiLine(true);
+    table.setReadOnly(true);
+    table.setFont(Font(Font::getDefaultMonospacedFontName(), 12.0f, Font::plain));
+    addAndMakeVisible(&table);
+    
+    dumpButton.setTooltip("Save the latency histograms of every string as JSON");
+    dumpButton.addListener(this);
+    addAndMakeVisible(&dumpButton);
+}
+
+void ThruStatsComponent::resized()
+{
+    table.setBounds(0, 0, getWidth()-90, getHeight());
+    dumpButton.setBounds(getWidth()-85, 0, 85, 20);
+}
+
+void ThruStatsComponent::visibilityChanged()
+{
+    // the tabs hide whichever one isn't selected, so the timer only runs while this one is
+    if (isVisible())
+    {
+        refresh();
+        startTimer(1000);
+    }
+    else
+        stopTimer();
+}
+
+void ThruStatsComponent::timerCallback()
+{
+    // no point working it out when nobody can see it
+    if (isShowing())
+        refresh();
+}
+
+void ThruStatsComponent::refresh()
+{
+    // once it's shown the rates dropping to nothing there's nothing new until a message comes
+    const int64 count = stats.getOverall().getCount();
+    if (count == lastCount && showingQuiet)
+        return;
+    
+    showingQuiet = count == lastCount;
+    lastCount = count;
+    table.setText(stats.getSummary(), false);
+}
+
+void ThruStatsComponent::buttonClicked(Button* button)
+{
+    if (&dumpButton == button)
+    {
+        FileChooser chooser("Save thru stats",
+                            File::getCurrentWorkingDirectory().getChildFile("thru-stats.json"),
+                            "*.json");
+        if (chooser.browseForFileToSave(true))
+        {
+            Result result = stats.dump(chooser.getResult());
+            if (!result)
+                AlertWindow::showMessageBoxAsync(AlertWindow::WarningIcon, "Thru stats", result.getErrorMessage());
+        }
+    }
+}
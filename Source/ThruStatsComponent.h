@@ -0,0 +1,45 @@
+//
+//  ThruStatsComponent.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__ThruStatsComponent__
+#define __SwivelAutotune__ThruStatsComponent__
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "ThruStats.h"
+
+/** Shows the MIDI thru's latency percentiles and message rates per string, refreshed every second
+    while it's on screen and anything's coming through, with a button to save the full histograms
+    as JSON. Something to glance at before a show.
+ */
+class ThruStatsComponent : public Component,
+                           private Timer,
+                           Button::Listener
+{
+public:
+    ThruStatsComponent(ThruStats& stats);
+    
+    void resized() override;
+    void visibilityChanged() override;
+    
+private:
+    void timerCallback() override;
+    void buttonClicked(Button* button) override;
+    
+    ThruStats& stats;
+    TextEditor table;
+    TextButton dumpButton;
+    // so nothing's redrawn while the thru is quiet
+    int64 lastCount;
+    bool showingQuiet;
+    
+    void refresh();
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ThruStatsComponent)
+};
+
+#endif /* defined(__SwivelAutotune__ThruStatsComponent__) */
@@ -0,0 +1,170 @@
+//
+//  Trace.cpp
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#include "Trace.h"
+#include <atomic>
+
+namespace
+{
+    struct Event
+    {
+        const char* name;
+        int64 start;
+        int64 end; // -1 for an instant
+    };
+
+    /** One thread's events, only that thread writes and nobody reads until recording has stopped */
+    struct ThreadBuffer
+    {
+        HeapBlock<Event> events;
+        int capacity;
+        std::atomic<int> used;
+        std::atomic<int> dropped;
+        char threadName[64];
+    };
+
+    ThreadBuffer buffers[Trace::maxThreads];
+    std::atomic<int> numClaimed(0);
+    std::atomic<int> session(0); // goes up with each start(), so threads know their buffer is from an old one
+    std::atomic<bool> recording(false);
+    int64 startTicks = 0;
+
+    thread_local ThreadBuffer* local = nullptr;
+    thread_local int localSession = -1;
+
+    ThreadBuffer* getBuffer() noexcept
+    {
+        const int current = session.load(std::memory_order_acquire);
+        if (localSession != current)
+        {
+            localSession = current;
+            const int index = numClaimed.fetch_add(1);
+            local = index < Trace::maxThreads ? &buffers[index] : nullptr;
+            if (local != nullptr)
+            {
+                // copying a String only bumps its reference count, so this is still safe in a callback
+                if (Thread* thread = Thread::getCurrentThread())
+                    thread->getThreadName().copyToUTF8(local->threadName, sizeof(local->threadName));
+                else
+                    snprintf(local->threadName, sizeof(local->threadName), "Thread %d", index);
+            }
+        }
+        return local;
+    }
+
+    void add(const char* name, int64 start, int64 end) noexcept
+    {
+        if (ThreadBuffer* buffer = getBuffer())
+        {
+            const int n = buffer->used.load(std::memory_order_relaxed);
+            if (n >= buffer->capacity)
+            {
+                buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            Event& event = buffer->events[n];
+            event.name = name;
+            event.start = start;
+            event.end = end;
+            buffer->used.store(n+1, std::memory_order_release);
+        }
+    }
+
+    double toMicroseconds(int64 ticks)
+    {
+        return (ticks - startTicks) * 1.0e6 / Time::getHighResolutionTicksPerSecond();
+    }
+}
+
+//==============================================================================================
+Trace::ScopedEvent::ScopedEvent(const char* n) noexcept
+:   name(n),
+    start(recording.load(std::memory_order_relaxed) ? Time::getHighResolutionTicks() : 0)
+{
+
+}
+
+Trace::ScopedEvent::~ScopedEvent() noexcept
+{
+    if (start != 0 && recording.load(std::memory_order_relaxed))
+        add(name, start, Time::getHighResolutionTicks());
+}
+
+void Trace::instant(const char* name) noexcept
+{
+    if (recording.load(std::memory_order_relaxed))
+        add(name, Time::getHighResolutionTicks(), -1);
+}
+
+//==============================================================================================
+void Trace::start(int eventsPerThread)
+{
+    recording = false;
+    for (ThreadBuffer& buffer : buffers)
+    {
+        if (buffer.capacity != eventsPerThread)
+            buffer.events.malloc((size_t) eventsPerThread);
+        buffer.capacity = eventsPerThread;
+        buffer.used = 0;
+        buffer.dropped = 0;
+        buffer.threadName[0] = 0;
+    }
+    numClaimed = 0;
+    startTicks = Time::getHighResolutionTicks();
+    session++;
+    recording = true;
+}
+
+void Trace::stop()
+{
+    recording = false;
+}
+
+bool Trace::isRecording() noexcept
+{
+    return recording.load(std::memory_order_relaxed);
+}
+
+Result Trace::writeJson(const File& file)
+{
+    file.deleteFile();
+    FileOutputStream out(file);
+    if (out.failedToOpen())
+        return Result::fail("Couldn't write " + file.getFullPathName());
+
+    // one line per event, complete events ("X") for scopes and thread-scoped instants ("i")
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    const int threads = jmin(numClaimed.load(), (int) maxThreads);
+    for (int t = 0; t < threads; t++)
+    {
+        const ThreadBuffer& buffer = buffers[t];
+        const int used = buffer.used.load(std::memory_order_acquire);
+
+        out << (first ? "" : ",\n")
+            << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << (t+1)
+            << ", \"args\": {\"name\": " << JSON::toString(String(CharPointer_UTF8(buffer.threadName)))
+            << ", \"dropped\": " << buffer.dropped.load() << "}}";
+        first = false;
+
+        for (int i = 0; i < used; i++)
+        {
+            const Event& event = buffer.events[i];
+            out << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"swivel\", \"pid\": 1, \"tid\": " << (t+1)
+                << ", \"ts\": " << String(toMicroseconds(event.start), 1);
+            if (event.end < 0)
+                out << ", \"ph\": \"i\", \"s\": \"t\"}";
+            else
+                out << ", \"ph\": \"X\", \"dur\": " << String(toMicroseconds(event.end) - toMicroseconds(event.start), 1) << "}";
+        }
+    }
+    out << "\n]}\n";
+    out.flush();
+
+    return out.getStatus();
+}
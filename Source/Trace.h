@@ -0,0 +1,54 @@
+//
+//  Trace.h
+//  SwivelAutotune
+//
+//  Created by Paul Francis Cunninghame Mathews on 19/10/26.
+//
+//
+
+#ifndef __SwivelAutotune__Trace__
+#define __SwivelAutotune__Trace__
+
+#include "CoreJuceHeader.h"
+
+/** A timeline of where a calibration's time goes, saved as Chrome trace event JSON for
+    chrome://tracing or ui.perfetto.dev.
+
+    Each thread records into its own fixed buffer, claimed the first time it records anything
+    after start(), so recording never locks or allocates and is fine in the audio callback.
+    Until start() is called a ScopedEvent costs a flag check.
+ */
+class Trace
+{
+public:
+    /** Times the scope it's in. The name has to be a string literal, only the pointer is kept */
+    class ScopedEvent
+    {
+    public:
+        ScopedEvent(const char* name) noexcept;
+        ~ScopedEvent() noexcept;
+
+    private:
+        const char* const name;
+        int64 start; // 0 if it isn't being recorded
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedEvent)
+    };
+
+    /** Marks a moment, same rules for the name */
+    static void instant(const char* name) noexcept;
+
+    /** Throws away anything recorded before and starts again. Nothing should be recording while it's called */
+    static void start(int eventsPerThread = 1 << 15);
+    /** Stops recording, anything still inside a ScopedEvent is left out */
+    static void stop();
+    static bool isRecording() noexcept;
+
+    /** Writes everything recorded since start(), call it after stop() */
+    static Result writeJson(const File& file);
+
+    // threads after this many get nothing recorded, there's usually the analysis, the audio device and a table builder
+    static const int maxThreads = 16;
+};
+
+#endif /* defined(__SwivelAutotune__Trace__) */
@@ -9,72 +9,103 @@
 #ifndef SwivelAutotune_Windowing_h
 #define SwivelAutotune_Windowing_h
 #include <cmath>
-#include <Accelerate/Accelerate.h>
+#include <vector>
 #define TWOPI 2*M_PI
 
 /**
-    Provides access to vDSP window generation functions, using them to window a given vector.
+    Generates Hamming, Hann and Blackman windows and uses them to window a given vector.
     Could definitely involve less copy-paste.
-    vDSP includes only Hamming, Hann and Blackman windows.
+    These used to come from vDSP, they are plain loops now so the core builds anywhere. The windows
+    are cached so only the multiply happens per frame, and that vectorises fine on its own. The cache
+    is per thread, so strings on different threads (swivel-sweep's workers) can use different sizes.
  */
 class Windowing
 {
 public:
+    enum WindowType {
+        placeholder,
+        HANN,
+        HAMMING,
+        BLACKMAN,
+        RECTANGULAR
+    };
+    
+    /** Windows the input in place with the given type of window */
+    static void apply(WindowType type, double* input, int size)
+    {
+        switch (type)
+        {
+            case HANN:
+                hann(input, size);
+                break;
+                
+            case HAMMING:
+                hamming(input, size);
+                break;
+                
+            case BLACKMAN:
+                blkman(input, size);
+                break;
+                
+            case RECTANGULAR: // rectangular is no windowing
+            default: // default is no windowing
+                break;
+        }
+    }
+    
     static void hann(double* input, int size)
     {
-        static double* window = nullptr;
-        static int lastSize = 0;
-        if (lastSize != size)
+        static thread_local std::vector<double> window;
+        if ((int) window.size() != size)
         { // cache the actual window
-            if (window != nullptr) delete[] window;
-            window = new double[size];
+            window.resize(size);
             /*for (int i = 0; i < size; i++)
             {
                 window[i] = 0.5 * (1.0-cos((TWOPI*i)/size-1));
             }*/
-            vDSP_hann_windowD(window, size, vDSP_HANN_NORM);
+            for (int i = 0; i < size; i++)
+                window[i] = 0.5 * (1.0 - cos((TWOPI*i)/size));
         }
-        vDSP_vmulD(window, 1, input, 1, input, 1, size);
-        
-        lastSize = size;
+        multiply(window.data(), input, size);
     }
     
     static void hamming(double* input, int size)
     {
-        static double* window = nullptr;
-        static int lastSize = 0;
-        if (lastSize != size)
+        static thread_local std::vector<double> window;
+        if ((int) window.size() != size)
         { // cache the actual window
-            if (window != nullptr) delete[] window;
-            window = new double[size];
+            window.resize(size);
             /*for (int i = 0; i < size; i++)
              {
              window[i] = 0.5 * (1.0-cos((TWOPI*i)/size-1));
              }*/
-            vDSP_hamm_windowD(window, size, 0);
+            for (int i = 0; i < size; i++)
+                window[i] = 0.54 - 0.46 * cos((TWOPI*i)/size);
         }
-        vDSP_vmulD(window, 1, input, 1, input, 1, size);
-        
-        lastSize = size;
+        multiply(window.data(), input, size);
     }
     
     static void blkman(double* input, int size)
     {
-        static double* window = nullptr;
-        static int lastSize = 0;
-        if (lastSize != size)
+        static thread_local std::vector<double> window;
+        if ((int) window.size() != size)
         { // cache the actual window
-            if (window != nullptr) delete[] window;
-            window = new double[size];
+            window.resize(size);
             /*for (int i = 0; i < size; i++)
              {
              window[i] = 0.5 * (1.0-cos((TWOPI*i)/size-1));
              }*/
-            vDSP_blkman_windowD(window, size, 0);
+            for (int i = 0; i < size; i++)
+                window[i] = 0.42 - 0.5 * cos((TWOPI*i)/size) + 0.08 * cos((2*TWOPI*i)/size);
         }
-        vDSP_vmulD(window, 1, input, 1, input, 1, size);
-        
-        lastSize = size;
+        multiply(window.data(), input, size);
+    }
+    
+private:
+    static void multiply(const double* window, double* input, int size)
+    {
+        for (int i = 0; i < size; i++)
+            input[i] *= window[i];
     }
 };
 